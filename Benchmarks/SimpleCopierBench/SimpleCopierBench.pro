@@ -0,0 +1,45 @@
+# Console benchmarks for CopyLib, no Qt modules are needed
+QT -= core gui
+CONFIG += c++17 console
+CONFIG -= app_bundle qt
+
+TEMPLATE = app
+
+unix: LIBS += -pthread
+
+INCLUDEPATH += ../../SourceCode
+
+SOURCES += \
+    main.cpp \
+    workloads.cpp \
+    ../../SourceCode/bufferpool.cpp \
+    ../../SourceCode/copylib.cpp \
+    ../../SourceCode/copyengine.cpp \
+    ../../SourceCode/copyqueue.cpp \
+    ../../SourceCode/devicelimits.cpp \
+    ../../SourceCode/jobstats.cpp \
+    ../../SourceCode/journal.cpp \
+    ../../SourceCode/logger.cpp \
+    ../../SourceCode/progresscounters.cpp \
+    ../../SourceCode/tracer.cpp \
+    ../../SourceCode/treewalker.cpp \
+    ../../SourceCode/uringengine.cpp \
+    ../../SourceCode/verifier.cpp \
+    ../../SourceCode/workercontrol.cpp
+
+HEADERS += \
+    workloads.h \
+    ../../SourceCode/bufferpool.h \
+    ../../SourceCode/copylib.h \
+    ../../SourceCode/copyengine.h \
+    ../../SourceCode/copyqueue.h \
+    ../../SourceCode/devicelimits.h \
+    ../../SourceCode/jobstats.h \
+    ../../SourceCode/journal.h \
+    ../../SourceCode/logger.h \
+    ../../SourceCode/progresscounters.h \
+    ../../SourceCode/tracer.h \
+    ../../SourceCode/treewalker.h \
+    ../../SourceCode/uringengine.h \
+    ../../SourceCode/verifier.h \
+    ../../SourceCode/workercontrol.h
@@ -0,0 +1,583 @@
+//===================================================================================================================================
+//
+// SimpleCopierBench: console benchmarks for CopyLib.
+//
+// Usage: SimpleCopierBench [origin dir]
+// Without an origin dir a synthetic tree is generated in the temp dir and removed at the end.
+// Scans are repeated, so numbers are for a warm dentry cache, drop the caches between runs to see cold numbers.
+//
+// Usage: SimpleCopierBench --suite [--workloads tiny,huge,...] [--threads 1,2,4] [--scale X] [--seed N] [--json file]
+// Throughput suite: every workload tree (see workloads.h) is generated and copied by createCopyQueues + worker
+// threads for every thread count. Scan and copy times, files/sec and MB/sec go to the JSON file
+// (SimpleCopierBench.json by default), runs with the same seed and scale are comparable.
+//
+// Page cache benchmark (Linux): a 128 MiB file is copied through the page cache and by directCopyFile, the share
+// of the origin and the destination pages left in the cache is what other programs lose by a copy of huge files.
+//
+//===================================================================================================================================
+
+#include "copylib.h"
+#include "copyengine.h"
+#include "progresscounters.h"
+#include "workloads.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <ctime>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const uint32_t benchRepeats{ 3U };
+
+    // Synthetic tree: dirsPerLevel ^ levels leaf dirs, filesPerDir tiny files in every dir
+    const uint32_t levels{ 4U };
+    const uint32_t dirsPerLevel{ 8U };
+    const uint32_t filesPerDir{ 20U };
+
+    void createTree(const std::string & dir, const uint32_t level)
+    {
+        fs::create_directories(dir);
+        for (uint32_t i = 0U; i < filesPerDir; i++)
+        {
+            std::ofstream fout(dir + "file_" + std::to_string(i) + ".txt");
+            fout << i;
+        }
+        if (level < levels)
+        {
+            for (uint32_t i = 0U; i < dirsPerLevel; i++)
+            {
+                createTree(dir + "dir_" + std::to_string(i) + "/", level + 1U);
+            }
+        }
+    }
+
+    // Best of benchRepeats scans in seconds
+    double benchScan(const std::string & origin, const std::string & dest, const uint32_t scanThreadsNum,
+                     uint64_t & scopeSize, uint64_t & fileNum)
+    {
+        auto options = CopyLib::getCopyOptions();
+        options.scanThreadsNum = scanThreadsNum;
+        CopyLib::setCopyOptions(options);
+
+        const std::atomic<bool> copyCancel{ false };
+        double best{ 0.0 };
+        for (uint32_t i = 0U; i < benchRepeats; i++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const bool ret = CopyLib::createCopyQueues(origin, dest, 1U, scopeSize, fileNum, copyCancel);
+            const auto end = std::chrono::steady_clock::now();
+            CopyLib::removeCopyQueues();
+            if (!ret)
+            {
+                return 0.0;
+            }
+            const double time = std::chrono::duration<double>(end - start).count();
+            best = (i == 0U) ? time : std::min(best, time);
+        }
+        return best;
+    }
+
+    // One single thread copy of the tree, syscalls of the scan and the copy are counted by CopyLib
+    double benchCopy(const std::string & origin, const std::string & dest, uint64_t & fileNum, uint64_t & syscallsNum)
+    {
+        uint64_t scopeSize{ 0U };
+        const std::atomic<bool> copyCancel{ false };
+        const auto start = std::chrono::steady_clock::now();
+        if (!CopyLib::createCopyQueues(origin, dest, 1U, scopeSize, fileNum, copyCancel))
+        {
+            return 0.0;
+        }
+        CopyLib::copyDirStructure();
+        std::atomic<uint64_t> copiedFileSize{ 0U };
+        std::atomic<uint64_t> copiedFileNum{ 0U };
+        std::atomic<uint32_t> finishedThreadsNum{ 0U };
+        CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+        const auto end = std::chrono::steady_clock::now();
+        syscallsNum = CopyLib::getSyscallsNum();
+        CopyLib::removeCopyQueues();
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    // Progress updates of many workers copying tiny files: every thread adds a file size and a file per iteration
+    const uint64_t counterUpdates{ 2'000'000U };
+
+    // The totals shared by every worker, next to each other as in the GUI before
+    struct TSharedCounters
+    {
+        std::atomic<uint64_t> copiedSize{ 0U };
+        std::atomic<uint64_t> copiedNum{ 0U };
+    };
+
+    template<class TCounters>
+    double benchCounters(const uint32_t threadsNum, TCounters getCounters, uint64_t & copiedNum)
+    {
+        std::vector<std::thread> threads;
+        const auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0U; i < threadsNum; i++)
+        {
+            threads.emplace_back([i, &getCounters]()
+            {
+                auto & counters = getCounters(i);
+                for (uint64_t j = 0U; j < counterUpdates; j++)
+                {
+                    counters.copiedSize += 4096U;
+                    counters.copiedNum++;
+                }
+            });
+        }
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        copiedNum = 0U;
+        for (uint32_t i = 0U; i < threadsNum; i++)
+        {
+            copiedNum += getCounters(i).copiedNum;
+        }
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+#if defined(__linux__)
+
+    const uint64_t cacheFileSize{ 128ULL << 20U };
+
+    // Share of the file pages in the page cache, mincore of a mapping of the whole file
+    double getCachedShare(const std::string & path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return 0.0;
+        }
+        double share{ 0.0 };
+        struct stat fileStat{};
+        if (::fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            const size_t size = static_cast<size_t>(fileStat.st_size);
+            void * map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+                std::vector<unsigned char> pages((size + pageSize - 1U) / pageSize);
+                if (::mincore(map, size, pages.data()) == 0)
+                {
+                    const auto cached = std::count_if(pages.begin(), pages.end(), [](const unsigned char page) { return (page & 1U) != 0U; });
+                    share = static_cast<double>(cached) / pages.size();
+                }
+                ::munmap(map, size);
+            }
+        }
+        ::close(fd);
+        return share;
+    }
+
+    // Written back and dropped from the page cache, so every copy starts cold
+    void dropCachedPages(const std::string & path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            ::fdatasync(fd);
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+
+    // A big file copied by copyFile and by directCopyFile from a cold cache. The time includes fdatasync of the destination,
+    // otherwise the cached copy only measures the memory bandwidth and leaves the writes to the kernel.
+    bool benchPageCache(const std::string & dir)
+    {
+        const std::string origin = dir + "cache_origin.bin";
+        const std::string dest = dir + "cache_dest.bin";
+        {
+            std::ofstream fout(origin, std::ios::binary);
+            std::string block(1U << 20U, '\0');
+            for (uint64_t done = 0U; done < cacheFileSize && fout; done += block.size())
+            {
+                for (size_t i = 0U; i < block.size(); i++)
+                {
+                    block[i] = static_cast<char>((done + i) * 2654435761U >> 13U);
+                }
+                fout.write(block.data(), static_cast<std::streamsize>(block.size()));
+            }
+            if (!fout.good())
+            {
+                return false;
+            }
+        }
+
+        std::cout << "Page cache benchmark, " << (cacheFileSize >> 20U) << " MB file" << std::endl;
+        std::cout << std::setw(20) << "method" << std::setw(12) << "time, sec" << std::setw(12) << "MB/sec"
+                  << std::setw(16) << "origin cached" << std::setw(14) << "dest cached" << std::endl;
+        bool ret{ true };
+        for (const bool direct : { false, true })
+        {
+            std::error_code code;
+            fs::remove(dest, code);
+            dropCachedPages(origin);
+            CopyLib::TFileStat stat;
+            CopyLib::ECopyMethod method{ CopyLib::ECopyMethod::Count };
+            const auto start = std::chrono::steady_clock::now();
+            uint64_t size{ 0U };
+            bool copied = CopyLib::statFile(origin, stat, code);
+            copied = copied && (direct ? CopyLib::directCopyFile(origin, dest, stat, CopyLib::getCopyOptions().directBlockSize, code, method, size)
+                                       : CopyLib::copyFile(origin, dest, stat, code, method, size));
+            const int fd = ::open(dest.c_str(), O_RDONLY | O_CLOEXEC);
+            copied = copied && fd >= 0 && ::fdatasync(fd) == 0;
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            const double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!copied)
+            {
+                std::cout << "Error! Can not copy " << origin << ". " << code.message() << std::endl;
+                ret = false;
+                break;
+            }
+            std::cout << std::setw(20) << CopyLib::getCopyMethodName(method) << std::setw(12) << std::setprecision(4) << time
+                      << std::setw(12) << std::setprecision(1) << (cacheFileSize >> 20U) / time
+                      << std::setw(15) << std::setprecision(1) << getCachedShare(origin) * 100.0 << "%"
+                      << std::setw(13) << getCachedShare(dest) * 100.0 << "%" << std::endl;
+        }
+        std::error_code code;
+        fs::remove(origin, code);
+        fs::remove(dest, code);
+        return ret;
+    }
+
+#endif // __linux__
+
+    // Suite settings from the command line
+    struct TSuiteOptions
+    {
+        std::vector<std::string> workloads;
+        std::vector<uint32_t> threadNums;
+        double scale{ 1.0 };
+        uint64_t seed{ 20220701U };
+        std::string jsonFile{ "SimpleCopierBench.json" };
+    };
+
+    // One copy of a workload
+    struct TSuiteRun
+    {
+        uint32_t threads{ 0U };
+        double scanTime{ 0.0 };  // createCopyQueues
+        double copyTime{ 0.0 };  // copyDirStructure and the workers
+        uint64_t copiedNum{ 0U };
+        uint64_t copiedSize{ 0U };
+    };
+
+    std::vector<std::string> splitList(const std::string & list)
+    {
+        std::vector<std::string> items;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            if (!item.empty())
+            {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    // Scan and copy of origin into an empty dest with threadsNum queues and workers, false on a copy error
+    bool runSuiteCopy(const std::string & origin, const std::string & dest, const uint32_t threadsNum, TSuiteRun & run)
+    {
+        std::error_code code;
+        fs::remove_all(dest, code);
+        fs::create_directories(dest, code);
+        auto options = CopyLib::getCopyOptions();
+        options.scanThreadsNum = threadsNum;
+        CopyLib::setCopyOptions(options);
+
+        run = TSuiteRun{};
+        run.threads = threadsNum;
+        uint64_t scopeSize{ 0U };
+        uint64_t fileNum{ 0U };
+        const std::atomic<bool> copyCancel{ false };
+        const auto start = std::chrono::steady_clock::now();
+        if (!CopyLib::createCopyQueues(origin, dest, threadsNum, scopeSize, fileNum, copyCancel))
+        {
+            return false;
+        }
+        const auto scanned = std::chrono::steady_clock::now();
+        CopyLib::copyDirStructure();
+        CopyLib::TProgressCounters progress(threadsNum);
+        std::atomic<uint32_t> finishedThreadsNum{ 0U };
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0U; i < threadsNum; i++)
+        {
+            threads.emplace_back(CopyLib::worker, i, std::ref(progress[i].copiedSize), std::ref(progress[i].copiedNum),
+                                 std::ref(finishedThreadsNum), std::cref(copyCancel));
+        }
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const bool ret = !CopyLib::isCopyErrorHappened() && progress.getCopiedNum() == fileNum && progress.getCopiedSize() == scopeSize;
+        CopyLib::removeCopyQueues();
+
+        run.scanTime = std::chrono::duration<double>(scanned - start).count();
+        run.copyTime = std::chrono::duration<double>(end - scanned).count();
+        run.copiedNum = progress.getCopiedNum();
+        run.copiedSize = progress.getCopiedSize();
+        return ret;
+    }
+
+    int runSuite(const TSuiteOptions & options, const std::string & tempDir)
+    {
+        std::ostringstream json;
+        json << std::fixed << std::setprecision(6);
+        json << "{\n  \"suite\": \"SimpleCopierBench\",\n  \"timestamp\": " << std::time(nullptr)
+             << ",\n  \"hardware_concurrency\": " << std::thread::hardware_concurrency()
+             << ",\n  \"seed\": " << options.seed << ",\n  \"scale\": " << options.scale << ",\n  \"workloads\": [";
+
+        int retValue{ 0 };
+        bool firstWorkload{ true };
+        for (const auto & name : options.workloads)
+        {
+            const std::string origin = tempDir + name + "/";
+            const std::string dest = tempDir + "dest/";
+            Bench::TWorkloadStats stats;
+            std::error_code code;
+            fs::remove_all(origin, code);
+            std::cout << "Generating workload " << name << " in " << origin << std::endl;
+            if (!Bench::generateWorkload(name, origin, options.seed, options.scale, stats))
+            {
+                std::cout << "Error! Can not generate the workload " << name << "." << std::endl;
+                fs::remove_all(origin, code);
+                retValue = 1;
+                continue;
+            }
+            std::cout << "Workload " << name << ": " << stats.files << " files, " << std::fixed << std::setprecision(1) << stats.bytes / 1'048'576.0 << " MB, " << stats.dirs << " dirs" << std::endl;
+            std::cout << std::setw(10) << "threads" << std::setw(12) << "scan, sec" << std::setw(12) << "copy, sec"
+                      << std::setw(14) << "files/sec" << std::setw(12) << "MB/sec" << std::endl;
+
+            json << (firstWorkload ? "" : ",") << "\n    {\n      \"name\": \"" << name << "\",\n      \"files\": " << stats.files
+                 << ",\n      \"bytes\": " << stats.bytes << ",\n      \"dirs\": " << stats.dirs << ",\n      \"runs\": [";
+            firstWorkload = false;
+            bool firstRun{ true };
+            for (const auto threads : options.threadNums)
+            {
+                TSuiteRun run;
+                if (!runSuiteCopy(origin, dest, threads, run))
+                {
+                    std::cout << "Error! The copy of the workload " << name << " with " << threads << " threads is not complete." << std::endl;
+                    retValue = 1;
+                }
+                const double totalTime = std::max(run.scanTime + run.copyTime, 0.000001);
+                const double filesPerSec = run.copiedNum / totalTime;
+                const double mbPerSec = run.copiedSize / 1'048'576.0 / totalTime;
+                std::cout << std::setw(10) << threads << std::setw(12) << std::setprecision(4) << run.scanTime << std::setw(12) << run.copyTime
+                          << std::setw(14) << std::setprecision(0) << filesPerSec << std::setw(12) << std::setprecision(1) << mbPerSec << std::endl;
+                json << (firstRun ? "" : ",") << "\n        { \"threads\": " << threads << ", \"scan_sec\": " << run.scanTime
+                     << ", \"copy_sec\": " << run.copyTime << ", \"files_per_sec\": " << filesPerSec
+                     << ", \"mbytes_per_sec\": " << mbPerSec << ", \"files\": " << run.copiedNum << ", \"bytes\": " << run.copiedSize << " }";
+                firstRun = false;
+            }
+            json << "\n      ]\n    }";
+            fs::remove_all(origin, code);
+            fs::remove_all(dest, code);
+        }
+        json << "\n  ]\n}\n";
+
+        std::ofstream fout(options.jsonFile);
+        fout << json.str();
+        if (!fout.good())
+        {
+            std::cout << "Error! Can not write " << options.jsonFile << std::endl;
+            return 1;
+        }
+        std::cout << "Results: " << options.jsonFile << std::endl;
+        return retValue;
+    }
+
+}; // namespace
+
+//===================================================================================================================================
+
+int main(int argc, char *argv[])
+{
+    // Throughput suite
+    if (argc >= 2 && std::string(argv[1]) == "--suite")
+    {
+        TSuiteOptions options;
+        for (const auto & workload : Bench::getWorkloads())
+        {
+            options.workloads.push_back(workload.name);
+        }
+        for (uint32_t threads = 1U; threads <= std::max(4U, std::thread::hardware_concurrency()); threads *= 2U)
+        {
+            options.threadNums.push_back(threads);
+        }
+        for (int i = 2; i + 1 < argc; i += 2)
+        {
+            const std::string arg = argv[i];
+            const std::string value = argv[i + 1];
+            if (arg == "--workloads")
+            {
+                options.workloads = splitList(value);
+            }
+            else if (arg == "--threads")
+            {
+                options.threadNums.clear();
+                for (const auto & item : splitList(value))
+                {
+                    options.threadNums.push_back(std::max(1U, static_cast<uint32_t>(std::stoul(item))));
+                }
+            }
+            else if (arg == "--scale")
+            {
+                options.scale = std::stod(value);
+            }
+            else if (arg == "--seed")
+            {
+                options.seed = std::stoull(value);
+            }
+            else if (arg == "--json")
+            {
+                options.jsonFile = value;
+            }
+            else
+            {
+                std::cout << "Error! Unknown option " << arg << std::endl;
+                return 1;
+            }
+        }
+        const std::string suiteDir = (fs::temp_directory_path() / "SimpleCopierBenchSuite").string() + "/";
+        const int ret = runSuite(options, suiteDir);
+        std::error_code code;
+        fs::remove_all(suiteDir, code);
+        fs::remove(CopyLib::TLogger::getInstance().getLogFileName(), code);
+        return ret;
+    }
+
+    const std::string tempDir = (fs::temp_directory_path() / "SimpleCopierBench").string() + "/";
+    const bool synthetic = (argc < 2);
+    const std::string origin = synthetic ? tempDir + "origin/" : argv[1];
+    const std::string dest = tempDir + "dest/";
+
+    if (synthetic)
+    {
+        std::cout << "Generating synthetic tree in " << origin << std::endl;
+        createTree(origin, 1U);
+    }
+    fs::create_directories(dest);
+
+    // Scan scaling: 1, 2, 4 ... threads. Scan is latency bound, so more threads than cores are measured too.
+    const uint32_t maxThreads = std::max(8U, 2U * std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadNums;
+    for (uint32_t threads = 1U; threads <= maxThreads; threads *= 2U)
+    {
+        threadNums.push_back(threads);
+    }
+
+    std::cout << "Scan benchmark, origin: " << origin << std::endl;
+    std::cout << std::setw(10) << "threads" << std::setw(12) << "files" << std::setw(14) << "time, sec"
+              << std::setw(16) << "files/sec" << std::setw(10) << "speedup" << std::endl;
+    double baseTime{ 0.0 };
+    uint64_t baseFileNum{ 0U };
+    uint64_t baseScopeSize{ 0U };
+    int retValue{ 0 };
+    for (const auto threads : threadNums)
+    {
+        uint64_t scopeSize{ 0U };
+        uint64_t fileNum{ 0U };
+        const double time = benchScan(origin, dest, threads, scopeSize, fileNum);
+        if (time <= 0.0)
+        {
+            std::cout << "Error! Can not scan the origin dir." << std::endl;
+            retValue = 1;
+            break;
+        }
+        if (threads == 1U)
+        {
+            baseTime = time;
+            baseFileNum = fileNum;
+            baseScopeSize = scopeSize;
+        }
+        else if (fileNum != baseFileNum || scopeSize != baseScopeSize) // Parallel walk must see the same tree
+        {
+            std::cout << "Error! Totals differ from the single thread scan." << std::endl;
+            retValue = 1;
+        }
+        std::cout << std::setw(10) << threads << std::setw(12) << fileNum << std::setw(14) << std::fixed << std::setprecision(4) << time
+                  << std::setw(16) << std::setprecision(0) << fileNum / time << std::setw(10) << std::setprecision(2) << baseTime / time << std::endl;
+    }
+
+    // Small files copy is bound by metadata calls, the scan stat is reused by the workers
+    uint64_t fileNum{ 0U };
+    uint64_t syscallsNum{ 0U };
+    const double copyTime = benchCopy(origin, dest, fileNum, syscallsNum);
+    if (copyTime > 0.0 && fileNum > 0U)
+    {
+        std::cout << "Copy benchmark, 1 thread: " << fileNum << " files, " << std::setprecision(4) << copyTime << " sec, "
+                  << std::setprecision(1) << static_cast<double>(syscallsNum) / fileNum << " syscalls per file" << std::endl;
+    }
+    else
+    {
+        std::cout << "Error! Can not copy the origin dir." << std::endl;
+        retValue = 1;
+    }
+
+#if defined(__linux__)
+    // Copied through the cache, both files push the cached data of other programs out. Direct I/O leaves nothing behind.
+    if (!benchPageCache(tempDir))
+    {
+        retValue = 1;
+    }
+#endif
+
+    // Shared atomics bounce their cache line between the cores, per thread blocks stay in every core's cache
+    std::cout << "Progress counters benchmark, " << counterUpdates << " updates per thread" << std::endl;
+    std::cout << std::setw(10) << "threads" << std::setw(16) << "shared, sec" << std::setw(16) << "padded, sec"
+              << std::setw(10) << "speedup" << std::endl;
+    for (const auto threads : threadNums)
+    {
+        TSharedCounters shared;
+        CopyLib::TProgressCounters padded(threads);
+        uint64_t sharedNum{ 0U };
+        uint64_t paddedNum{ 0U };
+        const double sharedTime = benchCounters(threads, [&shared](const uint32_t) -> TSharedCounters & { return shared; }, sharedNum);
+        const double paddedTime = benchCounters(threads, [&padded](const uint32_t i) -> CopyLib::TWorkerCounters & { return padded[i]; }, paddedNum);
+        sharedNum /= threads; // Every thread sees the shared total
+        if (sharedNum != threads * counterUpdates || paddedNum != threads * counterUpdates)
+        {
+            std::cout << "Error! Counters lost updates." << std::endl;
+            retValue = 1;
+        }
+        std::cout << std::setw(10) << threads << std::setw(16) << std::setprecision(4) << sharedTime << std::setw(16) << paddedTime
+                  << std::setw(10) << std::setprecision(2) << sharedTime / paddedTime << std::endl;
+    }
+
+    fs::remove_all(dest);
+    if (synthetic)
+    {
+        fs::remove_all(tempDir);
+    }
+    fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+
+    return retValue;
+}
@@ -0,0 +1,211 @@
+
+#include "workloads.h"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+namespace fs = std::filesystem;
+
+namespace Bench {
+
+namespace {
+
+    const uint64_t kb{ 1024U };
+    const uint64_t mb{ 1024U * 1024U };
+
+    // Tree writer keeping the totals, the content of every file comes from the workload generator
+    class TTreeWriter
+    {
+    public:
+
+        TTreeWriter(const std::string & root, const uint64_t seed, TWorkloadStats & stats) : root(root), rng(seed), stats(stats) { }
+
+        // [from, to], modulo bias does not matter for a benchmark
+        uint64_t random(const uint64_t from, const uint64_t to)
+        {
+            return from + rng() % (to - from + 1U);
+        }
+
+        bool dir(const std::string & path)
+        {
+            std::error_code code;
+            fs::create_directories(root + path, code);
+            stats.dirs += path.empty() ? 0U : 1U; // The root is not counted
+            return !code;
+        }
+
+        bool file(const std::string & path, const uint64_t size)
+        {
+            std::ofstream fout(root + path, std::ios::binary);
+            if (!fout.is_open())
+            {
+                return false;
+            }
+            // Random content, so nothing is compressed or deduplicated on the way
+            buffer.resize(static_cast<size_t>(std::min<uint64_t>(size, mb) + 7U) / 8U);
+            for (uint64_t done = 0U; done < size; )
+            {
+                const uint64_t chunk = std::min<uint64_t>(size - done, buffer.size() * 8U);
+                for (size_t i = 0U; i < (chunk + 7U) / 8U; i++)
+                {
+                    buffer[i] = rng();
+                }
+                fout.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(chunk));
+                done += chunk;
+            }
+            stats.files++;
+            stats.bytes += size;
+            return fout.good();
+        }
+
+    private:
+
+        const std::string root;
+        std::mt19937_64 rng;
+        TWorkloadStats & stats;
+        std::vector<uint64_t> buffer;
+
+    }; // TTreeWriter
+
+    uint64_t scaled(const uint64_t num, const double scale)
+    {
+        return std::max<uint64_t>(1U, static_cast<uint64_t>(std::llround(static_cast<double>(num) * scale)));
+    }
+
+    // Metadata bound: 20000 files up to 4 KiB in 100 dirs
+    bool tinyFiles(TTreeWriter & writer, const double scale)
+    {
+        const uint64_t filesNum = scaled(20'000U, scale);
+        bool ret{ true };
+        for (uint64_t i = 0U; i < 100U && ret; i++)
+        {
+            ret = writer.dir("d" + std::to_string(i));
+        }
+        for (uint64_t i = 0U; i < filesNum && ret; i++)
+        {
+            ret = writer.file("d" + std::to_string(i % 100U) + "/f" + std::to_string(i), writer.random(0U, 4U * kb));
+        }
+        return ret;
+    }
+
+    // Bandwidth bound: 3 files of 48 MiB, fewer files than workers
+    bool hugeFiles(TTreeWriter & writer, const double scale)
+    {
+        bool ret = writer.dir("");
+        for (uint64_t i = 0U; i < 3U && ret; i++)
+        {
+            ret = writer.file("huge" + std::to_string(i), scaled(48U * mb, scale));
+        }
+        return ret;
+    }
+
+    // Walk bound: 4 chains of 64 nested dirs, 8 small files on every level
+    bool deepNesting(TTreeWriter & writer, const double scale)
+    {
+        const uint64_t filesPerDir = scaled(8U, scale);
+        bool ret{ true };
+        for (uint64_t chain = 0U; chain < 4U && ret; chain++)
+        {
+            std::string path = "chain" + std::to_string(chain);
+            for (uint64_t level = 0U; level < 64U && ret; level++)
+            {
+                path += "/l" + std::to_string(level);
+                ret = writer.dir(path);
+                for (uint64_t i = 0U; i < filesPerDir && ret; i++)
+                {
+                    ret = writer.file(path + "/f" + std::to_string(i), writer.random(kb, 16U * kb));
+                }
+            }
+        }
+        return ret;
+    }
+
+    // One directory with 20000 entries, a single walker task
+    bool wideDir(TTreeWriter & writer, const double scale)
+    {
+        const uint64_t filesNum = scaled(20'000U, scale);
+        bool ret = writer.dir("wide");
+        for (uint64_t i = 0U; i < filesNum && ret; i++)
+        {
+            ret = writer.file("wide/f" + std::to_string(i), writer.random(0U, 8U * kb));
+        }
+        return ret;
+    }
+
+    // Like a home dir: 90% up to 16 KiB, 9% up to 1 MiB, 1% up to 8 MiB, in a random tree 1-4 levels deep
+    bool mixedSizes(TTreeWriter & writer, const double scale)
+    {
+        const uint64_t filesNum = scaled(2'000U, scale);
+        std::vector<std::string> dirs{ "" };
+        bool ret = writer.dir("");
+        for (uint64_t i = 0U; i < 200U && ret; i++)
+        {
+            const std::string & parent = dirs[writer.random(0U, dirs.size() - 1U)];
+            if (std::count(parent.begin(), parent.end(), '/') >= 4)
+            {
+                continue;
+            }
+            dirs.push_back(parent + "d" + std::to_string(i) + "/");
+            ret = writer.dir(dirs.back());
+        }
+        for (uint64_t i = 0U; i < filesNum && ret; i++)
+        {
+            const uint64_t kind = writer.random(0U, 99U);
+            const uint64_t size = (kind < 90U) ? writer.random(0U, 16U * kb)
+                                               : (kind < 99U) ? writer.random(16U * kb, mb) : writer.random(mb, 8U * mb);
+            ret = writer.file(dirs[writer.random(0U, dirs.size() - 1U)] + "f" + std::to_string(i), size);
+        }
+        return ret;
+    }
+
+}; // namespace
+
+//===================================================================================================================================
+
+const std::vector<TWorkload> & getWorkloads()
+{
+    static const std::vector<TWorkload> workloads{
+        { "tiny",  "20000 files up to 4 KiB in 100 dirs" },
+        { "huge",  "3 files of 48 MiB" },
+        { "deep",  "4 chains of 64 nested dirs, 8 files of 1-16 KiB each" },
+        { "wide",  "20000 files up to 8 KiB in one dir" },
+        { "mixed", "2000 files: 90% to 16 KiB, 9% to 1 MiB, 1% to 8 MiB in a random tree" } };
+    return workloads;
+}
+
+//===================================================================================================================================
+
+bool generateWorkload(const std::string & name, const std::string & dir, const uint64_t seed, const double scale,
+                      TWorkloadStats & stats)
+{
+    stats = TWorkloadStats{};
+    TTreeWriter writer(dir, seed, stats);
+    if (name == "tiny")
+    {
+        return tinyFiles(writer, scale);
+    }
+    if (name == "huge")
+    {
+        return hugeFiles(writer, scale);
+    }
+    if (name == "deep")
+    {
+        return deepNesting(writer, scale);
+    }
+    if (name == "wide")
+    {
+        return wideDir(writer, scale);
+    }
+    if (name == "mixed")
+    {
+        return mixedSizes(writer, scale);
+    }
+    return false;
+}
+
+//===================================================================================================================================
+
+}; // namespace Bench
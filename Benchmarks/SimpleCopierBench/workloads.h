@@ -0,0 +1,37 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace Bench {
+
+    // Totals of a generated tree
+    struct TWorkloadStats
+    {
+        uint64_t files{ 0U };
+        uint64_t bytes{ 0U };
+        uint64_t dirs{ 0U };
+    };
+
+    // Synthetic tree shape. The same name, seed and scale give the same tree byte for byte on every platform:
+    // mt19937_64 output is fixed by the standard, and the sizes and the content come from it directly,
+    // not through the implementation-defined std:: distributions.
+    struct TWorkload
+    {
+        std::string name;
+        std::string description;
+    };
+
+    // tiny, huge, deep, wide, mixed
+    const std::vector<TWorkload> & getWorkloads();
+
+    // Generates the workload tree in dir (created, must not exist yet). scale multiplies the number of files
+    // (huge: their size). False if the name is not known or the tree can not be written.
+    bool generateWorkload(const std::string & name, const std::string & dir, const uint64_t seed, const double scale,
+                          TWorkloadStats & stats);
+
+} // namespace Bench
+
+#endif // WORKLOADS_H
@@ -0,0 +1,420 @@
+//===================================================================================================================================
+//
+// SimpleCopierCli: headless console copier on CopyLib, for servers and batch pipelines.
+//
+// Usage: SimpleCopierCli <origin dir> <destination dir> [options]
+// Progress lines go to stderr every --interval ms, the final summary is one JSON object on stdout.
+// Exit codes: 0 copied, 1 some files were not copied, 2 bad arguments, 3 the job can not be started, 130 canceled (Ctrl+C).
+//
+//===================================================================================================================================
+
+#include "copylib.h"
+#include "copyengine.h"
+#include "copyqueue.h"
+#include "uringengine.h"
+#include "workercontrol.h"
+#include "progresscounters.h"
+
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const double oneMb{ 1'048'576.0 };
+
+    // Set by Ctrl+C, the workers see it as the usual cancel
+    std::atomic<bool> copyCancel{ false };
+
+    void onInterrupt(int)
+    {
+        copyCancel.store(true);
+    }
+
+    struct TCliOptions
+    {
+        std::string origin;
+        std::string dest;
+        uint32_t threadsNum{ 0U }; // 0 is the hardware concurrency
+        uint32_t intervalMs{ 1000U };
+        bool streaming{ false };
+        bool ioUring{ false };
+        bool quiet{ false };
+    };
+
+    void printUsage()
+    {
+        std::cerr << "Usage: SimpleCopierCli <origin dir> <destination dir> [options]\n"
+                     "  --threads N       copy workers (queues), hardware concurrency by default\n"
+                     "  --scan-threads N  threads walking the origin tree\n"
+                     "  --streaming       copy while the origin is scanned\n"
+                     "  --io-uring        io_uring workers (--uring-threads N, --uring-depth N)\n"
+                     "  --sync            skip unchanged files (--checksum compares their content)\n"
+                     "  --delta           rewrite only changed blocks of big files\n"
+                     "  --direct MB       files from MB MiB bypass the page cache (O_DIRECT)\n"
+                     "  --journal         resumable job\n"
+                     "  --keep-partial    keep files interrupted by cancel\n"
+                     "  --verify          CRC32C of every copy (--verify-threads N)\n"
+                     "  --dedup           link identical files to one copy\n"
+                     "  --adaptive        adapt the active worker count to the throughput\n"
+                     "  --stats FILE      job stats, rewritten every interval (--stats-format json|prometheus)\n"
+                     "  --trace FILE      Chrome trace of the job (chrome://tracing, ui.perfetto.dev)\n"
+                     "  --interval MS     progress period, 0 disables the progress lines\n"
+                     "  --quiet           no progress lines\n";
+    }
+
+    bool parseNumber(const std::string & text, uint32_t & value)
+    {
+        try
+        {
+            size_t pos{ 0U };
+            const unsigned long number = std::stoul(text, &pos);
+            if (pos != text.size() || number > UINT32_MAX)
+            {
+                return false;
+            }
+            value = static_cast<uint32_t>(number);
+            return true;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    // False for a bad command line, CopyLib options are set along the way
+    bool parseArgs(const int argc, char *argv[], TCliOptions & options, CopyLib::TCopyOptions & copyOptions)
+    {
+        std::vector<std::string> positional;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            const auto number = [&](uint32_t & value)
+            {
+                return (i + 1 < argc) && parseNumber(argv[++i], value);
+            };
+            bool ret{ true };
+            uint32_t directMb{ 0U };
+            if (arg == "--threads")             { ret = number(options.threadsNum); }
+            else if (arg == "--scan-threads")   { ret = number(copyOptions.scanThreadsNum); }
+            else if (arg == "--uring-threads")  { ret = number(copyOptions.uringThreadsNum); }
+            else if (arg == "--uring-depth")    { ret = number(copyOptions.uringQueueDepth); }
+            else if (arg == "--verify-threads") { ret = number(copyOptions.verifyThreadsNum); }
+            else if (arg == "--interval")       { ret = number(options.intervalMs); }
+            else if (arg == "--streaming")      { options.streaming = true; }
+            else if (arg == "--io-uring")       { options.ioUring = true; }
+            else if (arg == "--sync")           { copyOptions.sync = true; }
+            else if (arg == "--checksum")       { copyOptions.syncChecksum = true; }
+            else if (arg == "--delta")          { copyOptions.delta = true; }
+            else if (arg == "--direct")         { ret = number(directMb); copyOptions.directThreshold = static_cast<uint64_t>(directMb) << 20U; }
+            else if (arg == "--journal")        { copyOptions.journal = true; }
+            else if (arg == "--keep-partial")   { copyOptions.partialFiles = CopyLib::EPartialFilePolicy::Keep; }
+            else if (arg == "--verify")         { copyOptions.verify = true; }
+            else if (arg == "--dedup")          { copyOptions.dedup = true; }
+            else if (arg == "--adaptive")       { copyOptions.adaptiveWorkers = true; }
+            else if (arg == "--quiet")          { options.quiet = true; }
+            else if (arg == "--stats")          { ret = (i + 1 < argc); copyOptions.statsFile = ret ? argv[++i] : ""; }
+            else if (arg == "--trace")          { ret = (i + 1 < argc); copyOptions.traceFile = ret ? argv[++i] : ""; }
+            else if (arg == "--stats-format")
+            {
+                const std::string format = (i + 1 < argc) ? argv[++i] : "";
+                ret = (format == "json" || format == "prometheus");
+                copyOptions.statsFormat = (format == "prometheus") ? CopyLib::EStatsFormat::Prometheus : CopyLib::EStatsFormat::Json;
+            }
+            else if (arg.rfind("--", 0U) == 0U) { ret = false; }
+            else                                { positional.push_back(arg); }
+            if (!ret)
+            {
+                std::cerr << "Error! Bad option: " << arg << std::endl;
+                return false;
+            }
+        }
+        if (positional.size() != 2U)
+        {
+            return false;
+        }
+        options.origin = positional[0];
+        options.dest = positional[1];
+        copyOptions.syncChecksum = copyOptions.sync && copyOptions.syncChecksum;
+        return true;
+    }
+
+    std::string jsonString(const std::string & text)
+    {
+        std::ostringstream out;
+        out << '"';
+        for (const char c : text)
+        {
+            switch (c)
+            {
+            case '"':  out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20U)
+                {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+                }
+                else
+                {
+                    out << c;
+                }
+            }
+        }
+        out << '"';
+        return out.str();
+    }
+
+    // What the job did, printed as JSON
+    struct TSummary
+    {
+        std::string status{ "done" }; // done, errors, canceled, failed
+        uint32_t threadsNum{ 0U };
+        double seconds{ 0.0 };
+        uint64_t scopeSize{ 0U };
+        uint64_t fileNum{ 0U };
+        uint64_t copiedSize{ 0U };
+        uint64_t copiedNum{ 0U };
+    };
+
+    void printSummary(const TCliOptions & options, const CopyLib::TCopyOptions & copyOptions, const TSummary & summary)
+    {
+        const double seconds = std::max(summary.seconds, 0.000001);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3);
+        out << "{\"status\":" << jsonString(summary.status)
+            << ",\"origin\":" << jsonString(options.origin)
+            << ",\"destination\":" << jsonString(options.dest)
+            << ",\"threads\":" << summary.threadsNum
+            << ",\"mode\":{\"streaming\":" << std::boolalpha << options.streaming
+            << ",\"io_uring\":" << options.ioUring
+            << ",\"sync\":" << copyOptions.sync
+            << ",\"checksum\":" << copyOptions.syncChecksum
+            << ",\"delta\":" << copyOptions.delta
+            << ",\"direct\":" << (copyOptions.directThreshold != 0U)
+            << ",\"journal\":" << copyOptions.journal
+            << ",\"keep_partial\":" << (copyOptions.partialFiles == CopyLib::EPartialFilePolicy::Keep)
+            << ",\"verify\":" << copyOptions.verify
+            << ",\"dedup\":" << copyOptions.dedup
+            << ",\"adaptive\":" << copyOptions.adaptiveWorkers << std::noboolalpha << "}"
+            << ",\"seconds\":" << summary.seconds
+            << ",\"files_planned\":" << summary.fileNum
+            << ",\"bytes_planned\":" << summary.scopeSize
+            << ",\"files_copied\":" << summary.copiedNum
+            << ",\"bytes_copied\":" << summary.copiedSize
+            << ",\"mbytes_per_sec\":" << summary.copiedSize / oneMb / seconds
+            << ",\"files_per_sec\":" << summary.copiedNum / seconds
+            << ",\"skipped_files\":" << CopyLib::getSkippedFileNum()
+            << ",\"skipped_bytes\":" << CopyLib::getSkippedFileSize()
+            << ",\"written_bytes\":" << CopyLib::getWrittenFileSize()
+            << ",\"dedup_files\":" << CopyLib::getDedupFileNum()
+            << ",\"dedup_saved_bytes\":" << CopyLib::getDedupSavedSize()
+            << ",\"verified_bytes\":" << CopyLib::getVerifiedFileSize()
+            << ",\"verify_mismatches\":" << CopyLib::getVerifyMismatchNum()
+            << ",\"resumed_files\":" << CopyLib::getResumedFileNum()
+            << ",\"resumed_bytes\":" << CopyLib::getResumedFileSize()
+            << ",\"syscalls\":" << CopyLib::getSyscallsNum()
+            << ",\"methods\":{";
+        for (uint32_t i = 0U; i < static_cast<uint32_t>(CopyLib::ECopyMethod::Count); i++)
+        {
+            const auto method = static_cast<CopyLib::ECopyMethod>(i);
+            out << (i == 0U ? "" : ",") << jsonString(CopyLib::getCopyMethodName(method)) << ":" << CopyLib::getCopyMethodFilesNum(method);
+        }
+        out << "},\"log\":" << jsonString(CopyLib::TLogger::getInstance().getLogFileName()) << "}";
+        std::cout << out.str() << std::endl;
+    }
+
+    // Scan, workers, verifiers and joins as the GUI controller does them. False if the job is not started.
+    bool runJob(const TCliOptions & options, const uint32_t hardwConcur, TSummary & summary)
+    {
+        const auto copyOptions = CopyLib::getCopyOptions();
+        const uint32_t workersNum = (options.threadsNum != 0U) ? options.threadsNum : hardwConcur;
+        std::atomic<uint64_t> scopeSize{ 0U };
+        std::atomic<uint64_t> fileNum{ 0U };
+        const auto start = std::chrono::steady_clock::now();
+        bool ret{ false };
+        if (options.streaming)
+        {
+            ret = CopyLib::openCopyQueues(options.origin, options.dest, workersNum);
+        }
+        else
+        {
+            uint64_t planSize{ 0U };
+            uint64_t planFileNum{ 0U };
+            ret = CopyLib::createCopyQueues(options.origin, options.dest, workersNum, planSize, planFileNum, copyCancel);
+            scopeSize.store(planSize);
+            fileNum.store(planFileNum);
+        }
+        if (!ret)
+        {
+            return false;
+        }
+
+        std::thread scanThread;
+        if (options.streaming)
+        {
+            scanThread = std::thread(CopyLib::scanner, std::ref(scopeSize), std::ref(fileNum), std::ref(copyCancel));
+        }
+        else
+        {
+            CopyLib::copyDirStructure();
+        }
+
+        // The rings copy through the page cache
+        const bool ioUring = options.ioUring && CopyLib::isIoUringAvailable() && !copyOptions.delta && copyOptions.directThreshold == 0U;
+        const uint32_t threadsNum = ioUring ? std::clamp(copyOptions.uringThreadsNum, 1U, hardwConcur)
+                                            : CopyLib::TCopyQueues::getInstance().getQueuesNum();
+        const auto workerFun = ioUring ? CopyLib::uringWorker : CopyLib::worker;
+        CopyLib::TProgressCounters progress(threadsNum);
+        std::atomic<uint32_t> finishedThreadsNum{ 0U };
+        std::vector<std::thread> threads;
+        if (options.streaming || (!CopyLib::isCopyErrorHappened() && fileNum > 0U))
+        {
+            for (uint32_t i = 0U; i < threadsNum; i++)
+            {
+                threads.emplace_back(workerFun, i, std::ref(progress[i].copiedSize), std::ref(progress[i].copiedNum),
+                                     std::ref(finishedThreadsNum), std::cref(copyCancel));
+            }
+        }
+        std::atomic<uint32_t> finishedVerifiersNum{ 0U };
+        std::vector<std::thread> verifyThreads;
+        if (copyOptions.verify && !threads.empty())
+        {
+            for (uint32_t i = 0U; i < std::max(copyOptions.verifyThreadsNum, 1U); i++)
+            {
+                verifyThreads.emplace_back(CopyLib::verifier, std::ref(finishedVerifiersNum), std::cref(copyCancel));
+            }
+        }
+
+        // Progress lines, the adaptive controller is fed at the same pace
+        auto & control = CopyLib::TWorkerControl::getInstance();
+        const auto tick = std::chrono::milliseconds(std::min(options.intervalMs == 0U ? 100U : options.intervalMs, 100U));
+        auto lastPrint = start;
+        auto lastStats = start;
+        uint64_t lastSize{ 0U };
+        bool verifyFinishing{ false };
+        while ((finishedThreadsNum != threads.size() || finishedVerifiersNum != verifyThreads.size()) && !copyCancel)
+        {
+            std::this_thread::sleep_for(tick);
+            if (!verifyFinishing && finishedThreadsNum == threads.size())
+            {
+                CopyLib::finishVerify();
+                verifyFinishing = true;
+            }
+            const uint64_t copiedSize = progress.getCopiedSize();
+            if (control.isAdaptive())
+            {
+                control.update(copiedSize, progress.getCopiedNum());
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (options.intervalMs != 0U && now - lastStats >= std::chrono::milliseconds(options.intervalMs))
+            {
+                CopyLib::saveJobStats(); // No file without --stats, the final one is saved by removeCopyQueues
+                lastStats = now;
+            }
+            if (!options.quiet && options.intervalMs != 0U && now - lastPrint >= std::chrono::milliseconds(options.intervalMs))
+            {
+                const double interval = std::chrono::duration<double>(now - lastPrint).count();
+                const double elapsed = std::chrono::duration<double>(now - start).count();
+                std::cerr << std::fixed << std::setprecision(1) << elapsed << " s: " << progress.getCopiedNum() << "/" << fileNum
+                          << " files, " << copiedSize / oneMb << "/" << scopeSize / oneMb << " MB, "
+                          << (copiedSize - lastSize) / oneMb / interval << " MB/s"
+                          << (CopyLib::TCopyQueues::getInstance().isScanning() ? ", scanning" : "")
+                          << (control.isAdaptive() ? ", workers " + std::to_string(control.getActiveNum()) + "/" + std::to_string(control.getWorkersNum()) : std::string())
+                          << std::endl;
+                lastPrint = now;
+                lastSize = copiedSize;
+            }
+        }
+
+        if (scanThread.joinable())
+        {
+            scanThread.join();
+        }
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+        CopyLib::finishVerify();
+        for (auto & verifyThread : verifyThreads)
+        {
+            verifyThread.join();
+        }
+        CopyLib::removeCopyQueues();
+
+        summary.threadsNum = threadsNum;
+        summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        summary.scopeSize = scopeSize;
+        summary.fileNum = fileNum;
+        summary.copiedSize = progress.getCopiedSize();
+        summary.copiedNum = progress.getCopiedNum();
+        summary.status = copyCancel ? "canceled" : (CopyLib::isCopyErrorHappened() ? "errors" : "done");
+        return true;
+    }
+
+}; // namespace
+
+//===================================================================================================================================
+
+int main(int argc, char *argv[])
+{
+    const uint32_t hardwConcur = std::max(std::thread::hardware_concurrency(), 1U);
+    TCliOptions options;
+    auto copyOptions = CopyLib::getCopyOptions();
+    copyOptions.scanThreadsNum = hardwConcur;
+    if (!parseArgs(argc, argv, options, copyOptions))
+    {
+        printUsage();
+        return 2;
+    }
+    CopyLib::setCopyOptions(copyOptions);
+
+    std::error_code code;
+    if (!fs::is_directory(options.origin, code) || !fs::is_directory(options.dest, code))
+    {
+        std::cerr << "Error! Origin or destination directory does not exist." << std::endl;
+        return 2;
+    }
+    if (fs::equivalent(options.origin, options.dest, code))
+    {
+        std::cerr << "Error! Origin directory must not be equal destination directory." << std::endl;
+        return 2;
+    }
+
+    std::signal(SIGINT, onInterrupt);
+    std::signal(SIGTERM, onInterrupt);
+
+    TSummary summary;
+    if (!runJob(options, hardwConcur, summary))
+    {
+        if (copyCancel) // Ctrl+C during the scan
+        {
+            summary.status = "canceled";
+            printSummary(options, copyOptions, summary);
+            return 130;
+        }
+        summary.status = "failed";
+        std::cerr << "Error! Can not create copy files queues. Probably access denied (for origin dir)." << std::endl;
+        printSummary(options, copyOptions, summary);
+        return 3;
+    }
+    printSummary(options, copyOptions, summary);
+    if (summary.status == "canceled")
+    {
+        return 130;
+    }
+    return (summary.status == "errors") ? 1 : 0;
+}
@@ -1,12 +1,30 @@
 
 #include "gtest/gtest.h"
 #include "../../../SourceCode/copylib.h"
+#include "../../../SourceCode/copyqueue.h"
+#include "../../../SourceCode/copyengine.h"
+#include "../../../SourceCode/uringengine.h"
+#include "../../../SourceCode/journal.h"
+#include "../../../SourceCode/verifier.h"
+#include "../../../SourceCode/workercontrol.h"
+#include "../../../SourceCode/devicelimits.h"
+#include "../../../SourceCode/progresscounters.h"
+#include "../../../SourceCode/jobstats.h"
+#include "../../../SourceCode/tracer.h"
+#include "../../../SourceCode/bufferpool.h"
 
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <sstream>
 
 namespace fs = std::filesystem;
 
+// Scans of the tests are not canceled, except the one of createCopyQueues_Canceled
+static const std::atomic<bool> noCancel{ false };
+
 //======================================================================================================
 
 TEST(CopyLibTests, isCopyErrorHappened)
@@ -16,24 +34,6 @@ TEST(CopyLibTests, isCopyErrorHappened)
 
 //======================================================================================================
 
-TEST(CopyLibTests, getTempFN)
-{
-	const auto libFN = CopyLib::getTempFN();
-	const std::string tempFNEtalon = "copy_plan_";
-	EXPECT_TRUE(libFN == tempFNEtalon);
-}
-
-//======================================================================================================
-
-TEST(CopyLibTests, getTempExten)
-{
-	const auto libExtension = CopyLib::getTempExten();
-	const std::string tempExtenEtalon = ".txt";
-	EXPECT_TRUE(libExtension == tempExtenEtalon);
-}
-
-//======================================================================================================
-
 TEST(CopyLibTests, isEnoughSpace) 
 {
 	const std::string tempDir = fs::temp_directory_path().string();
@@ -49,68 +49,74 @@ TEST(CopyLibTests, isEnoughSpace)
 
 //======================================================================================================
 
-TEST(CopyLibTests, removeCopyQueues_OneFile)
+TEST(CopyLibTests, removeCopyQueues_OneQueue)
 {
-	const std::string tempDir = fs::temp_directory_path().string();
-	const std::string fileName = tempDir + CopyLib::getTempFN() + std::to_string(0) + CopyLib::getTempExten();
-	std::ofstream fout(fileName);
-	ASSERT_TRUE(fout.is_open());
-	if (fout.is_open())
+	auto& queues = CopyLib::TCopyQueues::getInstance();
+	ASSERT_TRUE(queues.reset(1U, "origin", "dest"));
+	queues.push(0U, { "file", 1U });
+	EXPECT_EQ(queues.getTasksNum(0U), 1U);
+
+	CopyLib::removeCopyQueues();
+
+	EXPECT_EQ(queues.getQueuesNum(), 0U);
+	EXPECT_TRUE(queues.getOrigin().empty());
+	EXPECT_TRUE(queues.getDest().empty());
+	CopyLib::TCopyTask task;
+	EXPECT_FALSE(queues.pop(0U, task));
+}
+
+TEST(CopyLibTests, removeCopyQueues_ManyQueues)
+{
+	const uint32_t hardwConcur = 8U;
+	auto& queues = CopyLib::TCopyQueues::getInstance();
+	ASSERT_TRUE(queues.reset(hardwConcur, "origin", "dest"));
+	for (uint32_t i = 0U; i < hardwConcur; i++)
 	{
-		fout << fileName << std::endl;
-		fout.close();
+		queues.push(i, { "Some file " + std::to_string(i), i });
+		EXPECT_EQ(queues.getTasksNum(i), 1U);
 	}
 
-	EXPECT_TRUE(fs::exists(fileName));
+	CopyLib::removeCopyQueues();
 
-	const uint32_t concur = 1U;
-	CopyLib::removeCopyQueues(concur);
-
-	EXPECT_FALSE(fs::exists(fileName));
+	EXPECT_EQ(queues.getQueuesNum(), 0U);
+	for (uint32_t i = 0U; i < hardwConcur; i++)
+	{
+		EXPECT_EQ(queues.getTasksNum(i), 0U);
+	}
 }
 
-TEST(CopyLibTests, removeCopyQueues_ManyFiles)
+TEST(CopyLibTests, copyQueues_WorkStealing)
 {
-    const uint32_t hardwConcur = 8U;
-    std::ofstream* fplan = new (std::nothrow) std::ofstream[hardwConcur];
-    ASSERT_TRUE(fplan != nullptr);
-	if (fplan != nullptr)
+	const uint32_t queuesNum = 4U;
+	const uint32_t tasksNum = 10U;
+	auto& queues = CopyLib::TCopyQueues::getInstance();
+	ASSERT_TRUE(queues.reset(queuesNum, "origin", "dest"));
+	for (uint32_t i = 0U; i < tasksNum; i++)
 	{
-		const std::string tempDir = fs::temp_directory_path().string();
-		std::vector<std::string> fileNames;
-		fileNames.reserve(hardwConcur);
-		std::string path;
-		for (size_t i = 0U; i < hardwConcur; i++)
-		{
-			path = tempDir + CopyLib::getTempFN() + std::to_string(i) + CopyLib::getTempExten();
-			fileNames.push_back(path);
-		}
-
-		for (size_t i = 0U; i < hardwConcur; i++)
-		{
-			fplan[i].open(fileNames[i]);
-			ASSERT_TRUE(fplan[i].is_open());
-		}
-
-		for (size_t i = 0; i < hardwConcur; i++)
-		{
-			fplan[i] << "Some info" << std::endl;
-			fplan[i].close();
-		}
-		delete[] fplan;
-
-		for (size_t i = 0; i < hardwConcur; i++)
-		{
-			EXPECT_TRUE(fs::exists(fileNames[i]));
-		}
-
-		CopyLib::removeCopyQueues(hardwConcur);
+		queues.push(0U, { "file" + std::to_string(i), i });
+	}
 
-		for (size_t i = 0; i < hardwConcur; i++)
-		{
-			EXPECT_FALSE(fs::exists(fileNames[i]));
-		}
+	// Owner takes from the front
+	CopyLib::TCopyTask task;
+	ASSERT_TRUE(queues.pop(0U, task));
+	EXPECT_EQ(task.file, "file0");
+
+	// An idle worker steals a half from the back and keeps the rest of the loot
+	ASSERT_TRUE(queues.pop(3U, task));
+	EXPECT_EQ(task.file, "file5");
+	EXPECT_EQ(queues.getStolenTasksNum(), 5U);
+	EXPECT_EQ(queues.getTasksNum(0U), 4U);
+	EXPECT_EQ(queues.getTasksNum(3U), 4U);
+
+	// Everything is drained by any worker in the end
+	uint32_t popped{ 2U };
+	while (queues.pop(1U, task))
+	{
+		popped++;
 	}
+	EXPECT_EQ(popped, tasksNum);
+
+	CopyLib::removeCopyQueues();
 }
 
 //======================================================================================================
@@ -143,14 +149,11 @@ TEST(CopyLibTests, copyDirStructure_ManyFolders)
 
 	fs::create_directories(dest);
 
-	const auto pathFirstQueue = tempDir + CopyLib::getTempFN() + "0" + CopyLib::getTempExten();
-	std::ofstream fout(pathFirstQueue);
-	ASSERT_TRUE(fout.is_open());
-	if (fout.is_open())
+	// Enough dirs on one level for several threads
+	const uint32_t manyDirsNum{ 300U };
+	for (uint32_t i = 0U; i < manyDirsNum; i++)
 	{
-		fout << origin << std::endl;
-		fout << dest << std::endl;
-		fout.close();
+		fs::create_directories(origin + "many/" + std::to_string(i) + "/sub");
 	}
 
 	ASSERT_TRUE(fs::exists(originDir1));
@@ -158,15 +161,33 @@ TEST(CopyLibTests, copyDirStructure_ManyFolders)
 	ASSERT_TRUE(fs::exists(originDir3));
 	ASSERT_TRUE(fs::exists(originDir4));
 
+	// Dirs are taken from the scan of createCopyQueues, the origin is not walked again
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.scanThreadsNum = 4U;
+	CopyLib::setCopyOptions(options);
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(origin, dest, 1U, scopeSize, fileNum, noCancel));
+	fs::create_directories(origin + "after_scan");
 	CopyLib::copyDirStructure();
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
 
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
 	EXPECT_TRUE(fs::exists(destDir1));
 	EXPECT_TRUE(fs::exists(destDir2));
 	EXPECT_TRUE(fs::exists(destDir3));
 	EXPECT_TRUE(fs::exists(destDir4));
+	for (uint32_t i = 0U; i < manyDirsNum; i++)
+	{
+		EXPECT_TRUE(fs::is_directory(dest + "many/" + std::to_string(i) + "/sub")) << i;
+	}
+	EXPECT_FALSE(fs::exists(dest + "after_scan"));
 
 	fs::remove_all(origin);
 	fs::remove_all(dest);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
 
 	EXPECT_FALSE(fs::exists(origin));
 	EXPECT_FALSE(fs::exists(dest));
@@ -209,6 +230,57 @@ TEST(CopyLibTests, logger)
 
 //======================================================================================================
 
+TEST(CopyLibTests, logger_ManyThreads)
+{
+	auto & logger = CopyLib::TLogger::getInstance();
+	logger.startLogging();
+	const uint32_t threadsNum{ 4U };
+	const uint32_t messagesNum{ 20'000U };
+	std::atomic<uint64_t> logged{ 0U };
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < threadsNum; i++)
+	{
+		threads.emplace_back([&logger, &logged, i]()
+		{
+			for (uint32_t j = 0U; j < messagesNum; j++)
+			{
+				logged += logger.logMessage("Thread " + std::to_string(i) + ", message " + std::to_string(j)) ? 1U : 0U;
+			}
+		});
+	}
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	const uint64_t dropped = logger.getDroppedNum();
+	logger.finishLogging();
+	EXPECT_EQ(logged + dropped, threadsNum * messagesNum);
+
+	// Every accepted message is written once, numbered in order, the dropped ones are counted at the end
+	std::ifstream fin(logger.getLogFileName());
+	ASSERT_TRUE(fin.is_open());
+	std::string line;
+	std::string lastLine;
+	uint64_t lines{ 0U };
+	bool numbered{ true };
+	while (std::getline(fin, line))
+	{
+		lines++;
+		numbered = numbered && line.rfind(std::to_string(lines) + ": ", 0U) == 0U;
+		lastLine = line;
+	}
+	EXPECT_TRUE(numbered);
+	EXPECT_EQ(lines, logged + (dropped > 0U ? 1U : 0U));
+	if (dropped > 0U)
+	{
+		EXPECT_NE(lastLine.find(std::to_string(dropped) + " messages were dropped"), std::string::npos);
+	}
+	fin.close();
+	fs::remove(logger.getLogFileName());
+}
+
+//======================================================================================================
+
 TEST(CopyLibTests, createCopyQueues_False)
 {
 	const auto tempDir = fs::temp_directory_path().string();
@@ -226,30 +298,30 @@ TEST(CopyLibTests, createCopyQueues_False)
 	uint64_t fileNum{ 0U };
 	
 	// (1) hardwConcur = 0
-	ret = CopyLib::createCopyQueues(originDir, destDir, 0U, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues(originDir, destDir, 0U, scopeSize, fileNum, noCancel);
 	EXPECT_FALSE(ret);
 
 	// (2) origin is empty
 	const uint32_t hardwConcur{ 8U };
-	ret = CopyLib::createCopyQueues("", destDir, hardwConcur, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues("", destDir, hardwConcur, scopeSize, fileNum, noCancel);
 	EXPECT_FALSE(ret);
 
 	// (3) dest is empty
-	ret = CopyLib::createCopyQueues(originDir, "", hardwConcur, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues(originDir, "", hardwConcur, scopeSize, fileNum, noCancel);
 	EXPECT_FALSE(ret);
 
 	// (4) origin is not existing
 	const auto notExistingDir = tempDir + "notExistingDir/";
 	ASSERT_FALSE(fs::exists(notExistingDir));
-	ret = CopyLib::createCopyQueues(notExistingDir, destDir, hardwConcur, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues(notExistingDir, destDir, hardwConcur, scopeSize, fileNum, noCancel);
 	EXPECT_FALSE(ret);
 
 	// (5) dest is not existing
-	ret = CopyLib::createCopyQueues(originDir, notExistingDir, hardwConcur, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues(originDir, notExistingDir, hardwConcur, scopeSize, fileNum, noCancel);
 	EXPECT_FALSE(ret);
 
 	// (6) origin is equal dest
-	ret = CopyLib::createCopyQueues(originDir, originDir, hardwConcur, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues(originDir, originDir, hardwConcur, scopeSize, fileNum, noCancel);
 	EXPECT_FALSE(ret);
 
 	fs::remove_all(originDir);
@@ -259,6 +331,39 @@ TEST(CopyLibTests, createCopyQueues_False)
 	EXPECT_FALSE(fs::exists(destDir));
 }
 
+// Cancel clicked during the scan stops it, no queues are made
+TEST(CopyLibTests, createCopyQueues_Canceled)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir + "dir/subdir");
+	fs::create_directories(destDir);
+	for (const auto & file : { "file", "dir/file", "dir/subdir/file" })
+	{
+		std::ofstream fout(originDir + file, std::ios::binary);
+		fout << "content";
+	}
+
+	const std::atomic<bool> copyCancel{ true };
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	EXPECT_FALSE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, copyCancel));
+	EXPECT_EQ(fileNum, 0U);
+	EXPECT_EQ(scopeSize, 0U);
+	const auto& queues = CopyLib::TCopyQueues::getInstance();
+	EXPECT_EQ(queues.getTasksNum(0U) + queues.getTasksNum(1U), 0U);
+
+	// The next job is not canceled
+	EXPECT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(fileNum, 3U);
+	CopyLib::removeCopyQueues();
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
 TEST(CopyLibTests, createCopyQueues_True_OneFileConcur1)
 {
 	// Create dirs and test file
@@ -290,33 +395,26 @@ TEST(CopyLibTests, createCopyQueues_True_OneFileConcur1)
 	uint64_t fileNum{ 0ULL };
 
 	const uint32_t hardwConcur{ 1U };
-	ret = CopyLib::createCopyQueues(originDir, destDir, hardwConcur, scopeSize, fileNum);
+	ret = CopyLib::createCopyQueues(originDir, destDir, hardwConcur, scopeSize, fileNum, noCancel);
 	EXPECT_TRUE(ret);
 	EXPECT_EQ(fileNum, 1U);
 	const uint64_t testFileSize{ 100ULL };
 	EXPECT_EQ(scopeSize, testFileSize);
 
-	// Check queue file content
-	const auto pathFirstQueue = tempDir + CopyLib::getTempFN() + "0" + CopyLib::getTempExten();
-	ASSERT_TRUE(fs::exists(pathFirstQueue));
-	std::ifstream fin(pathFirstQueue);
-	ASSERT_TRUE(fin.is_open());
-	if (fin.is_open())
-	{
-		std::string buf;
-		std::getline(fin, buf);
-		EXPECT_TRUE(buf == originDir);
-		std::getline(fin, buf);
-		EXPECT_TRUE(buf == destDir);
-		std::getline(fin, buf);
-		EXPECT_TRUE(buf.find(testFileName) != std::string::npos);
-		fin.close();
-	}
+	// Check queue content
+	auto& queues = CopyLib::TCopyQueues::getInstance();
+	EXPECT_TRUE(queues.getOrigin() == originDir);
+	EXPECT_TRUE(queues.getDest() == destDir);
+	ASSERT_EQ(queues.getTasksNum(0U), 1U);
+	CopyLib::TCopyTask task;
+	ASSERT_TRUE(queues.pop(0U, task));
+	EXPECT_TRUE(task.file.find(testFileName) != std::string::npos);
+	EXPECT_EQ(task.size, testFileSize);
 
-	// Remove files and dirs
-	CopyLib::removeCopyQueues(hardwConcur);
+	// Remove queues, files and dirs
+	CopyLib::removeCopyQueues();
 
-	EXPECT_FALSE(fs::exists(pathFirstQueue));
+	EXPECT_EQ(queues.getQueuesNum(), 0U);
 
 	fs::remove_all(originDir);
 	fs::remove_all(destDir);
@@ -340,6 +438,302 @@ TEST(CopyLibTests, createCopyQueues_True_ManyFilesConcur8)
 	// Add later
 }
 
+TEST(CopyLibTests, createCopyQueues_BalancedBySize)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	// One big file first in name order and many small ones
+	const uint32_t hardwConcur{ 4U };
+	const uint64_t bigSize{ 40000ULL };
+	const uint64_t smallSize{ 100ULL };
+	const uint32_t smallNum{ 16U };
+	{
+		std::ofstream fout(originDir + "a_big.bin", std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << std::string(bigSize, 'b');
+	}
+	for (uint32_t i = 0U; i < smallNum; i++)
+	{
+		std::ofstream fout(originDir + "small_" + std::to_string(i) + ".bin", std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << std::string(smallSize, 's');
+	}
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	EXPECT_TRUE(CopyLib::createCopyQueues(originDir, destDir, hardwConcur, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(fileNum, smallNum + 1U);
+	EXPECT_EQ(scopeSize, bigSize + smallSize * smallNum);
+
+	// The big file takes a queue alone, small files are spread evenly over the rest
+	const auto loads = CopyLib::getQueueLoads();
+	ASSERT_EQ(loads.size(), hardwConcur);
+	uint32_t bigQueues{ 0U };
+	for (const auto& load : loads)
+	{
+		if (load.bytes >= bigSize)
+		{
+			bigQueues++;
+			EXPECT_EQ(load.files, 1U);
+		}
+		else
+		{
+			EXPECT_LE(load.files, smallNum / (hardwConcur - 1U) + 1U);
+		}
+	}
+	EXPECT_EQ(bigQueues, 1U);
+	EXPECT_LE(CopyLib::getPlanImbalance(), CopyLib::getRoundRobinImbalance());
+
+	CopyLib::removeCopyQueues();
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+}
+
+TEST(CopyLibTests, createCopyQueues_ParallelScanSameTotals)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+
+	// 3 levels of 4 dirs with 3 files in every dir
+	uint64_t expectedSize{ 0U };
+	uint64_t expectedNum{ 0U };
+	std::vector<std::string> dirs{ "" };
+	std::vector<std::string> level{ "" };
+	for (uint32_t depth = 0U; depth < 3U; depth++)
+	{
+		std::vector<std::string> next;
+		for (const auto& dir : level)
+		{
+			for (uint32_t i = 0U; i < 4U; i++)
+			{
+				next.push_back(dir + "d" + std::to_string(i) + "/");
+			}
+		}
+		dirs.insert(dirs.end(), next.begin(), next.end());
+		level = next;
+	}
+	for (const auto& dir : dirs)
+	{
+		fs::create_directories(originDir + dir);
+		for (uint32_t i = 0U; i < 3U; i++)
+		{
+			std::ofstream fout(originDir + dir + "f" + std::to_string(i), std::ios::binary);
+			ASSERT_TRUE(fout.is_open());
+			fout << std::string(dir.size() + i, 'x');
+			expectedSize += dir.size() + i;
+			expectedNum++;
+		}
+	}
+	fs::create_directories(destDir);
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	for (const uint32_t scanThreadsNum : { 1U, 2U, 8U })
+	{
+		auto options = savedOptions;
+		options.scanThreadsNum = scanThreadsNum;
+		CopyLib::setCopyOptions(options);
+
+		uint64_t scopeSize{ 0U };
+		uint64_t fileNum{ 0U };
+		EXPECT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 4U, scopeSize, fileNum, noCancel));
+		EXPECT_EQ(scopeSize, expectedSize);
+		EXPECT_EQ(fileNum, expectedNum);
+		CopyLib::removeCopyQueues();
+	}
+	CopyLib::setCopyOptions(savedOptions);
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, copyEngine_copyFile)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originFile = tempDir + "copy_engine_origin.bin";
+	const auto destFile = tempDir + "copy_engine_dest.bin";
+
+	std::string content(3U * 1024U * 1024U + 7U, '\0');
+	for (size_t i = 0U; i < content.size(); i++)
+	{
+		content[i] = static_cast<char>(i * 31U);
+	}
+	{
+		std::ofstream fout(originFile, std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << content;
+	}
+	{
+		std::ofstream fout(destFile, std::ios::binary); // Longer destination must be overwritten
+		ASSERT_TRUE(fout.is_open());
+		fout << content << content;
+	}
+
+	CopyLib::resetCopyMethodStats();
+	std::error_code code;
+	CopyLib::TFileStat stat;
+	ASSERT_TRUE(CopyLib::statFile(originFile, stat, code));
+	EXPECT_EQ(stat.type, fs::file_type::regular);
+	EXPECT_EQ(stat.size, content.size());
+	CopyLib::ECopyMethod method{ CopyLib::ECopyMethod::Count };
+	uint64_t size{ 0U };
+	EXPECT_TRUE(CopyLib::copyFile(originFile, destFile, stat, code, method, size));
+	EXPECT_FALSE(code);
+	EXPECT_EQ(size, content.size());
+	ASSERT_LT(method, CopyLib::ECopyMethod::Count);
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(method), 1U);
+	// One stat, opens, closes and a few copy calls. The buffered copy takes 1 MB per read.
+	EXPECT_GT(CopyLib::getSyscallsNum(), 0U);
+	EXPECT_LE(CopyLib::getSyscallsNum(), 16U);
+
+	std::ifstream fin(destFile, std::ios::binary);
+	const std::string copied((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	EXPECT_TRUE(copied == content);
+	fin.close();
+
+	// Not existing origin, removed after the scan
+	EXPECT_TRUE(CopyLib::statFile(tempDir + "not_existing_file.bin", stat, code));
+	EXPECT_EQ(stat.type, fs::file_type::not_found);
+	stat.type = fs::file_type::regular;
+	EXPECT_FALSE(CopyLib::copyFile(tempDir + "not_existing_file.bin", destFile, stat, code, method, size));
+	EXPECT_TRUE(code);
+
+	fs::remove(originFile);
+	fs::remove(destFile);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, copyEngine_progressAndCancel)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originFile = tempDir + "progress_origin.bin";
+	const auto destFile = tempDir + "progress_dest.bin";
+	const std::string content(40U << 20U, 'p'); // A few progress chunks
+	{
+		std::ofstream fout(originFile, std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << content;
+	}
+	std::error_code code;
+	CopyLib::TFileStat stat;
+	ASSERT_TRUE(CopyLib::statFile(originFile, stat, code));
+
+	std::atomic<uint64_t> copiedSize{ 0U };
+	std::atomic<bool> cancel{ false };
+	CopyLib::TCopyProgress progress;
+	progress.copiedSize = &copiedSize;
+	progress.cancel = &cancel;
+	CopyLib::ECopyMethod method{ CopyLib::ECopyMethod::Count };
+	uint64_t size{ 0U };
+	EXPECT_TRUE(CopyLib::copyFile(originFile, destFile, stat, code, method, size, &progress));
+	EXPECT_EQ(copiedSize, progress.published);
+	if (method == CopyLib::ECopyMethod::Reflink) // One call, nothing to publish
+	{
+		fs::remove(originFile);
+		fs::remove(destFile);
+		return;
+	}
+	EXPECT_EQ(progress.published, content.size());
+
+	// Stops after the first chunk, the published bytes are landed
+	cancel.store(true);
+	copiedSize.store(0U);
+	progress.published = 0U;
+	EXPECT_FALSE(CopyLib::copyFile(originFile, destFile, stat, code, method, size, &progress));
+	EXPECT_EQ(code, std::errc::operation_canceled);
+	EXPECT_GT(progress.published, 0U);
+	EXPECT_LT(progress.published, content.size());
+	EXPECT_EQ(copiedSize, progress.published);
+	EXPECT_EQ(fs::file_size(destFile), progress.published);
+
+	CopyLib::TSplitFile split;
+	split.size = stat.size;
+	split.mode = stat.mode;
+	split.rangesLeft.store(1U);
+	uint64_t written{ 0U };
+	progress.published = 0U;
+	EXPECT_FALSE(CopyLib::copyRange(originFile, destFile, split, 0U, stat.size, code, written, &progress));
+	EXPECT_EQ(code, std::errc::operation_canceled);
+	EXPECT_LT(progress.published, content.size());
+
+	fs::remove(originFile);
+	fs::remove(destFile);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, copyEngine_kernelCopyFallback)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originFile = tempDir + "fallback_origin.bin";
+	const auto destFile = tempDir + "fallback_dest.bin";
+	std::string content((3U << 20U) + 7U, '\0');
+	for (size_t i = 0U; i < content.size(); i++)
+	{
+		content[i] = static_cast<char>(i * 7U);
+	}
+	{
+		std::ofstream fout(originFile, std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << content;
+	}
+	const auto readDest = [&destFile]()
+	{
+		std::ifstream fin(destFile, std::ios::binary);
+		return std::string((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+	};
+	std::error_code code;
+	CopyLib::TFileStat stat;
+	ASSERT_TRUE(CopyLib::statFile(originFile, stat, code));
+
+	// The first kernel call copies nothing, the file is not left empty and is copied by the next method
+	CopyLib::setEmptyKernelCopy(true);
+	CopyLib::ECopyMethod method{ CopyLib::ECopyMethod::Count };
+	uint64_t size{ 0U };
+	const bool copied = CopyLib::copyFile(originFile, destFile, stat, code, method, size);
+	CopyLib::TSplitFile split;
+	split.size = stat.size;
+	split.mode = stat.mode;
+	split.rangesLeft.store(2U);
+	uint64_t written{ 0U };
+	const bool firstRange = CopyLib::copyRange(originFile, destFile + ".split", split, 0U, 1U << 20U, code, written);
+	const bool secondRange = CopyLib::copyRange(originFile, destFile + ".split", split, 1U << 20U, stat.size - (1U << 20U), code, written);
+	CopyLib::setEmptyKernelCopy(false);
+	EXPECT_TRUE(copied);
+	EXPECT_TRUE(method == CopyLib::ECopyMethod::Buffered || method == CopyLib::ECopyMethod::Reflink);
+	EXPECT_TRUE(readDest() == content);
+	EXPECT_TRUE(firstRange && secondRange);
+	EXPECT_TRUE(CopyLib::isSameContent(originFile, destFile + ".split", stat.size, code));
+
+	// The file grew after the scan, it is copied whole whatever the method
+	{
+		std::ofstream fout(originFile, std::ios::binary | std::ios::app);
+		fout << "grown";
+	}
+	content += "grown";
+	EXPECT_TRUE(CopyLib::copyFile(originFile, destFile, stat, code, method, size));
+	EXPECT_EQ(size, content.size());
+	EXPECT_TRUE(readDest() == content);
+	CopyLib::setEmptyKernelCopy(true);
+	EXPECT_TRUE(CopyLib::copyFile(originFile, destFile, stat, code, method, size));
+	CopyLib::setEmptyKernelCopy(false);
+	EXPECT_EQ(size, content.size());
+	EXPECT_TRUE(readDest() == content);
+
+	fs::remove(originFile);
+	fs::remove(destFile);
+	fs::remove(destFile + ".split");
+}
+
 //======================================================================================================
 
 TEST(CopyLibTests, worker_OneThreadOneFile)
@@ -354,9 +748,1554 @@ TEST(CopyLibTests, worker_OneThreadManyFiles)
 
 TEST(CopyLibTests, worker_TwoThreadsManyFile)
 {
-	// Add later 
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+
+	fs::create_directories(originDir + "sub/");
+	fs::create_directories(destDir);
+
+	const uint32_t filesNum{ 20U };
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		std::ofstream fout(originDir + (i % 2U ? "sub/" : "") + "file_" + std::to_string(i) + ".bin", std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << std::string(100U * (i + 1U), 'x');
+	}
+
+	const uint32_t hardwConcur{ 2U };
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, hardwConcur, scopeSize, fileNum, noCancel));
+	CopyLib::copyDirStructure();
+
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	std::thread first(CopyLib::worker, 0U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	std::thread second(CopyLib::worker, 1U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	first.join();
+	second.join();
+	CopyLib::removeCopyQueues();
+
+	EXPECT_EQ(finishedThreadsNum, hardwConcur);
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		const auto file = std::string(i % 2U ? "sub/" : "") + "file_" + std::to_string(i) + ".bin";
+		ASSERT_TRUE(fs::exists(destDir + file));
+		EXPECT_EQ(fs::file_size(destDir + file), fs::file_size(originDir + file));
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
 }
 
+TEST(CopyLibTests, scanner_StreamingTwoThreads)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+
+	fs::create_directories(originDir + "a/b/c/");
+	fs::create_directories(destDir);
+
+	const std::vector<std::string> files{ "1.bin", "a/2.bin", "a/b/3.bin", "a/b/c/4.bin", "a/b/c/5.bin" };
+	for (size_t i = 0U; i < files.size(); i++)
+	{
+		std::ofstream fout(originDir + files[i], std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << std::string(1000U * (i + 1U), 'x');
+	}
+
+	// Workers are started before the scan, destination dirs are created by the scanner
+	const uint32_t hardwConcur{ 2U };
+	ASSERT_TRUE(CopyLib::openCopyQueues(originDir, destDir, hardwConcur));
+	std::atomic<uint64_t> scopeSize{ 0U };
+	std::atomic<uint64_t> fileNum{ 0U };
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	std::thread first(CopyLib::worker, 0U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	std::thread second(CopyLib::worker, 1U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	std::thread scan(CopyLib::scanner, std::ref(scopeSize), std::ref(fileNum), std::cref(copyCancel));
+	scan.join();
+	first.join();
+	second.join();
+	CopyLib::removeCopyQueues();
+
+	EXPECT_EQ(fileNum, files.size());
+	EXPECT_EQ(scopeSize, 15000U);
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	for (const auto& file : files)
+	{
+		ASSERT_TRUE(fs::exists(destDir + file));
+		EXPECT_EQ(fs::file_size(destDir + file), fs::file_size(originDir + file));
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+TEST(CopyLibTests, uringWorker_ManyFilesInFlight)
+{
+	if (!CopyLib::isIoUringAvailable())
+	{
+		GTEST_SKIP() << "io_uring is not available";
+	}
+
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	// Small blocks, so big files take many slots and small files share the ring
+	const std::vector<size_t> sizes{ 0U, 1U, 4095U, 4096U, 4097U, 100000U, 300001U, 7U, 65536U };
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i), std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		std::string content(sizes[i], '\0');
+		for (size_t j = 0U; j < content.size(); j++)
+		{
+			content[j] = static_cast<char>(j * 7U + i);
+		}
+		fout << content;
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.uringQueueDepth = 8U;
+	options.uringBlockSize = 4096U;
+	CopyLib::setCopyOptions(options);
+
+	// One ring drains both queues
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, noCancel));
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	CopyLib::uringWorker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(finishedThreadsNum, 1U);
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::IoUring), fileNum);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		const auto file = "file_" + std::to_string(i);
+		std::ifstream originIn(originDir + file, std::ios::binary);
+		std::ifstream destIn(destDir + file, std::ios::binary);
+		ASSERT_TRUE(destIn.is_open());
+		const std::string originContent((std::istreambuf_iterator<char>(originIn)), std::istreambuf_iterator<char>());
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(originContent == destContent) << file;
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+// Files changed after the scan: a grown one is copied whole, a shrunk split file is an error, not a zero filled hole
+TEST(CopyLibTests, uringWorker_OriginChangedAfterScan)
+{
+	if (!CopyLib::isIoUringAvailable())
+	{
+		GTEST_SKIP() << "io_uring is not available";
+	}
+
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+	const std::vector<size_t> sizes{ 10000U, 100000U };
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i), std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		fout << std::string(sizes[i], static_cast<char>('a' + i));
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.splitThreshold = 100000U; // Only file_1 is split
+	options.splitRangeSize = 30000U;
+	options.uringBlockSize = 4096U;
+	CopyLib::setCopyOptions(options);
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+	{
+		std::ofstream fout(originDir + "file_0", std::ios::binary | std::ios::app);
+		fout << "grown";
+	}
+	fs::resize_file(originDir + "file_1", 45000U);
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	CopyLib::uringWorker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::IoUring), 1U);
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::SplitRanges), 0U);
+	EXPECT_TRUE(CopyLib::isCopyErrorHappened());
+	EXPECT_EQ(CopyLib::getWrittenFileSize(), sizes[0] + 5U);
+	std::error_code code;
+	EXPECT_EQ(fs::file_size(destDir + "file_0"), sizes[0] + 5U);
+	EXPECT_TRUE(CopyLib::isSameContent(originDir + "file_0", destDir + "file_0", sizes[0] + 5U, code));
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+static void splitRangesTest(const bool ioUring)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	// Files over the threshold are copied in 30000 bytes ranges, the last range is shorter
+	const std::vector<size_t> sizes{ 100000U, 99999U, 250001U, 7U };
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i), std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		std::string content(sizes[i], '\0');
+		for (size_t j = 0U; j < content.size(); j++)
+		{
+			content[j] = static_cast<char>(j * 13U + i);
+		}
+		fout << content;
+	}
+	// Stale bigger destination must be truncated
+	{
+		std::ofstream fout(destDir + "file_0", std::ios::binary);
+		fout << std::string(300000U, 'x');
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.splitThreshold = 100000U;
+	options.splitRangeSize = 30000U;
+	options.uringBlockSize = 4096U;
+	CopyLib::setCopyOptions(options);
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(fileNum, sizes.size());
+	const auto& queues = CopyLib::TCopyQueues::getInstance();
+	EXPECT_EQ(queues.getTasksNum(0U) + queues.getTasksNum(1U), 4U + 1U + 9U + 1U);
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	const auto workerFun = ioUring ? CopyLib::uringWorker : CopyLib::worker;
+	std::thread th1(workerFun, 0U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	std::thread th2(workerFun, 1U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	th1.join();
+	th2.join();
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(finishedThreadsNum, 2U);
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::SplitRanges), 2U);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		const auto file = "file_" + std::to_string(i);
+		std::ifstream originIn(originDir + file, std::ios::binary);
+		std::ifstream destIn(destDir + file, std::ios::binary);
+		ASSERT_TRUE(destIn.is_open());
+		const std::string originContent((std::istreambuf_iterator<char>(originIn)), std::istreambuf_iterator<char>());
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(originContent == destContent) << file;
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+TEST(CopyLibTests, worker_SplitRanges)
+{
+	splitRangesTest(false);
+}
+
+TEST(CopyLibTests, uringWorker_SplitRanges)
+{
+	if (!CopyLib::isIoUringAvailable())
+	{
+		GTEST_SKIP() << "io_uring is not available";
+	}
+	splitRangesTest(true);
+}
+
+//======================================================================================================
+
+// Cancel in the middle of a split file: the ranges in flight and the queued ones are canceled, not failed,
+// the file is removed once and its bytes are taken back
+static void splitRangesCancelTest(const bool ioUring)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+	{
+		std::ofstream fout(originDir + "big", std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		std::string block(1024U * 1024U, '\0');
+		for (size_t i = 0U; i < block.size(); i++)
+		{
+			block[i] = static_cast<char>(i * 7U);
+		}
+		for (size_t i = 0U; i < 128U; i++)
+		{
+			fout << block;
+		}
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.splitThreshold = 2U * 1024U * 1024U;
+	options.splitRangeSize = 2U * 1024U * 1024U;
+	options.uringBlockSize = 256U * 1024U;
+	CopyLib::setCopyOptions(options);
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, noCancel));
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	std::atomic<bool> copyCancel{ false };
+	const auto workerFun = ioUring ? CopyLib::uringWorker : CopyLib::worker;
+	std::thread th1(workerFun, 0U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	std::thread th2(workerFun, 1U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	while (copiedFileSize == 0U && finishedThreadsNum < 2U)
+	{
+		std::this_thread::yield();
+	}
+	copyCancel.store(true);
+	th1.join();
+	th2.join();
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(finishedThreadsNum, 2U);
+	EXPECT_EQ(copiedFileNum, 0U);
+	EXPECT_EQ(copiedFileSize, 0U);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	EXPECT_FALSE(fs::exists(destDir + "big"));
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+TEST(CopyLibTests, worker_SplitRangesCancel)
+{
+	splitRangesCancelTest(false);
+}
+
+TEST(CopyLibTests, uringWorker_SplitRangesCancel)
+{
+	if (!CopyLib::isIoUringAvailable())
+	{
+		GTEST_SKIP() << "io_uring is not available";
+	}
+	splitRangesCancelTest(true);
+}
+
+TEST(CopyLibTests, worker_SyncSkipsUnchanged)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	const uint32_t filesNum{ 5U };
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i));
+		ASSERT_TRUE(fout.is_open());
+		fout << "content " << i;
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.sync = true;
+	CopyLib::setCopyOptions(options);
+
+	// Runs one sync, returns copied files number
+	const auto runSync = [&]()
+	{
+		uint64_t scopeSize{ 0U };
+		uint64_t fileNum{ 0U };
+		EXPECT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+		std::atomic<uint64_t> copiedFileSize{ 0U };
+		std::atomic<uint64_t> copiedFileNum{ 0U };
+		std::atomic<uint32_t> finishedThreadsNum{ 0U };
+		const std::atomic<bool> copyCancel{ false };
+		CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+		CopyLib::removeCopyQueues();
+		EXPECT_EQ(copiedFileNum, fileNum);
+		EXPECT_EQ(CopyLib::getSkippedFileNum() + fileNum, filesNum);
+		return fileNum;
+	};
+
+	EXPECT_EQ(runSync(), filesNum);
+	EXPECT_EQ(fs::last_write_time(destDir + "file_0"), fs::last_write_time(originDir + "file_0"));
+	EXPECT_EQ(runSync(), 0U);
+	EXPECT_EQ(CopyLib::getSkippedFileSize(), filesNum * std::string("content 0").size());
+
+	// Changed size is copied, the same size with other content is missed by size and time
+	{
+		std::ofstream fout(originDir + "file_1", std::ios::app);
+		fout << " more";
+	}
+	std::string sameSize{ "CONTENT 2" };
+	{
+		std::ofstream fout(destDir + "file_2");
+		fout << sameSize;
+	}
+	fs::last_write_time(destDir + "file_2", fs::last_write_time(originDir + "file_2"));
+	fs::last_write_time(destDir + "file_3", fs::last_write_time(originDir + "file_3") - std::chrono::hours(1));
+	EXPECT_EQ(runSync(), 2U); // file_1 and file_3
+
+	// Content compare finds file_2, file_3 differs by time only now
+	fs::last_write_time(destDir + "file_3", fs::last_write_time(originDir + "file_3") - std::chrono::hours(1));
+	options.syncChecksum = true;
+	CopyLib::setCopyOptions(options);
+	EXPECT_EQ(runSync(), 1U);
+	EXPECT_EQ(fs::last_write_time(destDir + "file_3"), fs::last_write_time(originDir + "file_3"));
+	CopyLib::setCopyOptions(savedOptions);
+
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		const auto file = "file_" + std::to_string(i);
+		std::ifstream originIn(originDir + file);
+		std::ifstream destIn(destDir + file);
+		const std::string originContent((std::istreambuf_iterator<char>(originIn)), std::istreambuf_iterator<char>());
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(originContent == destContent) << file;
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+TEST(CopyLibTests, worker_DeltaRewritesChangedBlocks)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	const size_t blockSize{ 4096U };
+	std::string content(64U * blockSize, '\0');
+	for (size_t i = 0U; i < content.size(); i++)
+	{
+		content[i] = static_cast<char>(i * 11U);
+	}
+	// file_0: two dirty blocks and one appended block, file_1: shrunk origin,
+	// file_2: split into ranges with one dirty block, file_3: no destination yet
+	std::string changed = content;
+	changed[5U * blockSize] ^= 1;
+	changed[40U * blockSize + 7U] ^= 1;
+	changed += std::string(blockSize, 'a');
+	const std::string bigChanged = changed + std::string(blockSize, 'b');
+	const std::vector<std::pair<std::string, std::string>> files{ { changed, content },
+		{ content.substr(0U, 10U * blockSize), content }, { bigChanged, content }, { content, "" } };
+	for (size_t i = 0U; i < files.size(); i++)
+	{
+		const auto file = "file_" + std::to_string(i);
+		std::ofstream originOut(originDir + file, std::ios::binary);
+		originOut << files[i].first;
+		if (i != 3U)
+		{
+			std::ofstream destOut(destDir + file, std::ios::binary);
+			destOut << files[i].second;
+		}
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.delta = true;
+	options.deltaThreshold = 1U;
+	options.deltaBlockSize = blockSize;
+	options.splitThreshold = bigChanged.size(); // Only file_2 is split
+	options.splitRangeSize = 16U * blockSize;
+	CopyLib::setCopyOptions(options);
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::Delta), 2U);
+	EXPECT_EQ(CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::SplitRanges), 1U);
+	// 3 blocks of file_0, 4 blocks of file_2, nothing of file_1, the whole file_3
+	EXPECT_EQ(CopyLib::getWrittenFileSize(), 7U * blockSize + content.size());
+	for (size_t i = 0U; i < files.size(); i++)
+	{
+		const auto file = "file_" + std::to_string(i);
+		std::ifstream destIn(destDir + file, std::ios::binary);
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(destContent == files[i].first) << file;
+	}
+
+	// The origin changed after the scan: a grown one is copied whole, a range of a shrunk one fails
+	std::error_code code;
+	CopyLib::TFileStat stat;
+	ASSERT_TRUE(CopyLib::statFile(originDir + "file_0", stat, code));
+	{
+		std::ofstream originOut(originDir + "file_0", std::ios::binary | std::ios::app);
+		originOut << "grown";
+	}
+	uint64_t written{ 0U };
+	uint64_t size{ 0U };
+	EXPECT_TRUE(CopyLib::deltaCopyFile(originDir + "file_0", destDir + "file_0", stat, blockSize, code, written, size));
+	EXPECT_FALSE(code) << code.message();
+	EXPECT_EQ(size, changed.size() + 5U);
+	EXPECT_EQ(fs::file_size(destDir + "file_0"), changed.size() + 5U);
+	EXPECT_TRUE(CopyLib::isSameContent(originDir + "file_0", destDir + "file_0", changed.size() + 5U, code));
+
+	ASSERT_TRUE(CopyLib::statFile(originDir + "file_2", stat, code));
+	fs::resize_file(originDir + "file_2", 8U * blockSize);
+	CopyLib::TSplitFile split;
+	split.size = stat.size;
+	split.mode = stat.mode;
+	split.deltaBlockSize = blockSize;
+	split.keepContent = true;
+	split.rangesLeft.store(2U);
+	EXPECT_FALSE(CopyLib::copyRange(originDir + "file_2", destDir + "file_2", split, 0U, 16U * blockSize, code, written));
+	EXPECT_EQ(code, std::errc::io_error) << code.message();
+	EXPECT_FALSE(CopyLib::copyRange(originDir + "file_2", destDir + "file_2", split, 64U * blockSize, stat.size - 64U * blockSize, code, written));
+	EXPECT_EQ(code, std::errc::io_error) << code.message();
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+TEST(CopyLibTests, verifier_crc32c)
+{
+	const std::string check{ "123456789" };
+	EXPECT_EQ(CopyLib::crc32c(0U, check.data(), check.size()), 0xE3069283U);
+	EXPECT_EQ(CopyLib::crc32c(0U, nullptr, 0U), 0U);
+
+	// Chunked checksum is the same, odd sizes go through the tail loops
+	std::string data(100003U, '\0');
+	for (size_t i = 0U; i < data.size(); i++)
+	{
+		data[i] = static_cast<char>(i * 131U + (i >> 7U));
+	}
+	const uint32_t whole = CopyLib::crc32c(0U, data.data(), data.size());
+	uint32_t chunked{ 0U };
+	for (size_t offset = 0U; offset < data.size(); offset += 4099U)
+	{
+		chunked = CopyLib::crc32c(chunked, data.data() + offset, std::min<size_t>(4099U, data.size() - offset));
+	}
+	EXPECT_EQ(whole, chunked);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, worker_VerifyFindsMismatch)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	const uint32_t filesNum{ 4U };
+	uint64_t totalSize{ 0U };
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i), std::ios::binary);
+		const std::string content((i + 1U) * 300000U, static_cast<char>('a' + i));
+		fout << content;
+		totalSize += content.size();
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.verify = true;
+	CopyLib::setCopyOptions(options);
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+	{
+		// Grown after the scan, the tail is verified and counted too
+		std::ofstream fout(originDir + "file_0", std::ios::binary | std::ios::app);
+		fout << "grown";
+		totalSize += 5U;
+	}
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	std::atomic<uint32_t> finishedVerifiersNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	if (CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::Reflink) == 0U) // A reflink writes nothing
+	{
+		EXPECT_EQ(CopyLib::getWrittenFileSize(), totalSize);
+	}
+
+	// Damaged after the copy, before the verifier gets it
+	{
+		std::fstream fout(destDir + "file_2", std::ios::binary | std::ios::in | std::ios::out);
+		fout.seekp(500000);
+		fout << 'X';
+	}
+	CopyLib::finishVerify();
+	CopyLib::verifier(finishedVerifiersNum, copyCancel);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(finishedVerifiersNum, 1U);
+	EXPECT_EQ(CopyLib::getVerifiedFileSize(), totalSize);
+	EXPECT_EQ(CopyLib::getVerifyMismatchNum(), 1U);
+	EXPECT_TRUE(CopyLib::isCopyErrorHappened());
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, worker_DedupLinksDuplicates)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir + "sub");
+	fs::create_directories(destDir);
+
+	const std::string same(100000U, 's');
+	std::string other(same);
+	other[50000U] = 'o'; // The same size, other content
+	const std::vector<std::pair<std::string, std::string>> files{ { "a", same }, { "sub/b", same }, { "c", same }, { "d", other }, { "e", "unique" } };
+	for (const auto & [file, content] : files)
+	{
+		std::ofstream fout(originDir + file, std::ios::binary);
+		fout << content;
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.dedup = true;
+	CopyLib::setCopyOptions(options);
+
+	// Returns planned files number
+	const auto runCopy = [&]()
+	{
+		uint64_t scopeSize{ 0U };
+		uint64_t fileNum{ 0U };
+		EXPECT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+		CopyLib::copyDirStructure();
+		std::atomic<uint64_t> copiedFileSize{ 0U };
+		std::atomic<uint64_t> copiedFileNum{ 0U };
+		std::atomic<uint32_t> finishedThreadsNum{ 0U };
+		const std::atomic<bool> copyCancel{ false };
+		CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+		CopyLib::removeCopyQueues();
+		EXPECT_EQ(copiedFileNum, fileNum);
+		EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+		return fileNum;
+	};
+
+	EXPECT_EQ(runCopy(), 3U); // a, d and e
+	EXPECT_EQ(CopyLib::getDedupFileNum(), 2U);
+	EXPECT_EQ(CopyLib::getDedupSavedSize(), 2U * same.size());
+	const bool reflinked = CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::Reflink) >= 2U;
+	EXPECT_TRUE(reflinked || fs::hard_link_count(destDir + "a") == 3U);
+
+	// A changed duplicate is copied alone, the linked copies keep their content
+	{
+		std::fstream fout(originDir + "c", std::ios::binary | std::ios::in | std::ios::out);
+		fout.seekp(10);
+		fout << 'C';
+	}
+	EXPECT_EQ(runCopy(), 4U); // a, c, d and e
+	EXPECT_EQ(CopyLib::getDedupFileNum(), 1U);
+	CopyLib::setCopyOptions(savedOptions);
+
+	for (const auto & [file, content] : files)
+	{
+		std::ifstream originIn(originDir + file, std::ios::binary);
+		std::ifstream destIn(destDir + file, std::ios::binary);
+		const std::string originContent((std::istreambuf_iterator<char>(originIn)), std::istreambuf_iterator<char>());
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(originContent == destContent) << file;
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, workerControl_ClimbsToBestLevel)
+{
+	auto & control = CopyLib::TWorkerControl::getInstance();
+	control.reset(8U, false);
+	EXPECT_EQ(control.getActiveNum(), 8U);
+	control.reset(8U, true);
+	EXPECT_EQ(control.getActiveNum(), 4U);
+
+	// Synthetic workload: throughput grows up to 6 workers and drops after
+	const auto rate = [](const uint32_t workers) { return (workers <= 6U ? workers : 12U - workers) * 100'000'000ULL; };
+	auto now = std::chrono::steady_clock::now();
+	uint64_t copiedSize{ 0U };
+	control.update(copiedSize, 0U, now);
+	uint32_t maxActive{ 0U };
+	for (uint32_t i = 0U; i < 40U; i++)
+	{
+		copiedSize += rate(control.getActiveNum());
+		now += CopyLib::TWorkerControl::sampleInterval;
+		control.update(copiedSize, 0U, now);
+		maxActive = std::max(maxActive, control.getActiveNum());
+		if (i >= 10U) // Settled, probes go one step away at most
+		{
+			EXPECT_GE(control.getActiveNum(), 5U);
+			EXPECT_LE(control.getActiveNum(), 7U);
+		}
+	}
+	EXPECT_LE(maxActive, 7U);
+	control.reset(1U, false);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, progressCounters_SumOfWorkers)
+{
+	CopyLib::TProgressCounters progress(4U);
+	EXPECT_EQ(progress.size(), 4U);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(&progress[1]) - reinterpret_cast<uintptr_t>(&progress[0]), 64U); // A cache line each
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < progress.size(); i++)
+	{
+		threads.emplace_back([&progress, i]()
+		{
+			for (uint32_t j = 0U; j < 1000U; j++)
+			{
+				progress[i].copiedSize += i + 1U;
+				progress[i].copiedNum++;
+			}
+		});
+	}
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	EXPECT_EQ(progress.getCopiedNum(), 4000U);
+	EXPECT_EQ(progress.getCopiedSize(), 10000U);
+
+	progress.reset(4U);
+	EXPECT_EQ(progress.getCopiedNum(), 0U);
+	EXPECT_EQ(progress.getCopiedSize(), 0U);
+	progress.reset(2U);
+	EXPECT_EQ(progress.size(), 2U);
+	EXPECT_EQ(progress.getCopiedSize(), 0U);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, worker_ParkedWorkersFinish)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+	const uint32_t filesNum{ 40U };
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i));
+		fout << "content " << i;
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.adaptiveWorkers = true;
+	CopyLib::setCopyOptions(options);
+
+	const uint32_t threadsNum{ 4U };
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, threadsNum, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(CopyLib::TWorkerControl::getInstance().getActiveNum(), 2U);
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < threadsNum; i++)
+	{
+		threads.emplace_back(CopyLib::worker, i, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	}
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	// Queues of the parked workers are stolen
+	EXPECT_EQ(finishedThreadsNum, threadsNum);
+	EXPECT_EQ(copiedFileNum, filesNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, deviceLimits_LimitInFlight)
+{
+	const auto device = CopyLib::getDeviceInfo(fs::temp_directory_path().string());
+	EXPECT_TRUE(device.valid);
+	EXPECT_NE(device.id, 0U);
+	const auto missing = CopyLib::getDeviceInfo("/no/such/path");
+	EXPECT_FALSE(missing.valid);
+	EXPECT_EQ(missing.id, 0U);
+
+	// Two paths failed to stat are not one device
+	auto & limits = CopyLib::TDeviceLimits::getInstance();
+	limits.configure(missing, missing, 2U, 8U);
+	EXPECT_FALSE(limits.isSameDevice());
+
+	CopyLib::TDeviceInfo hdd;
+	hdd.id = 1U;
+	hdd.valid = true;
+	hdd.name = "sda";
+	hdd.rotational = hdd.known = true;
+	CopyLib::TDeviceInfo ssd;
+	ssd.id = 2U;
+	ssd.valid = true;
+	ssd.name = "nvme0n1";
+	ssd.known = true;
+	limits.configure(hdd, ssd, 2U, 8U);
+	EXPECT_EQ(limits.getReadLimit(), 2U);
+	EXPECT_EQ(limits.getWriteLimit(), 8U);
+	EXPECT_FALSE(limits.isSameDevice());
+
+	// The rotational origin lets two copies run at once
+	std::atomic<uint32_t> inFlight{ 0U };
+	std::atomic<uint32_t> maxInFlight{ 0U };
+	const std::atomic<bool> noCancel{ false };
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < 6U; i++)
+	{
+		threads.emplace_back([&]()
+		{
+			for (uint32_t j = 0U; j < 20U; j++)
+			{
+				const CopyLib::TDeviceSlot slot(noCancel);
+				const uint32_t now = ++inFlight;
+				uint32_t seen = maxInFlight;
+				while (now > seen && !maxInFlight.compare_exchange_weak(seen, now)) { }
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				inFlight--;
+			}
+		});
+	}
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	EXPECT_LE(maxInFlight, 2U);
+	EXPECT_GE(maxInFlight, 1U);
+
+	// A waiting worker gives up on cancel
+	limits.configure(hdd, hdd, 1U, 8U);
+	EXPECT_TRUE(limits.isSameDevice());
+	const std::atomic<bool> cancel{ true };
+	{
+		const CopyLib::TDeviceSlot slot(noCancel);
+		EXPECT_TRUE(slot.isAcquired());
+		const CopyLib::TDeviceSlot waiting(cancel);
+		EXPECT_FALSE(waiting.isAcquired());
+	}
+	limits.configure(ssd, ssd, 0U, 0U);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, journal_ResumeWithoutRescan)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir + "sub");
+	fs::create_directories(destDir);
+
+	// Small files and one file of 4 ranges
+	std::vector<std::string> files;
+	for (uint32_t i = 0U; i < 6U; i++)
+	{
+		files.push_back((i % 2U ? "sub/file_" : "file_") + std::to_string(i));
+		std::ofstream fout(originDir + files.back());
+		fout << "content " << i;
+	}
+	files.push_back("big");
+	{
+		std::ofstream fout(originDir + files.back(), std::ios::binary);
+		fout << std::string(40000U, 'b');
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.journal = true;
+	options.splitThreshold = 40000U;
+	options.splitRangeSize = 10000U;
+	CopyLib::setCopyOptions(options);
+
+	// The first run is interrupted after 2 files, 1 range and the first 4 bytes of a file kept by a cancel
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(fileNum, files.size());
+	CopyLib::copyDirStructure();
+	auto& queues = CopyLib::TCopyQueues::getInstance();
+	auto& journal = CopyLib::TJournal::getInstance();
+	CopyLib::TCopyTask task;
+	uint32_t filesDone{ 0U };
+	bool rangeDone{ false };
+	bool partialDone{ false };
+	while ((filesDone < 2U || !rangeDone || !partialDone) && queues.tryPop(0U, task))
+	{
+		std::error_code code;
+		uint64_t written{ 0U };
+		CopyLib::ECopyMethod method{ CopyLib::ECopyMethod::Buffered };
+		uint64_t size{ 0U };
+		if (task.split && !rangeDone)
+		{
+			ASSERT_TRUE(CopyLib::copyRange(originDir + task.file, destDir + task.file, *task.split, task.offset, task.size, code, written));
+			journal.rangeDone(task.journalIndex, task.offset);
+			rangeDone = true;
+		}
+		else if (!task.split && filesDone < 2U)
+		{
+			ASSERT_TRUE(CopyLib::copyFile(originDir + task.file, destDir + task.file, task.stat, code, method, size));
+			journal.fileDone(task.journalIndex);
+			filesDone++;
+		}
+		else if (!task.split && !partialDone)
+		{
+			std::ofstream fout(destDir + task.file, std::ios::binary);
+			fout << "cont";
+			journal.partialDone(task.journalIndex, 4U);
+			partialDone = true;
+		}
+	}
+	CopyLib::removeCopyQueues();
+	EXPECT_TRUE(fs::exists(CopyLib::TJournal::getFileName(destDir)));
+
+	// Not seen by the resumed job, the plan is taken from the journal
+	{
+		std::ofstream fout(originDir + "new_file");
+		fout << "new";
+	}
+
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(CopyLib::getResumedFileNum(), 2U);
+	EXPECT_EQ(fileNum, files.size() - 2U);
+	EXPECT_EQ(CopyLib::getResumedFileSize(), 2U * std::string("content 0").size() + 10000U + 4U);
+	CopyLib::copyDirStructure();
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	CopyLib::worker(1U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_FALSE(fs::exists(CopyLib::TJournal::getFileName(destDir))); // Removed by the complete job
+	EXPECT_FALSE(fs::exists(destDir + "new_file"));
+	for (const auto& file : files)
+	{
+		std::ifstream originIn(originDir + file, std::ios::binary);
+		std::ifstream destIn(destDir + file, std::ios::binary);
+		const std::string originContent((std::istreambuf_iterator<char>(originIn)), std::istreambuf_iterator<char>());
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(originContent == destContent) << file;
+	}
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, journal_ResumeCreatesDirs)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir + "a/b/c");
+	fs::create_directories(originDir + "empty");
+	fs::create_directories(destDir);
+	{
+		std::ofstream fout(originDir + "a/b/c/file", std::ios::binary);
+		fout << "content";
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.journal = true;
+	CopyLib::setCopyOptions(options);
+
+	// Interrupted before the dirs are created
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+	CopyLib::removeCopyQueues();
+	ASSERT_TRUE(fs::exists(CopyLib::TJournal::getFileName(destDir)));
+
+	// The origin is not walked again, the dirs come from the journal
+	fs::create_directories(originDir + "after_plan");
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 1U, scopeSize, fileNum, noCancel));
+	EXPECT_EQ(fileNum, 1U);
+	CopyLib::copyDirStructure();
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	CopyLib::worker(0U, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	EXPECT_EQ(copiedFileNum, 1U);
+	EXPECT_TRUE(fs::exists(destDir + "a/b/c/file"));
+	EXPECT_TRUE(fs::is_directory(destDir + "empty"));
+	EXPECT_FALSE(fs::exists(destDir + "after_plan"));
+	EXPECT_FALSE(fs::exists(CopyLib::TJournal::getFileName(destDir))); // Removed by the complete job
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, journal_KeepsRecordsWhenSyncFails)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(destDir);
+	const std::string origin{ tempDir + "origin/" };
+
+	auto& journal = CopyLib::TJournal::getInstance();
+	CopyLib::TFileStat stat;
+	stat.type = fs::file_type::regular;
+	ASSERT_TRUE(journal.create(origin, destDir));
+	const uint64_t first = journal.addFile("file_0", stat);
+	journal.addFile("file_1", stat);
+	journal.finishPlan();
+
+	// The data may not be on the disk, the record is not written
+	journal.setSyncFailure(true);
+	journal.fileDone(first);
+	EXPECT_FALSE(journal.close());
+	journal.setSyncFailure(false);
+	std::vector<CopyLib::TJournalEntry> entries;
+	std::vector<std::string> dirs;
+	bool dirsCreated{ false };
+	ASSERT_TRUE(journal.load(origin, destDir, entries, dirs, dirsCreated));
+	ASSERT_EQ(entries.size(), 2U);
+	EXPECT_FALSE(entries[0].done);
+
+	ASSERT_TRUE(journal.resume(destDir, entries.size(), 0U));
+	journal.fileDone(first);
+	EXPECT_FALSE(journal.close());
+	ASSERT_TRUE(journal.load(origin, destDir, entries, dirs, dirsCreated));
+	EXPECT_TRUE(entries[0].done);
+	EXPECT_FALSE(entries[1].done);
+
+	fs::remove_all(destDir);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, jobStats_Histograms)
+{
+	using namespace std::chrono_literals;
+	EXPECT_EQ(CopyLib::TJobStats::getSizeClass(0U), 0U);
+	EXPECT_EQ(CopyLib::TJobStats::getSizeClass(4095U), 0U);
+	EXPECT_EQ(CopyLib::TJobStats::getSizeClass(4096U), 1U);
+	EXPECT_EQ(CopyLib::TJobStats::getSizeClass(1U << 20U), 3U);
+	EXPECT_EQ(CopyLib::TJobStats::getSizeClass(1ULL << 40U), CopyLib::TJobStats::sizeClassesNum - 1U);
+	EXPECT_EQ(CopyLib::TJobStats::getLatencyBucket(0ns), 0U);
+	EXPECT_EQ(CopyLib::TJobStats::getLatencyBucket(1999ns), 0U);
+	EXPECT_EQ(CopyLib::TJobStats::getLatencyBucket(3us), 1U);
+	EXPECT_EQ(CopyLib::TJobStats::getLatencyBucket(1ms), 9U);
+	EXPECT_EQ(CopyLib::TJobStats::getLatencyBucket(1h), CopyLib::TJobStats::latencyBucketsNum - 1U);
+
+	auto & stats = CopyLib::TJobStats::getInstance();
+	stats.reset(2U);
+	stats.addFile(0U, 100U, 3us);
+	stats.addFile(1U, 1U << 20U, 1ms);
+	stats.addFile(1U, 1U << 20U, 1ms);
+	stats.addFile(2U, 100U, 3us); // Not a worker of the job
+	stats.addQueueWait(1U, 10us);
+	const auto start = std::chrono::steady_clock::now();
+	stats.addPhase(CopyLib::EJobPhase::Verify, start, start + 10ms);
+	stats.addPhase(CopyLib::EJobPhase::Verify, start + 5ms, start + 20ms);
+	EXPECT_EQ(stats.getFileNum(0U, 0U, 1U), 1U);
+	EXPECT_EQ(stats.getFileNum(1U, 3U, 9U), 2U);
+	EXPECT_EQ(stats.getQueueWaitNum(1U, 3U), 1U);
+	EXPECT_EQ(stats.getPhaseWall(CopyLib::EJobPhase::Verify), 20ms);
+	EXPECT_EQ(stats.getPhaseBusy(CopyLib::EJobPhase::Verify), 25ms);
+	EXPECT_EQ(stats.getPhaseWall(CopyLib::EJobPhase::Scan), 0ns);
+
+	const std::string json = stats.toJson();
+	EXPECT_NE(json.find("\"verify\":{\"wall_sec\":0.020000,\"busy_sec\":0.025000}"), std::string::npos);
+	EXPECT_NE(json.find("\"lt1m\":{\"count\":0"), std::string::npos);
+	EXPECT_NE(json.find("\"lt16m\":{\"count\":2,\"sum_sec\":0.002000"), std::string::npos);
+	const std::string text = stats.toPrometheus();
+	EXPECT_NE(text.find("simplecopier_file_latency_seconds_bucket{worker=\"1\",size=\"lt16m\",le=\"0.001024\"} 2"), std::string::npos);
+	EXPECT_NE(text.find("simplecopier_file_latency_seconds_bucket{worker=\"1\",size=\"lt16m\",le=\"0.000512\"} 0"), std::string::npos);
+	EXPECT_NE(text.find("simplecopier_file_latency_seconds_count{worker=\"0\",size=\"lt4k\"} 1"), std::string::npos);
+	EXPECT_EQ(text.find("size=\"lt1m\""), std::string::npos); // Empty classes are left out
+	EXPECT_NE(text.find("simplecopier_queue_wait_seconds_bucket{worker=\"1\",le=\"+Inf\"} 1"), std::string::npos);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, worker_JobStatsSaved)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	const auto statsFile = tempDir + "SimpleCopierStats.prom";
+	fs::create_directories(originDir + "sub/");
+	fs::create_directories(destDir);
+	const uint32_t filesNum{ 30U };
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		std::ofstream fout(originDir + (i % 2U ? "sub/" : "") + "file_" + std::to_string(i), std::ios::binary);
+		fout << std::string((i % 3U) * 5000U, 'x');
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.statsFile = statsFile;
+	options.statsFormat = CopyLib::EStatsFormat::Prometheus;
+	CopyLib::setCopyOptions(options);
+
+	const uint32_t threadsNum{ 2U };
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, threadsNum, scopeSize, fileNum, noCancel));
+	CopyLib::copyDirStructure();
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < threadsNum; i++)
+	{
+		threads.emplace_back(CopyLib::worker, i, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	}
+	EXPECT_TRUE(CopyLib::saveJobStats()); // On demand while the workers copy
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	// Every file is in a histogram and took one wait for the queue, the last wait finds it empty
+	const auto & stats = CopyLib::TJobStats::getInstance();
+	uint64_t files{ 0U };
+	uint64_t waits{ 0U };
+	for (uint32_t worker = 0U; worker < threadsNum; worker++)
+	{
+		for (size_t bucket = 0U; bucket < CopyLib::TJobStats::latencyBucketsNum; bucket++)
+		{
+			waits += stats.getQueueWaitNum(worker, bucket);
+			for (size_t sizeClass = 0U; sizeClass < CopyLib::TJobStats::sizeClassesNum; sizeClass++)
+			{
+				files += stats.getFileNum(worker, sizeClass, bucket);
+			}
+		}
+	}
+	EXPECT_EQ(files, filesNum);
+	EXPECT_EQ(waits, filesNum);
+	EXPECT_GT(stats.getPhaseWall(CopyLib::EJobPhase::Scan).count(), 0);
+	EXPECT_GT(stats.getPhaseWall(CopyLib::EJobPhase::Mkdir).count(), 0);
+	EXPECT_GT(stats.getPhaseWall(CopyLib::EJobPhase::Copy).count(), 0);
+	EXPECT_EQ(stats.getPhaseWall(CopyLib::EJobPhase::Verify).count(), 0);
+
+	std::ifstream fin(statsFile);
+	std::stringstream saved;
+	saved << fin.rdbuf();
+	EXPECT_EQ(saved.str(), stats.toPrometheus()); // Saved at the end of the job
+	EXPECT_FALSE(fs::exists(statsFile + ".tmp"));
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(statsFile);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, tracer_ThreadBuffers)
+{
+	const auto traceFile = fs::temp_directory_path().string() + "SimpleCopierTrace.json";
+	auto & tracer = CopyLib::TTracer::getInstance();
+	tracer.start();
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < 3U; i++)
+	{
+		threads.emplace_back([&tracer, i]()
+		{
+			tracer.nameThread("thread " + std::to_string(i));
+			for (uint32_t j = 0U; j < 100U; j++)
+			{
+				const CopyLib::TTraceSpan span("span", "test", "quote \" and \\ in a detail");
+			}
+		});
+	}
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	const auto now = std::chrono::steady_clock::now();
+	tracer.addSpan("async", "test", now, now + std::chrono::milliseconds(1), std::string(), true);
+	tracer.stop();
+	{
+		const CopyLib::TTraceSpan span("not recorded", "test");
+	}
+	ASSERT_TRUE(tracer.save(traceFile));
+
+	std::ifstream fin(traceFile);
+	std::stringstream saved;
+	saved << fin.rdbuf();
+	const std::string trace = saved.str();
+	const auto count = [&trace](const std::string & text)
+	{
+		size_t num{ 0U };
+		for (size_t pos = trace.find(text); pos != std::string::npos; pos = trace.find(text, pos + 1U))
+		{
+			num++;
+		}
+		return num;
+	};
+	EXPECT_EQ(trace.rfind("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 0U), 0U);
+	EXPECT_EQ(count("\"name\":\"span\",\"cat\":\"test\",\"ph\":\"X\""), 300U);
+	EXPECT_EQ(count("{\"detail\":\"quote \\\" and \\\\ in a detail\"}"), 300U); // Escaped
+	EXPECT_EQ(count("\"ph\":\"b\",\"id\":1,"), 1U);
+	EXPECT_EQ(count("\"ph\":\"e\",\"id\":1,"), 1U);
+	EXPECT_EQ(count("\"thread_name\""), 3U);
+	EXPECT_EQ(count("not recorded"), 0U);
+	for (uint32_t i = 1U; i <= 3U; i++) // A thread a buffer, the main thread is the 4th
+	{
+		EXPECT_EQ(count("\"tid\":" + std::to_string(i) + ",\"args\":{\"detail\""), 100U);
+	}
+
+	tracer.start(); // The previous trace is dropped
+	ASSERT_TRUE(tracer.save(traceFile));
+	tracer.stop();
+	std::ifstream emptyIn(traceFile);
+	const std::string empty((std::istreambuf_iterator<char>(emptyIn)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(empty.find("\"span\""), std::string::npos);
+	fs::remove(traceFile);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, worker_TraceSaved)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	const auto traceFile = tempDir + "SimpleCopierTrace.json";
+	fs::create_directories(originDir + "sub/");
+	fs::create_directories(destDir);
+	const uint32_t filesNum{ 20U };
+	for (uint32_t i = 0U; i < filesNum; i++)
+	{
+		std::ofstream fout(originDir + (i % 2U ? "sub/" : "") + "file_" + std::to_string(i), std::ios::binary);
+		fout << std::string(i * 100U, 'x');
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.traceFile = traceFile;
+	options.verify = true;
+	CopyLib::setCopyOptions(options);
+
+	const uint32_t threadsNum{ 2U };
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, threadsNum, scopeSize, fileNum, noCancel));
+	CopyLib::copyDirStructure();
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	std::atomic<uint32_t> finishedVerifiersNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	std::vector<std::thread> threads;
+	for (uint32_t i = 0U; i < threadsNum; i++)
+	{
+		threads.emplace_back(CopyLib::worker, i, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	}
+	std::thread verifyThread(CopyLib::verifier, std::ref(finishedVerifiersNum), std::cref(copyCancel));
+	for (auto & thread : threads)
+	{
+		thread.join();
+	}
+	CopyLib::finishVerify();
+	verifyThread.join();
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+	EXPECT_FALSE(CopyLib::TTracer::getInstance().isRecording());
+
+	std::ifstream fin(traceFile);
+	std::stringstream saved;
+	saved << fin.rdbuf();
+	const std::string trace = saved.str();
+	const auto count = [&trace](const std::string & text)
+	{
+		size_t num{ 0U };
+		for (size_t pos = trace.find(text); pos != std::string::npos; pos = trace.find(text, pos + 1U))
+		{
+			num++;
+		}
+		return num;
+	};
+	EXPECT_EQ(count("\"name\":\"createCopyQueues\""), 1U);
+	EXPECT_EQ(count("\"name\":\"copyDirStructure\""), 1U);
+	EXPECT_EQ(count("\"name\":\"copy file\""), filesNum);
+	EXPECT_EQ(count("\"name\":\"verify\""), filesNum);
+	EXPECT_EQ(count("{\"name\":\"worker 0\"}"), 1U);
+	EXPECT_EQ(count("{\"name\":\"worker 1\"}"), 1U);
+	EXPECT_EQ(count("{\"name\":\"verifier\"}"), 1U);
+	EXPECT_NE(trace.find("\"detail\":\"sub/file_1\""), std::string::npos);
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(traceFile);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, bufferPool_ReusesAlignedBuffers)
+{
+	auto & pool = CopyLib::TAlignedBufferPool::getInstance();
+	pool.clear();
+	const uint64_t allocatedNum = pool.getAllocatedNum();
+
+	char * first = pool.acquire(100000U); // Rounded up to 25 pages
+	ASSERT_NE(first, nullptr);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(first) % CopyLib::TAlignedBufferPool::directAlignment, 0U);
+	first[CopyLib::TAlignedBufferPool::alignSize(100000U) - 1U] = 'x';
+	char * second = pool.acquire(100000U);
+	ASSERT_NE(second, nullptr);
+	EXPECT_NE(first, second);
+	EXPECT_EQ(pool.getAllocatedNum(), allocatedNum + 2U);
+
+	pool.release(first, 100000U);
+	EXPECT_EQ(pool.getFreeNum(), 1U);
+	EXPECT_EQ(pool.acquire(100001U), first); // The same aligned size
+	EXPECT_EQ(pool.getAllocatedNum(), allocatedNum + 2U);
+	{
+		const CopyLib::TPooledBuffer buffer(4096U); // Another size, a new buffer
+		ASSERT_NE(buffer.get(), nullptr);
+		EXPECT_EQ(pool.getAllocatedNum(), allocatedNum + 3U);
+	}
+	EXPECT_EQ(pool.getFreeNum(), 1U);
+
+	pool.release(first, 100000U);
+	pool.release(second, 100000U);
+	EXPECT_EQ(pool.getFreeNum(), 3U);
+	pool.clear();
+	EXPECT_EQ(pool.getFreeNum(), 0U);
+}
+
+//======================================================================================================
+
+TEST(CopyLibTests, worker_DirectLargeFiles)
+{
+	const auto tempDir = fs::temp_directory_path().string();
+	const auto originDir = tempDir + "origin/";
+	const auto destDir = tempDir + "dest/";
+	fs::create_directories(originDir);
+	fs::create_directories(destDir);
+
+	// A file with an unaligned tail, a split one in aligned ranges, small files through the page cache
+	const std::vector<size_t> sizes{ (5U << 20U) + 123U, (10U << 20U) + 5U, 4096U, 100U, 0U };
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		std::ofstream fout(originDir + "file_" + std::to_string(i), std::ios::binary);
+		ASSERT_TRUE(fout.is_open());
+		std::string content(sizes[i], '\0');
+		for (size_t j = 0U; j < content.size(); j++)
+		{
+			content[j] = static_cast<char>(j * 13U + i);
+		}
+		fout << content;
+	}
+	// Stale bigger destination must be truncated
+	{
+		std::ofstream fout(destDir + "file_0", std::ios::binary);
+		fout << std::string(6U << 20U, 'x');
+	}
+
+	const auto savedOptions = CopyLib::getCopyOptions();
+	auto options = savedOptions;
+	options.directThreshold = 1U << 20U;
+	options.directBlockSize = 1U << 20U; // Several blocks a file
+	options.splitThreshold = 8U << 20U;
+	options.splitRangeSize = 4U << 20U;
+	CopyLib::setCopyOptions(options);
+
+	uint64_t scopeSize{ 0U };
+	uint64_t fileNum{ 0U };
+	ASSERT_TRUE(CopyLib::createCopyQueues(originDir, destDir, 2U, scopeSize, fileNum, noCancel));
+	std::atomic<uint64_t> copiedFileSize{ 0U };
+	std::atomic<uint64_t> copiedFileNum{ 0U };
+	std::atomic<uint32_t> finishedThreadsNum{ 0U };
+	const std::atomic<bool> copyCancel{ false };
+	std::thread th1(CopyLib::worker, 0U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	std::thread th2(CopyLib::worker, 1U, std::ref(copiedFileSize), std::ref(copiedFileNum), std::ref(finishedThreadsNum), std::cref(copyCancel));
+	th1.join();
+	th2.join();
+	const uint64_t directNum = CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::Direct)
+	                         + CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::Uncached)
+	                         + CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::Reflink);
+	const uint64_t splitNum = CopyLib::getCopyMethodFilesNum(CopyLib::ECopyMethod::SplitRanges);
+	CopyLib::removeCopyQueues();
+	CopyLib::setCopyOptions(savedOptions);
+
+	EXPECT_EQ(finishedThreadsNum, 2U);
+	EXPECT_EQ(copiedFileNum, fileNum);
+	EXPECT_EQ(copiedFileSize, scopeSize);
+	EXPECT_GE(directNum, 1U); // Small files may be reflinked too
+	EXPECT_EQ(splitNum, 1U);
+	EXPECT_FALSE(CopyLib::isCopyErrorHappened());
+	EXPECT_EQ(CopyLib::TAlignedBufferPool::getInstance().getFreeNum(), 0U); // Freed at the end of the job
+	for (size_t i = 0U; i < sizes.size(); i++)
+	{
+		const auto file = "file_" + std::to_string(i);
+		std::ifstream originIn(originDir + file, std::ios::binary);
+		std::ifstream destIn(destDir + file, std::ios::binary);
+		ASSERT_TRUE(destIn.is_open());
+		const std::string originContent((std::istreambuf_iterator<char>(originIn)), std::istreambuf_iterator<char>());
+		const std::string destContent((std::istreambuf_iterator<char>(destIn)), std::istreambuf_iterator<char>());
+		EXPECT_TRUE(originContent == destContent) << file;
+	}
+
+	// Unaligned ranges are copied through the page cache, their pages are dropped
+	const auto originFile = originDir + "file_1";
+	const auto destFile = destDir + "file_1";
+	fs::remove(destFile);
+	std::error_code code;
+	CopyLib::TFileStat stat;
+	ASSERT_TRUE(CopyLib::statFile(originFile, stat, code));
+	CopyLib::TSplitFile split;
+	split.size = stat.size;
+	split.mode = stat.mode;
+	split.directBlockSize = 1U << 20U;
+	const uint64_t rangeSize{ 3000000U };
+	split.rangesLeft.store(static_cast<uint32_t>((stat.size + rangeSize - 1U) / rangeSize));
+	for (uint64_t offset = 0U; offset < stat.size; offset += rangeSize)
+	{
+		uint64_t written{ 0U };
+		const uint64_t length = std::min(rangeSize, stat.size - offset);
+		EXPECT_TRUE(CopyLib::copyRange(originFile, destFile, split, offset, length, code, written));
+		EXPECT_FALSE(code) << code.message();
+		EXPECT_EQ(written, length);
+	}
+	EXPECT_EQ(fs::file_size(destFile), stat.size);
+	EXPECT_TRUE(CopyLib::isSameContent(originFile, destFile, stat.size, code));
+
+	// The origin shrank after the plan: a direct range is short, an error, not a silently cut copy.
+	// A whole file is copied with the size of the open origin.
+	const uint64_t shrunkSize{ (1U << 20U) + 100U };
+	fs::resize_file(originFile, shrunkSize);
+	fs::remove(destFile);
+	CopyLib::TSplitFile shrunkSplit;
+	shrunkSplit.size = stat.size;
+	shrunkSplit.mode = stat.mode;
+	shrunkSplit.directBlockSize = 1U << 20U;
+	shrunkSplit.rangesLeft.store(1U);
+	uint64_t written{ 0U };
+	EXPECT_FALSE(CopyLib::copyRange(originFile, destFile, shrunkSplit, 0U, 2U << 20U, code, written));
+	EXPECT_EQ(code, std::errc::io_error) << code.message();
+	EXPECT_EQ(written, shrunkSize);
+	CopyLib::ECopyMethod method{ CopyLib::ECopyMethod::Buffered };
+	uint64_t size{ 0U };
+	EXPECT_TRUE(CopyLib::directCopyFile(originFile, destFile, stat, 1U << 20U, code, method, size));
+	EXPECT_FALSE(code) << code.message();
+	EXPECT_EQ(size, shrunkSize);
+	EXPECT_EQ(fs::file_size(destFile), shrunkSize);
+	EXPECT_TRUE(CopyLib::isSameContent(originFile, destFile, shrunkSize, code));
+
+	fs::remove_all(originDir);
+	fs::remove_all(destDir);
+	fs::remove(CopyLib::TLogger::getInstance().getLogFileName());
+}
+
+//======================================================================================================
+
 // If we want to cover all branches by unit tests in worker fun
 // It is needed to add a lot extra tests
 
@@ -18,12 +18,40 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    bufferpool.cpp \
+    controller.cpp \
     copylib.cpp \
+    copyengine.cpp \
+    copyqueue.cpp \
+    devicelimits.cpp \
+    jobstats.cpp \
+    journal.cpp \
+    logger.cpp \
+    progresscounters.cpp \
+    tracer.cpp \
+    treewalker.cpp \
+    uringengine.cpp \
+    verifier.cpp \
+    workercontrol.cpp \
     main.cpp \
     mainwindow.cpp
 
 HEADERS += \
+    bufferpool.h \
+    controller.h \
     copylib.h \
+    copyengine.h \
+    copyqueue.h \
+    devicelimits.h \
+    jobstats.h \
+    journal.h \
+    logger.h \
+    progresscounters.h \
+    tracer.h \
+    treewalker.h \
+    uringengine.h \
+    verifier.h \
+    workercontrol.h \
     mainwindow.h
 
 FORMS += \
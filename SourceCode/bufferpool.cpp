@@ -0,0 +1,87 @@
+
+#include "bufferpool.h"
+
+#include <new>
+
+namespace CopyLib {
+
+//===================================================================================================================================
+
+char * TAlignedBufferPool::acquire(const size_t size)
+{
+    const size_t alignedSize = alignSize(size);
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        // The newest buffer of the size, it is the most likely one to be in the CPU cache
+        for (auto it = freeBuffers.rbegin(); it != freeBuffers.rend(); ++it)
+        {
+            if (it->size == alignedSize)
+            {
+                char * buffer = it->buffer;
+                freeBuffers.erase(std::next(it).base());
+                return buffer;
+            }
+        }
+    }
+    auto buffer = static_cast<char *>(::operator new(alignedSize, std::align_val_t(directAlignment), std::nothrow));
+    if (buffer != nullptr)
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        allocatedNum++;
+    }
+    return buffer;
+}
+
+//===================================================================================================================================
+
+void TAlignedBufferPool::release(char * buffer, const size_t size)
+{
+    if (buffer == nullptr)
+    {
+        return;
+    }
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        if (freeBuffers.size() < maxFreeBuffers)
+        {
+            freeBuffers.push_back(TFreeBuffer{ buffer, alignSize(size) });
+            return;
+        }
+    }
+    ::operator delete(buffer, std::align_val_t(directAlignment));
+}
+
+//===================================================================================================================================
+
+void TAlignedBufferPool::clear()
+{
+    std::vector<TFreeBuffer> buffers;
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        buffers.swap(freeBuffers);
+    }
+    for (const auto & buffer : buffers)
+    {
+        ::operator delete(buffer.buffer, std::align_val_t(directAlignment));
+    }
+}
+
+//===================================================================================================================================
+
+uint64_t TAlignedBufferPool::getAllocatedNum() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return allocatedNum;
+}
+
+//===================================================================================================================================
+
+size_t TAlignedBufferPool::getFreeNum() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return freeBuffers.size();
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
@@ -0,0 +1,88 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // Buffers for direct I/O (see directCopyFile): their address is aligned to directAlignment and their size is rounded
+    // up to it. A released buffer is kept for the next file, so a job of many big files allocates a buffer per worker.
+    class TAlignedBufferPool
+    {
+    public:
+
+        static TAlignedBufferPool & getInstance()
+        {
+            static TAlignedBufferPool pool;
+            return pool;
+        }
+
+        // A page, the logical block size of every common device divides it
+        static constexpr size_t directAlignment{ 4096U };
+
+        // Free buffers kept by the pool, the rest are freed on release
+        static constexpr size_t maxFreeBuffers{ 64U };
+
+        static size_t alignSize(const size_t size) { return (size + directAlignment - 1U) / directAlignment * directAlignment; }
+
+        // A buffer of at least size bytes (rounded up to the alignment), nullptr if it can not be allocated
+        char * acquire(const size_t size);
+
+        // size is the one passed to acquire
+        void release(char * buffer, const size_t size);
+
+        // Frees the kept buffers, called at the end of a job
+        void clear();
+
+        // Buffers allocated since the start, reused ones are not counted
+        uint64_t getAllocatedNum() const;
+
+        size_t getFreeNum() const;
+
+    private:
+
+        TAlignedBufferPool() { }
+        ~TAlignedBufferPool() { clear(); }
+        TAlignedBufferPool(const TAlignedBufferPool & pool) = delete;
+        TAlignedBufferPool operator=(const TAlignedBufferPool & pool) = delete;
+
+        struct TFreeBuffer
+        {
+            char * buffer{ nullptr };
+            size_t size{ 0U }; // Aligned
+        };
+
+        mutable std::mutex mutex;
+        std::vector<TFreeBuffer> freeBuffers;
+        uint64_t allocatedNum{ 0U };
+
+    }; // TAlignedBufferPool
+
+    // Buffer of the pool for the enclosing scope
+    class TPooledBuffer
+    {
+    public:
+
+        explicit TPooledBuffer(const size_t size)
+            : size(size), buffer(TAlignedBufferPool::getInstance().acquire(size)) { }
+
+        ~TPooledBuffer() { TAlignedBufferPool::getInstance().release(buffer, size); }
+
+        char * get() const { return buffer; }
+
+    private:
+
+        TPooledBuffer(const TPooledBuffer & buffer) = delete;
+        TPooledBuffer operator=(const TPooledBuffer & buffer) = delete;
+
+        const size_t size;
+        char * const buffer;
+
+    }; // TPooledBuffer
+
+} // namespace CopyLib
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,263 @@
+
+#include "controller.h"
+#include "copylib.h"
+#include "copyqueue.h"
+#include "workercontrol.h"
+
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+using namespace std::chrono_literals;
+
+namespace
+{
+    const auto progressInterval { 30ms };
+
+    const auto oneMb = 1'048'576.0f;
+
+}; // namespace
+
+//===================================================================================================================================
+
+void TCopyController::startJob(const TCopyJob & job)
+{
+    progress.reset(0U);
+    const auto copyOptions = CopyLib::getCopyOptions();
+    bool ret{ false };
+    if (job.streaming)
+    {
+        scopeSize.store(0U);
+        fileNum.store(0U);
+        ret = CopyLib::openCopyQueues(job.origin.toStdString(), job.dest.toStdString(), job.workersNum);
+    }
+    else
+    {
+        uint64_t planSize{ 0U };
+        uint64_t planFileNum{ 0U };
+        ret = CopyLib::createCopyQueues(job.origin.toStdString(), job.dest.toStdString(), job.workersNum, planSize, planFileNum, copyCancel);
+        scopeSize.store(planSize);
+        fileNum.store(planFileNum);
+    }
+    if (!ret)
+    {
+        emit jobFailed(copyCancel ? "Copy is CANCELED during the scan."
+                                  : "Can not create copy files queues. Probably access denied (for origin dir).");
+        return;
+    }
+    if (!job.streaming)
+    {
+        emit planReady(getPlanInfo(false));
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    runCopy(job);
+    if (job.streaming)
+    {
+        emit planReady(getPlanInfo(true)); // Known only when the scan is finished
+    }
+    CopyLib::removeCopyQueues();
+
+    const auto end = std::chrono::steady_clock::now();
+    const auto time = std::chrono::duration <double, std::milli> (end - start).count();
+    emit progressChanged(getProgressInfo(start));
+
+    // Status message
+    std::string message;
+    const uint64_t copiedFileSize = progress.getCopiedSize();
+    const uint64_t copiedFileNum = progress.getCopiedNum();
+    if (copyCancel)
+    {
+        message = "Copy is CANCELED! Copied files: " + std::to_string(copiedFileNum) + " from "
+                + std::to_string(fileNum) + ", Copied size: "
+                + std::to_string(copiedFileSize/oneMb) + " MBytes, Took time: "
+                + std::to_string(time/1000.0f) + " sec.";
+    }
+    else
+    {
+        message = "Copy is DONE. Copied files: " + std::to_string(copiedFileNum) + ", Total size: "
+                + std::to_string(copiedFileSize/oneMb) + " MBytes, Took time: "
+                + std::to_string(time/1000.0f) + " sec.";
+    }
+    if (copyOptions.sync)
+    {
+        message += " Skipped unchanged: " + std::to_string(CopyLib::getSkippedFileNum()) + " files, "
+                 + std::to_string(CopyLib::getSkippedFileSize()/oneMb) + " MBytes.";
+    }
+    if (copyOptions.delta)
+    {
+        message += " Written: " + std::to_string(CopyLib::getWrittenFileSize()/oneMb) + " MBytes.";
+    }
+    if (copyOptions.dedup && !job.streaming)
+    {
+        message += " Deduplicated: " + std::to_string(CopyLib::getDedupFileNum()) + " files, saved "
+                 + std::to_string(CopyLib::getDedupSavedSize()/oneMb) + " MBytes.";
+    }
+    if (copyOptions.verify)
+    {
+        message += " Verified: " + std::to_string(CopyLib::getVerifiedFileSize()/oneMb) + " MBytes, mismatches: "
+                 + std::to_string(CopyLib::getVerifyMismatchNum()) + ".";
+    }
+    if (CopyLib::getResumedFileNum() > 0U)
+    {
+        message += " Resumed job, already copied: " + std::to_string(CopyLib::getResumedFileNum()) + " files, "
+                 + std::to_string(CopyLib::getResumedFileSize()/oneMb) + " MBytes.";
+    }
+    emit jobFinished(QString::fromStdString(message), copyCancel, CopyLib::isCopyErrorHappened());
+}
+
+//===================================================================================================================================
+
+void TCopyController::runCopy(const TCopyJob & job)
+{
+    std::thread scanThread;
+    if (job.streaming)
+    {
+        // Workers start right away and copy files while the scanner is still walking the origin
+        scanThread = std::thread(CopyLib::scanner, std::ref(scopeSize), std::ref(fileNum), std::ref(copyCancel));
+    }
+    else
+    {
+        CopyLib::copyDirStructure();
+
+        if (CopyLib::isCopyErrorHappened())
+        {
+            return;
+        }
+
+        if (fileNum == 0U)
+        {
+            // no files to copy
+            return;
+        }
+    }
+
+    // A few io_uring threads keep many files in flight and steal from all the queues,
+    // a thread per queue is the fallback when io_uring is not available
+    const auto copyOptions = CopyLib::getCopyOptions();
+    const uint32_t threadsNum = job.ioUring ? std::clamp(copyOptions.uringThreadsNum, 1U, job.hardwConcur)
+                                            : CopyLib::TCopyQueues::getInstance().getQueuesNum();
+    const auto workerFun = job.ioUring ? CopyLib::uringWorker : CopyLib::worker;
+
+    // Start threads
+    std::thread ** ppThreads = new (std::nothrow) std::thread * [threadsNum];
+    if (ppThreads == nullptr)
+    {
+        emit errorOccurred("Fatal error", QString(__FUNCTION__) + " - Sorry not enought memory, can not alloc memory for threads!");
+        copyCancel.store(true); // Stops the scanner
+        if (scanThread.joinable())
+        {
+            scanThread.join();
+        }
+        return;
+    }
+    finishedThreadsNum.store(0U);
+    progress.reset(threadsNum);
+    for(uint32_t i = 0U; i < threadsNum; i++)
+    {
+        ppThreads[i] = new (std::nothrow) std::thread(workerFun, i,
+                                                      std::ref(progress[i].copiedSize),
+                                                      std::ref(progress[i].copiedNum),
+                                                      std::ref(finishedThreadsNum),
+                                                      std::ref(copyCancel));
+
+        if (ppThreads[i] == nullptr) // Safe start canceling
+        {
+            emit errorOccurred("Fatal error", QString(__FUNCTION__) + " - Sorry not enought memory, can not alloc memory for a thread!");
+            copyCancel.store(true); // Stops the scanner and started workers
+            if (scanThread.joinable())
+            {
+                scanThread.join();
+            }
+            for(size_t j = 0U; j < i; j++)
+            {
+                ppThreads[j]->join();
+                delete ppThreads[j];
+            }
+            delete [] ppThreads;
+            return;
+        }
+    }
+
+    // Verifiers check landed files while the workers go on copying
+    std::vector<std::thread> verifyThreads;
+    finishedVerifiersNum.store(0U);
+    if (copyOptions.verify)
+    {
+        for (uint32_t i = 0U; i < std::max(copyOptions.verifyThreadsNum, 1U); i++)
+        {
+            verifyThreads.emplace_back(CopyLib::verifier, std::ref(finishedVerifiersNum), std::ref(copyCancel));
+        }
+    }
+
+    // Report the progress, the window repaints in its own thread meanwhile
+    const auto start = std::chrono::steady_clock::now();
+    auto & control = CopyLib::TWorkerControl::getInstance();
+    bool verifyFinishing{ false };
+    while((finishedThreadsNum != threadsNum || finishedVerifiersNum != verifyThreads.size()) && !copyCancel)
+    {
+        std::this_thread::sleep_for(progressInterval);
+        if (!verifyFinishing && finishedThreadsNum == threadsNum)
+        {
+            CopyLib::finishVerify(); // Verifiers drain the rest
+            verifyFinishing = true;
+        }
+        if (control.isAdaptive())
+        {
+            control.update(progress.getCopiedSize(), progress.getCopiedNum());
+        }
+        emit progressChanged(getProgressInfo(start));
+    }
+
+    // Finishing the threads
+    if (scanThread.joinable())
+    {
+        scanThread.join();
+    }
+    for(size_t i = 0U; i < threadsNum; i++)
+    {
+        ppThreads[i]->join();
+        delete ppThreads[i];
+    }
+    delete [] ppThreads;
+    CopyLib::finishVerify();
+    for (auto & verifyThread : verifyThreads)
+    {
+        verifyThread.join();
+    }
+}
+
+//===================================================================================================================================
+
+QString TCopyController::getPlanInfo(const bool streaming) const
+{
+    return QString("Threads: ") + std::to_string(CopyLib::TCopyQueues::getInstance().getQueuesNum()).c_str()
+            + ", queues imbalance (max/avg bytes): " + QString::number(CopyLib::getPlanImbalance(), 'f', 2)
+            + (streaming ? QString(", streaming scan")
+                         : ", round-robin would give: " + QString::number(CopyLib::getRoundRobinImbalance(), 'f', 2));
+}
+
+//===================================================================================================================================
+
+TCopyProgressInfo TCopyController::getProgressInfo(const std::chrono::steady_clock::time_point start) const
+{
+    const auto & control = CopyLib::TWorkerControl::getInstance();
+    TCopyProgressInfo info;
+    info.copiedSize = progress.getCopiedSize();
+    info.copiedNum = progress.getCopiedNum();
+    info.scopeSize = scopeSize;
+    info.fileNum = fileNum;
+    info.verifiedSize = CopyLib::getVerifiedFileSize();
+    info.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    info.percent = (info.scopeSize == 0U) ? 0 : static_cast<int>((info.copiedSize * 100.0f) / info.scopeSize);
+    info.activeWorkers = control.getActiveNum();
+    info.workersNum = control.getWorkersNum();
+    info.scanning = CopyLib::TCopyQueues::getInstance().isScanning();
+    info.verify = CopyLib::getCopyOptions().verify;
+    info.adaptive = control.isAdaptive();
+    return info;
+}
+
+//===================================================================================================================================
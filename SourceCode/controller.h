@@ -0,0 +1,99 @@
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include "progresscounters.h"
+
+#include <QObject>
+#include <QString>
+#include <QMetaType>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// A copy job as the window sets it up, CopyLib options are set before the job is started
+struct TCopyJob
+{
+    QString origin;
+    QString dest;
+    uint32_t workersNum{ 1U };  // Queues and sync workers
+    uint32_t hardwConcur{ 1U }; // Available CPU cores, limits io_uring threads
+    bool streaming{ false };    // Copy while scanning
+    bool ioUring{ false };
+};
+
+// Progress snapshot sent to the window
+struct TCopyProgressInfo
+{
+    uint64_t copiedSize{ 0U };
+    uint64_t copiedNum{ 0U };
+    uint64_t scopeSize{ 0U };    // Grow during the scan in streaming mode
+    uint64_t fileNum{ 0U };
+    uint64_t verifiedSize{ 0U };
+    double seconds{ 0.0 };       // Since the copy start
+    int percent{ 0 };            // Of copied bytes
+    uint32_t activeWorkers{ 0U };
+    uint32_t workersNum{ 0U };
+    bool scanning{ false };
+    bool verify{ false };
+    bool adaptive{ false };
+};
+
+Q_DECLARE_METATYPE(TCopyJob)
+Q_DECLARE_METATYPE(TCopyProgressInfo)
+
+//===================================================================================================================================
+
+// Runs copy jobs on its own thread: scan, workers, verifiers and joins. The window only sends a job and gets
+// the results through queued signals, so it is repainted and stays responsive during the scan and the copy.
+class TCopyController : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit TCopyController(QObject * parent = nullptr) : QObject(parent) { }
+
+    // Thread safe, the job stops as soon as the workers (or the scan) notice it
+    void cancel() { copyCancel.store(true); }
+
+    // Called by the window before a job is requested, a cancel clicked before the job starts is not lost then
+    void resetCancel() { copyCancel.store(false); }
+
+public slots:
+
+    // Blocks the controller thread until the job is done, ends with jobFinished or jobFailed
+    void startJob(const TCopyJob & job);
+
+signals:
+
+    void planReady(const QString & planInfo);
+
+    void progressChanged(const TCopyProgressInfo & info);
+
+    // Shown to the user, the job goes on or finishes as usual
+    void errorOccurred(const QString & title, const QString & message);
+
+    void jobFinished(const QString & message, const bool canceled, const bool errorHappened);
+
+    // The job is not started
+    void jobFailed(const QString & message);
+
+private:
+
+    void runCopy(const TCopyJob & job); // Starts and joins the threads
+
+    QString getPlanInfo(const bool streaming) const;
+
+    TCopyProgressInfo getProgressInfo(const std::chrono::steady_clock::time_point start) const;
+
+    std::atomic<bool> copyCancel{ false };
+    std::atomic<uint64_t> scopeSize{ 0U }; // Size all files to copy
+    std::atomic<uint64_t> fileNum{ 0U };   // Files number to copy
+    CopyLib::TProgressCounters progress;   // A counters block per worker
+    std::atomic<uint32_t> finishedThreadsNum{ 0U };
+    std::atomic<uint32_t> finishedVerifiersNum{ 0U };
+
+}; // TCopyController
+
+#endif // CONTROLLER_H
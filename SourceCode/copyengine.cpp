@@ -0,0 +1,1368 @@
+
+#include "copyengine.h"
+#include "bufferpool.h"
+
+#include <filesystem>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <cerrno>
+#endif
+
+namespace CopyLib {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    const size_t compareBufferSize{ 1U << 20U }; // Chunk of both files compared by isSameContent
+
+    std::atomic<uint64_t> methodFilesNum[static_cast<uint32_t>(ECopyMethod::Count)];
+    std::atomic<uint64_t> syscallsNum{ 0U };
+    std::atomic<bool> emptyKernelCopy{ false }; // See setEmptyKernelCopy
+
+    const char * methodNames[static_cast<uint32_t>(ECopyMethod::Count)] { "reflink", "copy_file_range", "sendfile", "buffered", "fs::copy_file", "io_uring", "split ranges", "delta", "hardlink", "direct I/O", "fadvise dontneed" };
+
+    const uint64_t progressChunkSize{ 16ULL << 20U }; // Max bytes for one kernel copy call when the progress is published
+
+    // Publishes a written chunk, true if the copy is canceled
+    bool publishChunk(TCopyProgress * progress, const uint64_t bytes)
+    {
+        if (progress == nullptr)
+        {
+            return false;
+        }
+        if (progress->copiedSize != nullptr)
+        {
+            *progress->copiedSize += bytes;
+        }
+        progress->published += bytes;
+        return progress->cancel != nullptr && progress->cancel->load();
+    }
+
+#if defined(__linux__)
+
+    const size_t bufferSize{ 1U << 20U };       // Buffered copy chunk
+    const size_t kernelChunkSize{ 1U << 30U };  // Max bytes for one copy_file_range/sendfile call
+
+    // Closes the descriptor on scope exit
+    class TFileDescriptor
+    {
+    public:
+        explicit TFileDescriptor(const int fd) : fd(fd) { }
+        ~TFileDescriptor() { if (fd >= 0) { ::close(fd); syscallsNum++; } }
+        TFileDescriptor(const TFileDescriptor & other) = delete;
+        TFileDescriptor operator=(const TFileDescriptor & other) = delete;
+
+        int get() const { return fd; }
+
+        // Close errors are write errors on NFS, so they are reported
+        bool close()
+        {
+            const int ret = ::close(fd);
+            syscallsNum++;
+            fd = -1;
+            return ret == 0;
+        }
+
+    private:
+        int fd{ -1 };
+    };
+
+    // Errors meaning "this method is not supported here, try the next one"
+    bool isNotSupported(const int error)
+    {
+        return error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY || error == EXDEV
+            || error == EINVAL || error == EBADF || error == ETXTBSY || error == EPERM;
+    }
+
+    // 1 if the whole size is copied, -1 for a short copy: the file ended before the size, the destination is not complete
+    int isCopyComplete(const uint64_t copied, const uint64_t size)
+    {
+        if (copied < size)
+        {
+            errno = EIO;
+            return -1;
+        }
+        return 1;
+    }
+
+    // Returns 1 on success, 0 if not supported (nothing written), -1 on error (errno is ECANCELED for a canceled copy)
+    int kernelCopyFileRange(const int src, const int dst, const uint64_t size, TCopyProgress * progress)
+    {
+        const uint64_t chunkSize = (progress != nullptr) ? progressChunkSize : kernelChunkSize;
+        uint64_t copied{ 0U };
+        while (copied < size)
+        {
+            const ssize_t ret = emptyKernelCopy.load(std::memory_order_relaxed) ? 0 : ::copy_file_range(src, nullptr, dst, nullptr, std::min<uint64_t>(size - copied, chunkSize), 0U);
+            syscallsNum++;
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return (copied == 0U && isNotSupported(errno)) ? 0 : -1;
+            }
+            if (ret == 0) // Nothing copied by the first call: pseudo files, some FUSE and cross filesystem setups
+            {
+                if (copied == 0U)
+                {
+                    return 0;
+                }
+                break;
+            }
+            copied += static_cast<uint64_t>(ret);
+            if (publishChunk(progress, static_cast<uint64_t>(ret)) && copied < size)
+            {
+                errno = ECANCELED;
+                return -1;
+            }
+        }
+        return isCopyComplete(copied, size);
+    }
+
+    int sendFile(const int src, const int dst, const uint64_t size, TCopyProgress * progress)
+    {
+        const uint64_t chunkSize = (progress != nullptr) ? progressChunkSize : kernelChunkSize;
+        uint64_t copied{ 0U };
+        while (copied < size)
+        {
+            const ssize_t ret = emptyKernelCopy.load(std::memory_order_relaxed) ? 0 : ::sendfile(dst, src, nullptr, std::min<uint64_t>(size - copied, chunkSize));
+            syscallsNum++;
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return (copied == 0U && isNotSupported(errno)) ? 0 : -1;
+            }
+            if (ret == 0)
+            {
+                if (copied == 0U)
+                {
+                    return 0;
+                }
+                break;
+            }
+            copied += static_cast<uint64_t>(ret);
+            if (publishChunk(progress, static_cast<uint64_t>(ret)) && copied < size)
+            {
+                errno = ECANCELED;
+                return -1;
+            }
+        }
+        return isCopyComplete(copied, size);
+    }
+
+    // Copies from the current offsets to the end of the file, copied is set to the bytes copied
+    bool bufferedCopy(const int src, const int dst, uint64_t & copied, TCopyProgress * progress)
+    {
+        thread_local std::vector<char> buffer(bufferSize);
+        copied = 0U;
+        while (true)
+        {
+            const ssize_t readBytes = ::read(src, buffer.data(), buffer.size());
+            syscallsNum++;
+            if (readBytes < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (readBytes == 0)
+            {
+                return true;
+            }
+            ssize_t written{ 0 };
+            while (written < readBytes)
+            {
+                const ssize_t ret = ::write(dst, buffer.data() + written, readBytes - written);
+                syscallsNum++;
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                written += ret;
+            }
+            copied += static_cast<uint64_t>(readBytes);
+            if (publishChunk(progress, static_cast<uint64_t>(readBytes)))
+            {
+                errno = ECANCELED;
+                return false;
+            }
+        }
+    }
+
+    // Reads length bytes unless the file ends, short reads are possible on network filesystems. Returns -1 on error.
+    ssize_t readFull(const int fd, char * buffer, const size_t length, const uint64_t offset)
+    {
+        size_t done{ 0U };
+        while (done < length)
+        {
+            const ssize_t ret = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            syscallsNum++;
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret < 0)
+            {
+                return -1;
+            }
+            if (ret == 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(ret);
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    // readFull for a direct descriptor and an aligned length. The tail of the file comes as a short unaligned read,
+    // the next read from an unaligned offset would fail, so it ends the reading.
+    ssize_t readDirectFull(const int fd, char * buffer, const size_t length, const uint64_t offset)
+    {
+        size_t done{ 0U };
+        while (done < length)
+        {
+            const ssize_t ret = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            syscallsNum++;
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret < 0)
+            {
+                return -1;
+            }
+            if (ret == 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(ret);
+            if (done % TAlignedBufferPool::directAlignment != 0U)
+            {
+                break;
+            }
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+    bool writeFull(const int fd, const char * buffer, const size_t length, const uint64_t offset)
+    {
+        size_t done{ 0U };
+        while (done < length)
+        {
+            const ssize_t ret = ::pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            syscallsNum++;
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret < 0)
+            {
+                return false;
+            }
+            done += static_cast<size_t>(ret);
+        }
+        return true;
+    }
+
+    // Rewrites only the blocks of [offset, offset + length) differing in the destination, dst is opened for reading and writing.
+    // An origin ending before offset + length fails with EIO, the stale tail of the destination would be kept.
+    bool linuxDeltaRange(const int src, const int dst, const uint64_t offset, const uint64_t length,
+                         const uint32_t blockSize, uint64_t & written, TCopyProgress * progress)
+    {
+        thread_local std::vector<char> srcBuffer;
+        thread_local std::vector<char> dstBuffer;
+        srcBuffer.resize(blockSize);
+        dstBuffer.resize(blockSize);
+        uint64_t done{ 0U };
+        while (done < length)
+        {
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(length - done, blockSize));
+            const ssize_t srcBytes = readFull(src, srcBuffer.data(), chunk, offset + done);
+            if (srcBytes < 0)
+            {
+                return false;
+            }
+            if (srcBytes == 0) // The file was truncated meanwhile
+            {
+                break;
+            }
+            const ssize_t dstBytes = readFull(dst, dstBuffer.data(), static_cast<size_t>(srcBytes), offset + done);
+            if (dstBytes < 0)
+            {
+                return false;
+            }
+            if (dstBytes != srcBytes || std::memcmp(srcBuffer.data(), dstBuffer.data(), static_cast<size_t>(srcBytes)) != 0)
+            {
+                if (!writeFull(dst, srcBuffer.data(), static_cast<size_t>(srcBytes), offset + done))
+                {
+                    return false;
+                }
+                written += static_cast<uint64_t>(srcBytes);
+            }
+            done += static_cast<uint64_t>(srcBytes);
+            if (publishChunk(progress, static_cast<uint64_t>(srcBytes)) && done < length)
+            {
+                errno = ECANCELED;
+                return false;
+            }
+        }
+        return isCopyComplete(done, length) == 1;
+    }
+
+    // Opens with O_DIRECT if tryDirect is set and the filesystem supports it, direct tells if it does
+    int openUncached(const std::string & path, const int flags, const uint32_t mode, const bool tryDirect, bool & direct)
+    {
+        direct = false;
+        if (tryDirect)
+        {
+            syscallsNum++;
+            const int fd = ::open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, mode);
+            if (fd >= 0 || errno != EINVAL)
+            {
+                direct = (fd >= 0);
+                return fd;
+            }
+        }
+        syscallsNum++;
+        return ::open(path.c_str(), flags | O_CLOEXEC, mode);
+    }
+
+    // Writeback of a not direct destination block is started after its write and waited for a block later,
+    // so the disk writes while the next block is read. Dirty pages can not be dropped, clean ones are dropped then.
+    void dropWritten(const int dst, const uint64_t offset, const uint64_t length)
+    {
+        syscallsNum += 2U;
+        ::sync_file_range(dst, static_cast<off64_t>(offset), static_cast<off64_t>(length),
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        ::posix_fadvise(dst, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_DONTNEED);
+    }
+
+    // Copies [offset, offset + length) leaving nothing in the page cache, copied is set to the bytes copied.
+    // A direct descriptor needs an aligned offset and whole blocks: the tail of the file is written as a whole block,
+    // the caller cuts the destination. Pages of a not direct descriptor are dropped behind the copy.
+    bool linuxUncachedRange(const int src, const bool srcDirect, const int dst, const bool dstDirect,
+                            const uint64_t offset, const uint64_t length, const uint32_t blockSize,
+                            uint64_t & copied, TCopyProgress * progress)
+    {
+        copied = 0U;
+        const size_t chunkSize = TAlignedBufferPool::alignSize(std::max<size_t>(blockSize, 1U));
+        const TPooledBuffer buffer(chunkSize);
+        if (buffer.get() == nullptr)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        uint64_t pendingOffset{ 0U }; // Written block of a not direct destination not dropped yet
+        uint64_t pendingLength{ 0U };
+        bool fileEnd{ false };
+        while (copied < length && !fileEnd)
+        {
+            const uint64_t position = offset + copied;
+            const size_t chunk = static_cast<size_t>(std::min<uint64_t>(length - copied, chunkSize));
+            ssize_t readBytes{ 0 };
+            if (srcDirect) // Whole blocks, a short read is the end of the file then
+            {
+                readBytes = readDirectFull(src, buffer.get(), TAlignedBufferPool::alignSize(chunk), position);
+                readBytes = std::min<ssize_t>(readBytes, static_cast<ssize_t>(chunk));
+            }
+            else
+            {
+                readBytes = readFull(src, buffer.get(), chunk, position);
+                syscallsNum++;
+                ::posix_fadvise(src, static_cast<off_t>(position), static_cast<off_t>(chunk), POSIX_FADV_DONTNEED);
+            }
+            if (readBytes < 0)
+            {
+                return false;
+            }
+            if (readBytes == 0) // File was truncated meanwhile
+            {
+                break;
+            }
+            const size_t bytes = static_cast<size_t>(readBytes);
+            fileEnd = (bytes < chunk);
+            size_t writeBytes = bytes;
+            if (dstDirect && bytes % TAlignedBufferPool::directAlignment != 0U)
+            {
+                writeBytes = TAlignedBufferPool::alignSize(bytes);
+                std::memset(buffer.get() + bytes, 0, writeBytes - bytes);
+            }
+            if (!writeFull(dst, buffer.get(), writeBytes, position))
+            {
+                return false;
+            }
+            if (!dstDirect)
+            {
+                syscallsNum++;
+                ::sync_file_range(dst, static_cast<off64_t>(position), static_cast<off64_t>(bytes), SYNC_FILE_RANGE_WRITE);
+                if (pendingLength > 0U)
+                {
+                    dropWritten(dst, pendingOffset, pendingLength);
+                }
+                pendingOffset = position;
+                pendingLength = bytes;
+            }
+            copied += bytes;
+            if (publishChunk(progress, bytes) && copied < length && !fileEnd)
+            {
+                errno = ECANCELED;
+                return false;
+            }
+        }
+        if (pendingLength > 0U)
+        {
+            dropWritten(dst, pendingOffset, pendingLength);
+        }
+        return true;
+    }
+
+    // A range of a split file, see directCopyFile. A range ending inside the file on an unaligned offset is not direct,
+    // its whole tail block would overwrite the start of the next range. copied is set to the bytes copied.
+    bool linuxDirectRange(const std::string & origin, const std::string & dest, const TSplitFile & split,
+                          const uint64_t offset, const uint64_t length, uint64_t & copied, TCopyProgress * progress)
+    {
+        copied = 0U;
+        const uint64_t alignment = TAlignedBufferPool::directAlignment;
+        const bool lastRange = (offset + length >= split.size);
+        const bool aligned = (offset % alignment == 0U) && (length % alignment == 0U || lastRange);
+        bool srcDirect{ false };
+        bool dstDirect{ false };
+        TFileDescriptor src(openUncached(origin, O_RDONLY, 0U, aligned, srcDirect));
+        if (src.get() < 0)
+        {
+            return false;
+        }
+        TFileDescriptor dst(openUncached(dest, O_WRONLY, 0U, aligned, dstDirect));
+        if (dst.get() < 0)
+        {
+            return false;
+        }
+        if (!linuxUncachedRange(src.get(), srcDirect, dst.get(), dstDirect, offset, length, split.directBlockSize, copied, progress))
+        {
+            return false;
+        }
+        if (dstDirect && lastRange) // The tail block went past the end
+        {
+            syscallsNum++;
+            if (::ftruncate(dst.get(), static_cast<off_t>(split.size)) != 0)
+            {
+                return false;
+            }
+        }
+        return dst.close();
+    }
+
+    // The size is taken by fstat of the open origin, the scan size is only for planning: a file grown after the scan
+    // is copied whole, as a reflink clones it whole. A file shrinking during the copy is a short copy, an error.
+    bool linuxCopyFile(const std::string & origin, const std::string & dest, const TFileStat & stat,
+                       std::error_code & code, ECopyMethod & method, uint64_t & copied, TCopyProgress * progress)
+    {
+        const auto setError = [&code]()
+        {
+            code.assign(errno, std::generic_category());
+            return false;
+        };
+
+        if (stat.type != fs::file_type::regular)
+        {
+            code = std::make_error_code(std::errc::not_supported);
+            return false;
+        }
+        syscallsNum++;
+        TFileDescriptor src(::open(origin.c_str(), O_RDONLY | O_CLOEXEC));
+        if (src.get() < 0)
+        {
+            return setError();
+        }
+        syscallsNum += 2U;
+        TFileDescriptor dst(::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, stat.mode & 07777));
+        if (dst.get() < 0)
+        {
+            return setError();
+        }
+        ::fchmod(dst.get(), stat.mode & 07777); // The same as fs::copy_file does for an existing destination
+
+        struct stat srcStat{};
+        syscallsNum++;
+        if (::fstat(src.get(), &srcStat) != 0)
+        {
+            return setError();
+        }
+        const uint64_t size = static_cast<uint64_t>(srcStat.st_size);
+        copied = size;
+        int ret{ 0 };
+        if (size > 0U)
+        {
+            syscallsNum++;
+            if (::ioctl(dst.get(), FICLONE, src.get()) == 0)
+            {
+                method = ECopyMethod::Reflink;
+                ret = 1;
+            }
+        }
+        if (ret == 0)
+        {
+            method = ECopyMethod::CopyFileRange;
+            ret = kernelCopyFileRange(src.get(), dst.get(), size, progress);
+        }
+        if (ret == 0)
+        {
+            method = ECopyMethod::Sendfile;
+            ret = sendFile(src.get(), dst.get(), size, progress);
+        }
+        if (ret == 0)
+        {
+            method = ECopyMethod::Buffered;
+            ret = bufferedCopy(src.get(), dst.get(), copied, progress) ? isCopyComplete(copied, size) : -1;
+        }
+        if (ret < 0)
+        {
+            return setError();
+        }
+        if (!dst.close())
+        {
+            return setError();
+        }
+        return true;
+    }
+
+    // Positional copy, copy_file_range first and pread/pwrite if it is not supported
+    bool linuxCopyRange(const int src, const int dst, const uint64_t offset, const uint64_t length, TCopyProgress * progress)
+    {
+        const uint64_t chunkSize = (progress != nullptr) ? progressChunkSize : kernelChunkSize;
+        loff_t inOffset = static_cast<loff_t>(offset);
+        loff_t outOffset = static_cast<loff_t>(offset);
+        uint64_t copied{ 0U };
+        bool kernelCopy{ true };
+        thread_local std::vector<char> buffer;
+        while (copied < length)
+        {
+            if (kernelCopy)
+            {
+                const ssize_t ret = emptyKernelCopy.load(std::memory_order_relaxed)
+                                  ? 0 : ::copy_file_range(src, &inOffset, dst, &outOffset, std::min<uint64_t>(length - copied, chunkSize), 0U);
+                syscallsNum++;
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (copied == 0U && isNotSupported(errno))
+                    {
+                        kernelCopy = false;
+                        continue;
+                    }
+                    return false;
+                }
+                if (ret == 0 && copied == 0U) // Nothing copied by the first call, pread/pwrite tell if the file ended
+                {
+                    kernelCopy = false;
+                    continue;
+                }
+                if (ret == 0) // File was truncated meanwhile
+                {
+                    break;
+                }
+                copied += static_cast<uint64_t>(ret);
+                if (publishChunk(progress, static_cast<uint64_t>(ret)) && copied < length)
+                {
+                    errno = ECANCELED;
+                    return false;
+                }
+            }
+            else
+            {
+                buffer.resize(bufferSize);
+                const ssize_t readBytes = ::pread(src, buffer.data(), std::min<uint64_t>(length - copied, buffer.size()), static_cast<off_t>(offset + copied));
+                syscallsNum++;
+                if (readBytes < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return false;
+                }
+                if (readBytes == 0)
+                {
+                    break;
+                }
+                ssize_t written{ 0 };
+                while (written < readBytes)
+                {
+                    const ssize_t ret = ::pwrite(dst, buffer.data() + written, readBytes - written, static_cast<off_t>(offset + copied + written));
+                    syscallsNum++;
+                    if (ret < 0)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        return false;
+                    }
+                    written += ret;
+                }
+                copied += static_cast<uint64_t>(readBytes);
+                if (publishChunk(progress, static_cast<uint64_t>(readBytes)) && copied < length)
+                {
+                    errno = ECANCELED;
+                    return false;
+                }
+            }
+        }
+        return isCopyComplete(copied, length) == 1;
+    }
+
+#else
+
+    // Portable version of the delta range, fout is opened for reading and writing
+    bool streamDeltaRange(std::istream & fin, std::fstream & fout, const uint64_t offset, const uint64_t length,
+                          const uint32_t blockSize, uint64_t & written, TCopyProgress * progress)
+    {
+        std::vector<char> srcBuffer(blockSize);
+        std::vector<char> dstBuffer(blockSize);
+        for (uint64_t done = 0U; done < length; )
+        {
+            const auto chunk = static_cast<std::streamsize>(std::min<uint64_t>(length - done, blockSize));
+            const auto position = static_cast<std::streamoff>(offset + done);
+            fin.seekg(position);
+            fin.read(srcBuffer.data(), chunk);
+            const auto srcBytes = fin.gcount();
+            if (srcBytes <= 0) // The origin shrank, its stale tail would be kept
+            {
+                return false;
+            }
+            fout.clear();
+            fout.seekg(position);
+            fout.read(dstBuffer.data(), srcBytes);
+            const auto dstBytes = fout.gcount();
+            syscallsNum += 2U;
+            if (dstBytes != srcBytes || std::memcmp(srcBuffer.data(), dstBuffer.data(), static_cast<size_t>(srcBytes)) != 0)
+            {
+                fout.clear();
+                fout.seekp(position);
+                fout.write(srcBuffer.data(), srcBytes);
+                if (!fout)
+                {
+                    return false;
+                }
+                syscallsNum++;
+                written += static_cast<uint64_t>(srcBytes);
+            }
+            done += static_cast<uint64_t>(srcBytes);
+            if (publishChunk(progress, static_cast<uint64_t>(srcBytes)) && done < length)
+            {
+                break; // The caller reports the cancel
+            }
+        }
+        fout.flush();
+        return static_cast<bool>(fout);
+    }
+
+    // Chunked copy for the progress, fs::copy_file copies a file in one call
+    bool streamCopyFile(const std::string & origin, const std::string & dest, uint64_t & copied, TCopyProgress * progress,
+                        std::error_code & code)
+    {
+        copied = 0U;
+        std::ifstream fin(origin, std::ios::binary);
+        std::ofstream fout(dest, std::ios::binary | std::ios::trunc);
+        syscallsNum += 2U;
+        if (!fin.is_open() || !fout.is_open())
+        {
+            code = std::make_error_code(std::errc::permission_denied);
+            return false;
+        }
+        std::vector<char> buffer(1U << 20U);
+        while (fin)
+        {
+            fin.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            const auto readBytes = fin.gcount();
+            if (readBytes <= 0)
+            {
+                break;
+            }
+            fout.write(buffer.data(), readBytes);
+            syscallsNum += 2U;
+            if (!fout)
+            {
+                break;
+            }
+            copied += static_cast<uint64_t>(readBytes);
+            if (publishChunk(progress, static_cast<uint64_t>(readBytes)))
+            {
+                code = std::make_error_code(std::errc::operation_canceled);
+                return false;
+            }
+        }
+        fout.flush();
+        if (!fout || fin.bad())
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+        return true;
+    }
+
+#endif // __linux__
+
+}; // namespace
+
+//===================================================================================================================================
+
+const char * getCopyMethodName(const ECopyMethod method)
+{
+    return (method < ECopyMethod::Count) ? methodNames[static_cast<uint32_t>(method)] : "unknown";
+}
+
+//===================================================================================================================================
+
+bool statFile(const std::string & path, TFileStat & stat, std::error_code & code)
+{
+    code.clear();
+    stat = TFileStat{};
+#if defined(__linux__)
+    struct stat pathStat{};
+    syscallsNum++;
+    if (::stat(path.c_str(), &pathStat) != 0)
+    {
+        if (errno == ENOENT || errno == ENOTDIR)
+        {
+            stat.type = fs::file_type::not_found;
+            return true;
+        }
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    stat.type = S_ISREG(pathStat.st_mode) ? fs::file_type::regular
+              : S_ISDIR(pathStat.st_mode) ? fs::file_type::directory : fs::file_type::unknown;
+    stat.size = static_cast<uint64_t>(pathStat.st_size);
+    stat.mtime = static_cast<int64_t>(pathStat.st_mtim.tv_sec) * 1000000000 + pathStat.st_mtim.tv_nsec;
+    stat.mode = static_cast<uint32_t>(pathStat.st_mode & 07777);
+    return true;
+#else
+    // Windows keeps the whole stat in the directory entry, other calls are cheap there
+    syscallsNum++;
+    const auto status = fs::status(path, code);
+    stat.type = status.type();
+    if (code || stat.type == fs::file_type::not_found)
+    {
+        return !code;
+    }
+    stat.mode = static_cast<uint32_t>(status.permissions());
+    if (stat.type == fs::file_type::regular)
+    {
+        syscallsNum += 2U;
+        stat.size = fs::file_size(path, code);
+        const auto mtime = fs::last_write_time(path, code);
+        stat.mtime = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+    }
+    return !code;
+#endif
+}
+
+//===================================================================================================================================
+
+bool copyFile(const std::string & origin, const std::string & dest, const TFileStat & stat,
+              std::error_code & code, ECopyMethod & method, uint64_t & size, TCopyProgress * progress)
+{
+    code.clear();
+    size = 0U;
+#if defined(__linux__)
+    const bool ret = linuxCopyFile(origin, dest, stat, code, method, size, progress);
+#else
+    bool ret{ false };
+    if (progress != nullptr && stat.size > progressChunkSize) // Small files are copied faster in one call
+    {
+        method = ECopyMethod::Buffered;
+        ret = streamCopyFile(origin, dest, size, progress, code);
+    }
+    else
+    {
+        syscallsNum += 2U;
+        method = ECopyMethod::FsCopy;
+        ret = fs::copy_file(origin, dest, fs::copy_options::overwrite_existing, code);
+        size = ret ? fs::file_size(dest, code) : 0U;
+        ret = ret && !code;
+    }
+#endif
+    if (ret)
+    {
+        methodFilesNum[static_cast<uint32_t>(method)]++;
+    }
+    return ret;
+}
+
+//===================================================================================================================================
+
+bool directCopyFile(const std::string & origin, const std::string & dest, const TFileStat & stat, const uint32_t blockSize,
+                    std::error_code & code, ECopyMethod & method, uint64_t & size, TCopyProgress * progress)
+{
+    code.clear();
+    size = 0U;
+#if defined(__linux__)
+    const auto setError = [&code]()
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    };
+
+    if (stat.type != fs::file_type::regular)
+    {
+        code = std::make_error_code(std::errc::not_supported);
+        return false;
+    }
+    bool srcDirect{ false };
+    bool dstDirect{ false };
+    TFileDescriptor src(openUncached(origin, O_RDONLY, 0U, true, srcDirect));
+    if (src.get() < 0)
+    {
+        return setError();
+    }
+    TFileDescriptor dst(openUncached(dest, O_WRONLY | O_CREAT | O_TRUNC, stat.mode & 07777, true, dstDirect));
+    if (dst.get() < 0)
+    {
+        return setError();
+    }
+    syscallsNum++;
+    ::fchmod(dst.get(), stat.mode & 07777);
+
+    struct stat srcStat{}; // The size of the open origin, see linuxCopyFile
+    syscallsNum++;
+    if (::fstat(src.get(), &srcStat) != 0)
+    {
+        return setError();
+    }
+    size = static_cast<uint64_t>(srcStat.st_size);
+    bool reflink{ false };
+    if (size > 0U)
+    {
+        syscallsNum++;
+        reflink = (::ioctl(dst.get(), FICLONE, src.get()) == 0);
+    }
+    if (reflink)
+    {
+        method = ECopyMethod::Reflink;
+    }
+    else
+    {
+        method = (srcDirect && dstDirect) ? ECopyMethod::Direct : ECopyMethod::Uncached;
+        uint64_t copied{ 0U };
+        if (!linuxUncachedRange(src.get(), srcDirect, dst.get(), dstDirect, 0U, size, blockSize, copied, progress)
+            || isCopyComplete(copied, size) != 1)
+        {
+            return setError();
+        }
+        if (dstDirect && copied % TAlignedBufferPool::directAlignment != 0U) // The tail block went past the end
+        {
+            syscallsNum++;
+            if (::ftruncate(dst.get(), static_cast<off_t>(copied)) != 0)
+            {
+                return setError();
+            }
+        }
+    }
+    if (!dst.close())
+    {
+        return setError();
+    }
+    methodFilesNum[static_cast<uint32_t>(method)]++;
+    return true;
+#else
+    // The cache could be bypassed by FILE_FLAG_NO_BUFFERING on Windows, the file streams do not open files with it
+    (void)blockSize;
+    return copyFile(origin, dest, stat, code, method, size, progress);
+#endif
+}
+
+//===================================================================================================================================
+
+bool deltaCopyFile(const std::string & origin, const std::string & dest, const TFileStat & stat, const uint32_t blockSize,
+                   std::error_code & code, uint64_t & written, uint64_t & size, TCopyProgress * progress)
+{
+    code.clear();
+    written = 0U;
+    size = 0U;
+    if (stat.type != fs::file_type::regular || blockSize == 0U)
+    {
+        code = std::make_error_code(std::errc::invalid_argument);
+        return false;
+    }
+#if defined(__linux__)
+    syscallsNum++;
+    TFileDescriptor dst(::open(dest.c_str(), O_RDWR | O_CLOEXEC)); // Not created, a new file is copied as a whole
+    if (dst.get() < 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    syscallsNum++;
+    TFileDescriptor src(::open(origin.c_str(), O_RDONLY | O_CLOEXEC));
+    if (src.get() < 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    struct stat srcStat{}; // The size of the open origin, see linuxCopyFile
+    syscallsNum++;
+    if (::fstat(src.get(), &srcStat) != 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    size = static_cast<uint64_t>(srcStat.st_size);
+    syscallsNum += 4U;
+    ::posix_fadvise(src.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    ::posix_fadvise(dst.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    ::fchmod(dst.get(), stat.mode & 07777);
+    if (!linuxDeltaRange(src.get(), dst.get(), 0U, size, blockSize, written, progress)
+        || ::ftruncate(dst.get(), static_cast<off_t>(size)) != 0 // A longer destination is cut to the origin
+        || !dst.close())
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+#else
+    syscallsNum += 3U;
+    if (!fs::exists(dest))
+    {
+        code = std::make_error_code(std::errc::no_such_file_or_directory);
+        return false;
+    }
+    size = fs::file_size(origin, code); // The current size, the scan one is only for planning
+    if (code)
+    {
+        return false;
+    }
+    {
+        std::ifstream fin(origin, std::ios::binary);
+        std::fstream fout(dest, std::ios::binary | std::ios::in | std::ios::out);
+        if (!fin.is_open() || !fout.is_open())
+        {
+            code = std::make_error_code(std::errc::permission_denied);
+            return false;
+        }
+        if (!streamDeltaRange(fin, fout, 0U, size, blockSize, written, progress))
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+    }
+    if (progress != nullptr && progress->cancel != nullptr && progress->cancel->load() && progress->published < size)
+    {
+        code = std::make_error_code(std::errc::operation_canceled);
+        return false;
+    }
+    fs::resize_file(dest, size, code);
+    if (code)
+    {
+        return false;
+    }
+#endif
+    methodFilesNum[static_cast<uint32_t>(ECopyMethod::Delta)]++;
+    return true;
+}
+
+//===================================================================================================================================
+
+bool linkFile(const std::string & target, const std::string & dest, const TFileStat & stat,
+              std::error_code & code, ECopyMethod & method)
+{
+    code.clear();
+#if defined(__linux__)
+    syscallsNum++;
+    if (::unlink(dest.c_str()) != 0 && errno != ENOENT) // A hard link would change an existing file of another name
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    if (stat.size > 0U)
+    {
+        syscallsNum += 3U;
+        TFileDescriptor src(::open(target.c_str(), O_RDONLY | O_CLOEXEC));
+        TFileDescriptor dst(::open(dest.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, stat.mode & 07777));
+        if (src.get() >= 0 && dst.get() >= 0 && ::ioctl(dst.get(), FICLONE, src.get()) == 0)
+        {
+            syscallsNum++;
+            ::fchmod(dst.get(), stat.mode & 07777);
+            if (!dst.close())
+            {
+                code.assign(errno, std::generic_category());
+                return false;
+            }
+            method = ECopyMethod::Reflink;
+            methodFilesNum[static_cast<uint32_t>(method)]++;
+            return true;
+        }
+        if (dst.get() >= 0)
+        {
+            syscallsNum++;
+            ::unlink(dest.c_str());
+        }
+    }
+    syscallsNum++;
+    if (::link(target.c_str(), dest.c_str()) != 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+#else
+    (void)stat;
+    syscallsNum += 2U;
+    fs::remove(dest, code);
+    if (code)
+    {
+        return false;
+    }
+    fs::create_hard_link(target, dest, code);
+    if (code)
+    {
+        return false;
+    }
+#endif
+    method = ECopyMethod::Hardlink;
+    methodFilesNum[static_cast<uint32_t>(method)]++;
+    return true;
+}
+
+//===================================================================================================================================
+
+bool setFileMtime(const std::string & path, const int64_t mtime, std::error_code & code)
+{
+    code.clear();
+    syscallsNum++;
+#if defined(__linux__)
+    struct timespec times[2]{};
+    times[0].tv_nsec = UTIME_OMIT; // Access time is kept
+    times[1].tv_sec = static_cast<time_t>(mtime / 1000000000);
+    times[1].tv_nsec = static_cast<long>(mtime % 1000000000);
+    if (::utimensat(AT_FDCWD, path.c_str(), times, 0) != 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    return true;
+#else
+    const auto duration = std::chrono::duration_cast<fs::file_time_type::duration>(std::chrono::nanoseconds(mtime));
+    fs::last_write_time(path, fs::file_time_type(duration), code);
+    return !code;
+#endif
+}
+
+//===================================================================================================================================
+
+bool isSameContent(const std::string & origin, const std::string & dest, const uint64_t size, std::error_code & code)
+{
+    code.clear();
+    thread_local std::vector<char> originBuffer;
+    thread_local std::vector<char> destBuffer;
+    originBuffer.resize(compareBufferSize);
+    destBuffer.resize(compareBufferSize);
+#if defined(__linux__)
+    syscallsNum += 2U;
+    TFileDescriptor src(::open(origin.c_str(), O_RDONLY | O_CLOEXEC));
+    TFileDescriptor dst(::open(dest.c_str(), O_RDONLY | O_CLOEXEC));
+    if (src.get() < 0 || dst.get() < 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    ::posix_fadvise(src.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    ::posix_fadvise(dst.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    syscallsNum += 2U;
+    for (uint64_t offset = 0U; offset < size; )
+    {
+        const size_t length = static_cast<size_t>(std::min<uint64_t>(size - offset, compareBufferSize));
+        const ssize_t originBytes = readFull(src.get(), originBuffer.data(), length, offset);
+        const ssize_t destBytes = readFull(dst.get(), destBuffer.data(), length, offset);
+        if (originBytes < 0 || destBytes < 0)
+        {
+            code.assign(errno, std::generic_category());
+            return false;
+        }
+        if (originBytes != destBytes || originBytes == 0
+            || std::memcmp(originBuffer.data(), destBuffer.data(), static_cast<size_t>(originBytes)) != 0)
+        {
+            return false;
+        }
+        offset += static_cast<uint64_t>(originBytes);
+    }
+    return true;
+#else
+    std::ifstream originIn(origin, std::ios::binary);
+    std::ifstream destIn(dest, std::ios::binary);
+    if (!originIn.is_open() || !destIn.is_open())
+    {
+        code = std::make_error_code(std::errc::permission_denied);
+        return false;
+    }
+    syscallsNum += 2U;
+    for (uint64_t offset = 0U; offset < size; )
+    {
+        const auto length = static_cast<std::streamsize>(std::min<uint64_t>(size - offset, compareBufferSize));
+        originIn.read(originBuffer.data(), length);
+        destIn.read(destBuffer.data(), length);
+        const auto originBytes = originIn.gcount();
+        syscallsNum += 2U;
+        if (originBytes == 0 || originBytes != destIn.gcount()
+            || std::memcmp(originBuffer.data(), destBuffer.data(), static_cast<size_t>(originBytes)) != 0)
+        {
+            return false;
+        }
+        offset += static_cast<uint64_t>(originBytes);
+    }
+    return true;
+#endif
+}
+
+//===================================================================================================================================
+
+bool prepareSplitFile(const std::string & dest, TSplitFile & split, std::error_code & code)
+{
+    std::call_once(split.prepared, [&dest, &split]()
+    {
+        const bool keepContent = split.keepContent;
+#if defined(__linux__)
+        if (!keepContent) // A new inode, the destination may be a hard link made by the dedup mode
+        {
+            syscallsNum++;
+            ::unlink(dest.c_str());
+        }
+        syscallsNum += 3U;
+        TFileDescriptor dst(::open(dest.c_str(), O_WRONLY | O_CREAT | (keepContent ? 0 : O_TRUNC) | O_CLOEXEC, split.mode & 07777));
+        if (dst.get() < 0 || ::ftruncate(dst.get(), static_cast<off_t>(split.size)) != 0)
+        {
+            split.prepareCode.assign(errno, std::generic_category());
+            return;
+        }
+        ::fchmod(dst.get(), split.mode & 07777);
+        if (!dst.close())
+        {
+            split.prepareCode.assign(errno, std::generic_category());
+        }
+#else
+        syscallsNum += 2U;
+        if (!keepContent)
+        {
+            std::error_code removeCode;
+            fs::remove(dest, removeCode);
+        }
+        if (!keepContent || !fs::exists(dest))
+        {
+            std::ofstream fout(dest, std::ios::binary | std::ios::trunc);
+            if (!fout.is_open())
+            {
+                split.prepareCode = std::make_error_code(std::errc::permission_denied);
+                return;
+            }
+        }
+        fs::resize_file(dest, split.size, split.prepareCode);
+#endif
+    });
+    code = split.prepareCode;
+    return !code;
+}
+
+//===================================================================================================================================
+
+bool copyRange(const std::string & origin, const std::string & dest, TSplitFile & split,
+               const uint64_t offset, const uint64_t length, std::error_code & code, uint64_t & written,
+               TCopyProgress * progress)
+{
+    code.clear();
+    written = 0U;
+    if (!prepareSplitFile(dest, split, code))
+    {
+        return false;
+    }
+    if (offset + length >= split.size) // The tail of a grown origin is not in any range, it would be dropped silently
+    {
+        syscallsNum++;
+        const uint64_t size = fs::file_size(origin, code);
+        if (code)
+        {
+            return false;
+        }
+        if (size != split.size)
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+    }
+    const bool delta = (split.deltaBlockSize != 0U);
+#if defined(__linux__)
+    if (split.directBlockSize != 0U && !delta)
+    {
+        // A short range means the origin shrank, the file would be cut silently
+        if (!linuxDirectRange(origin, dest, split, offset, length, written, progress) || isCopyComplete(written, length) != 1)
+        {
+            code.assign(errno, std::generic_category());
+            return false;
+        }
+        return true;
+    }
+    syscallsNum += 2U;
+    TFileDescriptor src(::open(origin.c_str(), O_RDONLY | O_CLOEXEC));
+    if (src.get() < 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    TFileDescriptor dst(::open(dest.c_str(), (delta ? O_RDWR : O_WRONLY) | O_CLOEXEC));
+    if (dst.get() < 0
+        || !(delta ? linuxDeltaRange(src.get(), dst.get(), offset, length, split.deltaBlockSize, written, progress)
+                   : linuxCopyRange(src.get(), dst.get(), offset, length, progress))
+        || !dst.close())
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    written = delta ? written : length;
+    return true;
+#else
+    std::ifstream fin(origin, std::ios::binary);
+    std::fstream fout(dest, std::ios::binary | std::ios::in | std::ios::out);
+    if (!fin.is_open() || !fout.is_open())
+    {
+        code = std::make_error_code(std::errc::permission_denied);
+        return false;
+    }
+    if (delta)
+    {
+        if (!streamDeltaRange(fin, fout, offset, length, split.deltaBlockSize, written, progress))
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+        if (progress != nullptr && progress->cancel != nullptr && progress->cancel->load() && progress->published < length)
+        {
+            code = std::make_error_code(std::errc::operation_canceled);
+            return false;
+        }
+        return true;
+    }
+    fin.seekg(static_cast<std::streamoff>(offset));
+    fout.seekp(static_cast<std::streamoff>(offset));
+    std::vector<char> buffer(1U << 20U);
+    uint64_t copied{ 0U };
+    while (copied < length && fin)
+    {
+        fin.read(buffer.data(), static_cast<std::streamsize>(std::min<uint64_t>(length - copied, buffer.size())));
+        const auto readBytes = fin.gcount();
+        if (readBytes <= 0)
+        {
+            break;
+        }
+        fout.write(buffer.data(), readBytes);
+        copied += static_cast<uint64_t>(readBytes);
+        if (fout && publishChunk(progress, static_cast<uint64_t>(readBytes)) && copied < length)
+        {
+            code = std::make_error_code(std::errc::operation_canceled);
+            return false;
+        }
+    }
+    fout.flush();
+    if (!fout)
+    {
+        code = std::make_error_code(std::errc::io_error);
+        return false;
+    }
+    written = copied;
+    return true;
+#endif
+}
+
+//===================================================================================================================================
+
+uint64_t getCopyMethodFilesNum(const ECopyMethod method)
+{
+    return (method < ECopyMethod::Count) ? methodFilesNum[static_cast<uint32_t>(method)].load() : 0U;
+}
+
+//===================================================================================================================================
+
+void addCopyMethodFile(const ECopyMethod method)
+{
+    if (method < ECopyMethod::Count)
+    {
+        methodFilesNum[static_cast<uint32_t>(method)]++;
+    }
+}
+
+//===================================================================================================================================
+
+void addSyscalls(const uint64_t num)
+{
+    syscallsNum += num;
+}
+
+//===================================================================================================================================
+
+void setEmptyKernelCopy(const bool empty)
+{
+    emptyKernelCopy.store(empty, std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+uint64_t getSyscallsNum()
+{
+    return syscallsNum;
+}
+
+//===================================================================================================================================
+
+void resetCopyMethodStats()
+{
+    for (auto & filesNum : methodFilesNum)
+    {
+        filesNum.store(0U);
+    }
+    syscallsNum.store(0U);
+}
+
+//===================================================================================================================================
+
+std::string getCopyMethodStats()
+{
+    std::string stats;
+    uint64_t filesNum{ 0U };
+    for (uint32_t i = 0U; i < static_cast<uint32_t>(ECopyMethod::Count); i++)
+    {
+        stats += std::string(i == 0U ? "" : ", ") + methodNames[i] + ": " + std::to_string(methodFilesNum[i].load());
+        filesNum += methodFilesNum[i];
+    }
+    stats += ". System calls: " + std::to_string(syscallsNum.load());
+    if (filesNum > 0U)
+    {
+        stats += ", per file: " + std::to_string(static_cast<double>(syscallsNum.load()) / filesNum);
+    }
+    return stats;
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
@@ -0,0 +1,115 @@
+#ifndef COPYENGINE_H
+#define COPYENGINE_H
+
+#include <string>
+#include <system_error>
+#include <atomic>
+#include <cstdint>
+
+#include "copyqueue.h"
+
+namespace CopyLib {
+
+    // The way file data went from the origin to the destination
+    enum class ECopyMethod : uint32_t
+    {
+        Reflink,       // FICLONE, destination shares the blocks on CoW filesystems (btrfs, XFS)
+        CopyFileRange, // copy_file_range, in-kernel copy (server side copy on NFS/SMB)
+        Sendfile,      // sendfile, in-kernel copy through the page cache
+        Buffered,      // read/write through a user space buffer
+        FsCopy,        // std::filesystem::copy_file, not Linux platforms
+        IoUring,       // io_uring backend, see uringCopy
+        SplitRanges,   // Big file copied by several workers in byte ranges, see copyRange
+        Delta,         // Only blocks differing from the existing destination are rewritten, see deltaCopyFile
+        Hardlink,      // Dedup mode: a duplicate is a hard link to the copy of the same content, see linkFile
+        Direct,        // O_DIRECT reads and writes, the page cache is bypassed, see directCopyFile
+        Uncached,      // Through the page cache, pages dropped behind the copy by posix_fadvise, see directCopyFile
+        Count
+    };
+
+    const char * getCopyMethodName(const ECopyMethod method);
+
+    // Byte progress of one copy call. Data is copied in chunks, every chunk is added to copiedSize as soon as it is written
+    // and cancel is checked after it, so a huge file neither freezes the progress nor delays a cancel.
+    // A canceled call fails with operation_canceled, published bytes are the landed prefix of the destination then.
+    struct TCopyProgress
+    {
+        std::atomic<uint64_t> * copiedSize{ nullptr };
+        const std::atomic<bool> * cancel{ nullptr };
+        uint64_t published{ 0U }; // Bytes added to copiedSize, reset by the caller before every call
+    };
+
+    // One stat call following symlinks. A missing path is not an error, its type is not_found.
+    bool statFile(const std::string & path, TFileStat & stat, std::error_code & code);
+
+    // Copies a regular file overwriting the destination. The type and permissions come from the scan (see statFile),
+    // the size is taken from the open origin, so a file changed after the scan is copied whole, size is set to the bytes
+    // copied. The fastest method is tried first: reflink, copy_file_range, sendfile and a buffered copy at last.
+    // On error returns false and sets code.
+    bool copyFile(const std::string & origin, const std::string & dest, const TFileStat & stat,
+                  std::error_code & code, ECopyMethod & method, uint64_t & size, TCopyProgress * progress = nullptr);
+
+    // Large file mode: copies a file without filling the page cache, so the cached data of other programs is not evicted.
+    // Data goes by O_DIRECT reads and writes of blockSize through a buffer of TAlignedBufferPool. Where a filesystem
+    // does not support O_DIRECT (tmpfs, FUSE, some network ones) the file goes through the cache and its pages are dropped
+    // behind the copy by posix_fadvise(POSIX_FADV_DONTNEED). A reflink reads nothing, it is tried first.
+    // The size is taken from the open origin as copyFile does. Other platforms copy the file by copyFile.
+    bool directCopyFile(const std::string & origin, const std::string & dest, const TFileStat & stat, const uint32_t blockSize,
+                        std::error_code & code, ECopyMethod & method, uint64_t & size, TCopyProgress * progress = nullptr);
+
+    // Updates an existing destination in place: blocks of blockSize bytes are compared with memcmp and only
+    // the differing ones are written, then the destination is cut to the origin size (of the open origin, as copyFile takes it).
+    // written is set to the bytes written and size to the origin size. An origin shrinking during the copy fails with io_error.
+    // Fails with no_such_file_or_directory if there is no destination, the file is copied as a whole then.
+    bool deltaCopyFile(const std::string & origin, const std::string & dest, const TFileStat & stat, const uint32_t blockSize,
+                       std::error_code & code, uint64_t & written, uint64_t & size, TCopyProgress * progress = nullptr);
+
+    // Dedup mode: dest becomes a copy of the already copied target sharing its data. A reflink is made where
+    // the filesystem supports it (an independent file), a hard link otherwise. An existing dest is replaced.
+    bool linkFile(const std::string & target, const std::string & dest, const TFileStat & stat,
+                  std::error_code & code, ECopyMethod & method);
+
+    // Sets the last write time taken by statFile, so a synced file matches its origin the next time
+    bool setFileMtime(const std::string & path, const int64_t mtime, std::error_code & code);
+
+    // Compares two files of the same size byte by byte. False on the first difference or on error (code is set then).
+    bool isSameContent(const std::string & origin, const std::string & dest, const uint64_t size, std::error_code & code);
+
+    // Creates the destination of a split file with the full size, only the first call for a file does the work.
+    // Every range task calls it before writing. The old content is kept for delta ranges and resumed files,
+    // otherwise the destination is a new file (not a hard link to another one).
+    bool prepareSplitFile(const std::string & dest, TSplitFile & split, std::error_code & code);
+
+    // Copies [offset, offset + length) of a split file with positional I/O, so ranges of one file
+    // are copied by several workers at once. Delta ranges (TSplitFile::deltaBlockSize) rewrite differing blocks only,
+    // written is set to the bytes written. Ranges of a file with TSplitFile::directBlockSize bypass the page cache
+    // as directCopyFile does, O_DIRECT is used for a range with an aligned offset ending on a block or at the end of the file.
+    // Ranges are planned by the scan size: a short range and the last range of an origin of another size fail with io_error.
+    bool copyRange(const std::string & origin, const std::string & dest, TSplitFile & split,
+                   const uint64_t offset, const uint64_t length, std::error_code & code, uint64_t & written,
+                   TCopyProgress * progress = nullptr);
+
+    // Files copied by every method since the last resetCopyMethodStats call
+    uint64_t getCopyMethodFilesNum(const ECopyMethod method);
+
+    // For copy backends not going through copyFile
+    void addCopyMethodFile(const ECopyMethod method);
+
+    // System calls made by the scan and the copy, counted where they are issued
+    void addSyscalls(const uint64_t num);
+
+    uint64_t getSyscallsNum();
+
+    // Tests: copy_file_range and sendfile of copyFile and copyRange behave as on filesystems where their first call
+    // copies nothing, so the fall back to the next method is checked on any filesystem
+    void setEmptyKernelCopy(const bool empty);
+
+    // Resets the syscalls number too
+    void resetCopyMethodStats();
+
+    // One line summary for the log
+    std::string getCopyMethodStats();
+
+} // namespace CopyLib
+
+#endif // COPYENGINE_H
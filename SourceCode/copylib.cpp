@@ -1,12 +1,29 @@
 
 #include "copylib.h"
+#include "copyqueue.h"
+#include "treewalker.h"
+#include "copyengine.h"
+#include "uringengine.h"
+#include "journal.h"
+#include "verifier.h"
+#include "workercontrol.h"
+#include "devicelimits.h"
+#include "jobstats.h"
+#include "tracer.h"
+#include "bufferpool.h"
 
 #include <filesystem>
-#include <fstream>
 #include <thread>
 #include <chrono>
 #include <csignal>
 #include <sstream>
+#include <vector>
+#include <queue>
+#include <tuple>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
 
 namespace CopyLib {
 
@@ -16,11 +33,477 @@ using namespace std::chrono_literals;
 
 namespace {
 
-    const std::string tempFN{ "copy_plan_" };
-    const std::string tempExten{ ".txt" };
-
     std::atomic<bool> copyErrorHappened{ false };
 
+    // Sync mode
+    std::atomic<uint64_t> skippedFileNum{ 0U };
+    std::atomic<uint64_t> skippedFileSize{ 0U };
+
+    std::atomic<uint64_t> writtenFileSize{ 0U };
+
+    // Verification
+    std::atomic<uint64_t> verifiedFileSize{ 0U };
+    std::atomic<uint64_t> verifyMismatchNum{ 0U };
+
+    // Dedup mode
+    std::atomic<uint64_t> dedupFileNum{ 0U };
+    std::atomic<uint64_t> dedupSavedSize{ 0U };
+
+    // Resumed job, see TJournal
+    bool planResumed{ false };
+    bool journalDirsCreated{ false };
+    uint64_t resumedFileNum{ 0U };
+    uint64_t resumedFileSize{ 0U };
+    uint64_t resumedScopeSize{ 0U }; // Not copied work of a resumed streaming job
+    uint64_t resumedScopeFileNum{ 0U };
+    const std::vector<uint64_t> noDoneRanges;
+
+    // Dirs of the last plan relative to the origin, found by the createCopyQueues scan or kept by the journal
+    std::vector<std::string> planDirs;
+    const size_t dirsChunk{ 64U }; // Dirs a copyDirStructure thread takes at once
+
+    TCopyOptions copyOptions;
+
+    // Load of every queue and imbalance of the last plan, see createCopyQueues
+    std::vector<TQueueLoad> queueLoads;
+    double planImbalance{ 1.0 };
+    double roundRobinImbalance{ 1.0 };
+
+    // A new trace for the job if it is asked for, the previous one is stopped either way
+    void startTrace()
+    {
+        auto & tracer = TTracer::getInstance();
+        tracer.stop();
+        if (!copyOptions.traceFile.empty())
+        {
+            tracer.start();
+        }
+    }
+
+    // Heaviest queue divided by the average one, 1.0 is a perfect balance
+    double calcImbalance(const std::vector<TQueueLoad> & loads)
+    {
+        uint64_t total{ 0U };
+        uint64_t heaviest{ 0U };
+        for (const auto & load : loads)
+        {
+            total += load.bytes;
+            heaviest = std::max(heaviest, load.bytes);
+        }
+        if (total == 0U || loads.empty())
+        {
+            return 1.0;
+        }
+        return static_cast<double>(heaviest) * loads.size() / total;
+    }
+
+    // Largest-first greedy assignment: every file goes to the queue with the least bytes (then the least files).
+    // Entries are reordered by size, the returned vector holds the queue index of every entry.
+    std::vector<uint32_t> balanceQueues(std::vector<TCopyTask> & entries, const uint32_t queuesNum)
+    {
+        // Round-robin by file count in the scan order, only to report the gain
+        std::vector<TQueueLoad> roundRobin(queuesNum);
+        for (size_t i = 0U; i < entries.size(); i++)
+        {
+            roundRobin[i % queuesNum].bytes += entries[i].size;
+            roundRobin[i % queuesNum].files++;
+        }
+        roundRobinImbalance = calcImbalance(roundRobin);
+
+        std::stable_sort(entries.begin(), entries.end(), [](const TCopyTask & a, const TCopyTask & b)
+        {
+            return a.size > b.size;
+        });
+
+        using TQueueKey = std::tuple<uint64_t, uint64_t, uint32_t>; // bytes, files, queue index
+        std::priority_queue<TQueueKey, std::vector<TQueueKey>, std::greater<TQueueKey>> lightest;
+        for (uint32_t i = 0U; i < queuesNum; i++)
+        {
+            lightest.emplace(0U, 0U, i);
+        }
+
+        queueLoads.assign(queuesNum, TQueueLoad{});
+        std::vector<uint32_t> indexes(entries.size());
+        for (size_t i = 0U; i < entries.size(); i++)
+        {
+            auto [bytes, files, index] = lightest.top();
+            lightest.pop();
+            indexes[i] = index;
+            queueLoads[index].bytes += entries[i].size;
+            queueLoads[index].files++;
+            lightest.emplace(bytes + entries[i].size, files + 1U, index);
+        }
+        planImbalance = calcImbalance(queueLoads);
+
+        return indexes;
+    }
+
+    // Big files are split into byte ranges copied by several workers at once, push is called for every task.
+    // Ranges landed before a job was interrupted (doneRanges) are not pushed. The rest of a file kept partially
+    // copied by a canceled job (partialSize) is the only range of a split file.
+    template<class TPush>
+    void makeTasks(std::string && file, const TFileStat & stat, const uint64_t journalIndex,
+                   const std::vector<uint64_t> & doneRanges, const uint64_t partialSize, TPush push)
+    {
+        const uint64_t size = stat.size;
+        const uint64_t rangeSize = copyOptions.splitRangeSize;
+        const bool partial = (partialSize > 0U && partialSize < size);
+        if (!partial && (copyOptions.splitThreshold == 0U || size < copyOptions.splitThreshold || rangeSize == 0U || size <= rangeSize))
+        {
+            TCopyTask task(std::move(file), stat);
+            task.journalIndex = journalIndex;
+            push(std::move(task));
+            return;
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> ranges; // Offset and length
+        if (partial)
+        {
+            ranges.emplace_back(partialSize, size - partialSize);
+        }
+        else
+        {
+            for (uint64_t offset = 0U; offset < size; offset += rangeSize)
+            {
+                if (std::find(doneRanges.begin(), doneRanges.end(), offset) == doneRanges.end())
+                {
+                    ranges.emplace_back(offset, std::min(rangeSize, size - offset));
+                }
+            }
+        }
+        auto split = std::make_shared<TSplitFile>();
+        split->size = size;
+        split->mode = stat.mode;
+        split->deltaBlockSize = copyOptions.delta ? copyOptions.deltaBlockSize : 0U;
+        split->directBlockSize = (copyOptions.directThreshold != 0U && size >= copyOptions.directThreshold) ? copyOptions.directBlockSize : 0U;
+        split->keepContent = copyOptions.delta || !doneRanges.empty() || partial;
+        split->rangesLeft.store(static_cast<uint32_t>(ranges.size()));
+        for (const auto & [offset, length] : ranges)
+        {
+            TCopyTask task(std::string(file), stat, offset, length, split);
+            task.journalIndex = journalIndex;
+            push(std::move(task));
+        }
+    }
+
+    void resetJobState()
+    {
+        skippedFileNum.store(0U);
+        skippedFileSize.store(0U);
+        writtenFileSize.store(0U);
+        verifiedFileSize.store(0U);
+        verifyMismatchNum.store(0U);
+        dedupFileNum.store(0U);
+        dedupSavedSize.store(0U);
+        if (copyOptions.verify)
+        {
+            TVerifyQueue::getInstance().open();
+        }
+        else
+        {
+            TVerifyQueue::getInstance().close();
+        }
+        planResumed = journalDirsCreated = false;
+        planDirs.clear();
+        resumedFileNum = resumedFileSize = resumedScopeSize = resumedScopeFileNum = 0U;
+        TJournal::getInstance().close(); // Left open by a job without removeCopyQueues
+    }
+
+    // Limits the copies in flight per device, logs what is found
+    void configureDeviceLimits(const std::string_view & origin, const std::string_view & dest, const std::string & logMesBase)
+    {
+        const auto originDevice = getDeviceInfo(std::string(origin));
+        const auto destDevice = getDeviceInfo(std::string(dest));
+        auto & limits = TDeviceLimits::getInstance();
+        limits.configure(originDevice, destDevice, copyOptions.rotationalInFlight, copyOptions.solidStateInFlight);
+        const auto describe = [](const TDeviceInfo & device)
+        {
+            return device.known ? device.name + (device.rotational ? " (rotational)" : " (solid state)") : std::string("not known");
+        };
+        TLogger::getInstance().logMessage(logMesBase + "Info! Origin device: " + describe(originDevice) + ", "
+                                          + std::to_string(limits.getReadLimit()) + " copies in flight. Destination device: "
+                                          + (limits.isSameDevice() ? std::string("the same") : describe(destDevice) + ", "
+                                             + std::to_string(limits.getWriteLimit()) + " copies in flight") + ". 0 is no limit.");
+    }
+
+    // Loads the journal of an interrupted job, not copied work is passed to push. False if there is nothing to resume.
+    template<class TPush>
+    bool resumeJob(const std::string_view & origin, const std::string_view & dest, uint64_t & scopeSize, uint64_t & fileNum, TPush push)
+    {
+        auto & journal = TJournal::getInstance();
+        std::vector<TJournalEntry> journalEntries;
+        if (!journal.load(origin, dest, journalEntries, planDirs, journalDirsCreated))
+        {
+            return false;
+        }
+        const std::string destDir(dest);
+        uint64_t doneNum{ 0U };
+        for (uint64_t i = 0U; i < journalEntries.size(); i++)
+        {
+            auto & entry = journalEntries[i];
+            if (!entry.done && (!entry.doneRanges.empty() || entry.partialSize > 0U))
+            {
+                // Landed data is trusted only if the destination is still there, a removed partial file is copied again
+                TFileStat destStat;
+                std::error_code code;
+                const bool kept = statFile(destDir + entry.file, destStat, code) && destStat.type == fs::file_type::regular
+                                  && (entry.doneRanges.empty() ? destStat.size >= entry.partialSize : destStat.size == entry.stat.size);
+                if (!kept)
+                {
+                    entry.doneRanges.clear();
+                    entry.partialSize = 0U;
+                }
+            }
+            uint64_t tasksNum{ 0U };
+            uint64_t tasksSize{ 0U };
+            if (!entry.done)
+            {
+                makeTasks(std::move(entry.file), entry.stat, i, entry.doneRanges, entry.partialSize, [&](TCopyTask && task)
+                {
+                    tasksNum++;
+                    tasksSize += task.size;
+                    push(std::move(task));
+                });
+            }
+            if (tasksNum == 0U) // Copied or every range is landed
+            {
+                doneNum++;
+                resumedFileNum++;
+                resumedFileSize += entry.stat.size;
+            }
+            else
+            {
+                fileNum++;
+                scopeSize += tasksSize;
+                resumedFileSize += entry.stat.size - tasksSize;
+            }
+        }
+        planResumed = journal.resume(dest, journalEntries.size(), doneNum);
+        return true;
+    }
+
+    // Dedup mode: candidates of the same size and permissions are hashed, equal files (confirmed byte by byte,
+    // CRC32C only sorts them) are attached to the first one as its duplicates and removed from the entries.
+    // Returns the number of duplicates and adds their bytes to duplicatesSize.
+    uint64_t findDuplicates(std::vector<TCopyTask> & entries, const std::string & origin, uint64_t & duplicatesSize)
+    {
+        std::map<std::pair<uint64_t, uint32_t>, std::vector<size_t>> candidates;
+        for (size_t i = 0U; i < entries.size(); i++)
+        {
+            if (entries[i].size > 0U)
+            {
+                candidates[{ entries[i].size, entries[i].stat.mode }].push_back(i);
+            }
+        }
+        std::vector<bool> duplicate(entries.size(), false);
+        uint64_t duplicatesNum{ 0U };
+        std::error_code code;
+        for (const auto & [key, group] : candidates)
+        {
+            if (group.size() < 2U)
+            {
+                continue;
+            }
+            std::unordered_map<uint32_t, std::vector<size_t>> copied; // Files to copy by the checksum
+            for (const auto index : group)
+            {
+                uint32_t crc{ 0U };
+                if (!fileCrc32c(origin + entries[index].file, key.first, crc, code)) // Left to the worker to report
+                {
+                    continue;
+                }
+                auto & sameCrc = copied[crc];
+                const auto same = std::find_if(sameCrc.begin(), sameCrc.end(), [&](const size_t other)
+                {
+                    return isSameContent(origin + entries[other].file, origin + entries[index].file, key.first, code);
+                });
+                if (same == sameCrc.end())
+                {
+                    sameCrc.push_back(index);
+                    continue;
+                }
+                auto & task = entries[*same];
+                if (!task.duplicates)
+                {
+                    task.duplicates = std::make_shared<std::vector<TDuplicate>>();
+                }
+                task.duplicates->push_back(TDuplicate{ std::move(entries[index].file), entries[index].stat, 0U });
+                duplicate[index] = true;
+                duplicatesNum++;
+                duplicatesSize += key.first;
+            }
+        }
+        size_t kept{ 0U };
+        for (size_t i = 0U; i < entries.size(); i++)
+        {
+            if (!duplicate[i])
+            {
+                if (kept != i)
+                {
+                    entries[kept] = std::move(entries[i]);
+                }
+                kept++;
+            }
+        }
+        entries.resize(kept);
+        return duplicatesNum;
+    }
+
+    // Sync mode: true if the destination file already matches the origin one, it is counted as skipped then
+    bool isUnchanged(const std::string & origin, const std::string & dest, const TFileStat & stat)
+    {
+        TFileStat destStat;
+        std::error_code code;
+        if (!statFile(dest, destStat, code) || destStat.type != fs::file_type::regular || destStat.size != stat.size)
+        {
+            return false;
+        }
+        if (!copyOptions.syncChecksum)
+        {
+            if (destStat.mtime != stat.mtime)
+            {
+                return false;
+            }
+        }
+        else if (isSameContent(origin, dest, stat.size, code))
+        {
+            if (destStat.mtime != stat.mtime) // The next run without checksum skips it too
+            {
+                setFileMtime(dest, stat.mtime, code);
+            }
+        }
+        else
+        {
+            return false;
+        }
+        skippedFileNum++;
+        skippedFileSize += stat.size;
+        return true;
+    }
+
+    // Sync mode: a copied file gets the origin mtime, so the next run skips it
+    void keepMtime(const std::string & dest, const TFileStat & stat, const std::string & logMesBase)
+    {
+        std::error_code code;
+        if (!setFileMtime(dest, stat.mtime, code))
+        {
+            TLogger::getInstance().logMessage(logMesBase + "Warning! Can not set the last write time, the file will be copied again by the next sync. " + dest + " System info: " + code.message());
+        }
+    }
+
+    // Dedup mode: destinations of the duplicates are linked to the copy (target) of a finished file,
+    // or copied when the file failed or linking is not possible
+    void linkDuplicates(const std::string & origin, const std::string & dest, const std::string & target,
+                        const TCopyTask & task, const bool copied, const std::string & logMesBase)
+    {
+        auto & logger = TLogger::getInstance();
+        std::error_code code;
+        ECopyMethod method{ ECopyMethod::Hardlink };
+        for (const auto & duplicate : *task.duplicates)
+        {
+            const std::string destPath = dest + duplicate.file;
+            bool ret{ false };
+            if (copied && linkFile(target, destPath, duplicate.stat, code, method))
+            {
+                ret = true;
+                dedupFileNum++;
+                dedupSavedSize += duplicate.stat.size;
+            }
+            else
+            {
+                if (copied)
+                {
+                    logger.logMessage(logMesBase + "Warning! Can not link a duplicate, it is copied. " + destPath + " System info: " + code.message());
+                }
+                uint64_t size{ 0U };
+                ret = copyFile(origin + duplicate.file, destPath, duplicate.stat, code, method, size);
+            }
+            if (!ret)
+            {
+                copyErrorHappened.store(true);
+                logger.logMessage(logMesBase + "Error! Can not copy a file, you do not have permissions for the destination folder or the file is being opened. " + origin + duplicate.file + " System info: " + code.message());
+                continue;
+            }
+            TJournal::getInstance().fileDone(duplicate.journalIndex);
+            if (copyOptions.sync && method != ECopyMethod::Hardlink) // A hard link has the time of its target
+            {
+                keepMtime(destPath, duplicate.stat, logMesBase);
+            }
+        }
+    }
+
+    // A file interrupted by cancel, handled by the partial files policy. Removed with its published bytes
+    // or kept, the landed prefix of a whole file (0 if not known) is journaled then.
+    void handlePartialFile(const std::string & dest, const TCopyTask & task, const uint64_t prefix, const uint64_t published,
+                           std::atomic<uint64_t>& copiedFileSize, const std::string & logMesBase)
+    {
+        if (copyOptions.partialFiles == EPartialFilePolicy::Keep)
+        {
+            if (!task.split && prefix > 0U)
+            {
+                TJournal::getInstance().partialDone(task.journalIndex, prefix);
+            }
+            return;
+        }
+        copiedFileSize -= published;
+        std::error_code code;
+        fs::remove(dest, code);
+        if (code.value() != 0)
+        {
+            TLogger::getInstance().logMessage(logMesBase + "Warning! Can not remove a partially copied file. " + dest + " System info: " + code.message());
+        }
+    }
+
+    // A range of a split file leaves the worker with the bytes it added to copiedFileSize. Once a range of the file
+    // is canceled the bytes of all its ranges are taken back and the last range in flight removes the file,
+    // unless partial files are kept. Ranges still writing never find the file removed under them.
+    void leaveSplitRange(const std::string & dest, TSplitFile & split, const uint64_t counted,
+                         std::atomic<uint64_t>& copiedFileSize, const std::string & logMesBase)
+    {
+        bool lastRange{ false };
+        const uint64_t canceledSize = split.leaveRange(counted, lastRange);
+        if (copyOptions.partialFiles == EPartialFilePolicy::Keep)
+        {
+            return;
+        }
+        copiedFileSize -= canceledSize;
+        if (lastRange)
+        {
+            std::error_code code;
+            fs::remove(dest, code);
+            if (code.value() != 0)
+            {
+                TLogger::getInstance().logMessage(logMesBase + "Warning! Can not remove a partially copied file. " + dest + " System info: " + code.message());
+            }
+        }
+    }
+
+    // Ranges left in the queues by cancel: their files are canceled, the last range leaving removes a started file
+    void dropCanceledRanges(const uint32_t queue, std::atomic<uint64_t>& copiedFileSize, const std::string & logMesBase)
+    {
+        auto & queues = TCopyQueues::getInstance();
+        TCopyTask task;
+        while (queues.tryPop(queue, task))
+        {
+            if (task.split)
+            {
+                task.split->canceled.store(true);
+                task.split->startRange();
+                leaveSplitRange(queues.getDest() + task.file, *task.split, 0U, copiedFileSize, logMesBase);
+            }
+        }
+    }
+
+    bool checkCopyParams(const std::string_view & origin, const std::string_view & dest, const uint32_t hardwConcur)
+    {
+        if (hardwConcur == 0 || origin.empty() || dest.empty())
+        {
+            return false;
+        }
+        const fs::path originPath = origin;
+        const fs::path destPath = dest;
+        return fs::exists(origin) && fs::exists(dest) && originPath != destPath;
+    }
+
     std::string getCurrentThreadId()
     {
         const auto myid = std::this_thread::get_id();
@@ -40,6 +523,20 @@ bool isCopyErrorHappened()
 
 //===================================================================================================================================
 
+void setCopyOptions(const TCopyOptions & options)
+{
+    copyOptions = options;
+}
+
+//===================================================================================================================================
+
+TCopyOptions getCopyOptions()
+{
+    return copyOptions;
+}
+
+//===================================================================================================================================
+
 bool isEnoughSpace(const std::string_view & dest, const uint64_t spaceNeeded)
 {
     if (dest.empty())
@@ -53,84 +550,155 @@ bool isEnoughSpace(const std::string_view & dest, const uint64_t spaceNeeded)
 //===================================================================================================================================
 
 bool createCopyQueues(const std::string_view & origin, const std::string_view & dest,
-                      const uint32_t hardwConcur, uint64_t & scopeSize, uint64_t & fileNum)
+                      const uint32_t hardwConcur, uint64_t & scopeSize, uint64_t & fileNum,
+                      const std::atomic<bool>& copyCancel)
 {
-    // Check input params
-    if (hardwConcur == 0 || origin.empty() || dest.empty())
+    if (!checkCopyParams(origin, dest, hardwConcur))
     {
         return false;
     }
+    auto & queues = TCopyQueues::getInstance();
+    if (!queues.reset(hardwConcur, origin, dest))
     {
-        const fs::path originPath = origin;
-        const fs::path destPath = dest;
-        if (!fs::exists(origin) || !fs::exists(dest) || originPath == destPath)
-        {
-            return false;
-        }
+        return false;
     }
-    std::ofstream * fplan = new (std::nothrow) std::ofstream [hardwConcur];
-    if (fplan == nullptr)
+
+    startTrace();
+    const TTraceSpan span("createCopyQueues", "scan");
+    const auto scanStart = std::chrono::steady_clock::now();
+    scopeSize = 0U;
+    fileNum = 0U;
+    queueLoads.clear();
+    planImbalance = roundRobinImbalance = 1.0;
+    resetJobState();
+    resetCopyMethodStats(); // The scan syscalls are counted too
+    TWorkerControl::getInstance().reset(hardwConcur, copyOptions.adaptiveWorkers);
+    TJobStats::getInstance().reset(hardwConcur);
+    bool retValue{ true };
+    std::vector<TCopyTask> entries;
+    auto & journal = TJournal::getInstance();
+    const auto pushEntry = [&entries](TCopyTask && task)
     {
-        return false;
+        entries.push_back(std::move(task));
+    };
+    if (copyOptions.journal && resumeJob(origin, dest, scopeSize, fileNum, pushEntry)) // No rescan
+    {
+        TLogger::getInstance().startLogging();
+        TLogger::getInstance().logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Resumed from the journal, "
+                                          + std::to_string(resumedFileNum) + " files, " + std::to_string(resumedFileSize) + " bytes were copied before.");
     }
-    const std::string tempDir = fs::temp_directory_path().string();
-    for(size_t i = 0U; i < hardwConcur; i++)
+    else
     {
-        const std::string path = tempDir + tempFN + std::to_string(i) + tempExten;
-        fplan[i].open(path);
-        if (!fplan[i].is_open()) // Safe exit
+        // Every walker thread collects its own files and dirs, merged after the walk.
+        // copyDirStructure creates the dirs from this list, the origin is walked once.
+        TTreeWalker walker(origin, copyOptions.scanThreadsNum);
+        std::vector<std::vector<TCopyTask>> threadEntries(walker.getThreadsNum());
+        std::vector<std::vector<std::string>> threadDirs(walker.getThreadsNum());
+        const std::string originDir(origin);
+        const std::string destDir(dest);
+        retValue = walker.walk([&](const uint32_t thread, const std::string & dir)
         {
-            for(size_t j = 0U; j < i; j++)
+            threadDirs[thread].push_back(dir);
+        },
+        [&](const uint32_t thread, std::string && file, const TFileStat & stat)
+        {
+            if (!copyOptions.sync || !isUnchanged(originDir + file, destDir + file, stat))
             {
-                fplan[j].close();
+                threadEntries[thread].emplace_back(std::move(file), stat);
             }
-            return false;
+        }, copyCancel);
+        for (auto & dirs : threadDirs)
+        {
+            std::move(dirs.begin(), dirs.end(), std::back_inserter(planDirs));
         }
-    }
 
-    for(size_t i = 0; i < hardwConcur; i++)
-    {
-        fplan[i] << origin << std:: endl;
-        fplan[i] << dest << std:: endl;
-    }
+        uint64_t duplicatesNum{ 0U };
+        uint64_t duplicatesSize{ 0U };
+        if (retValue && copyOptions.dedup && !threadEntries.empty()) // Duplicates are looked for among all the files
+        {
+            for (size_t i = 1U; i < threadEntries.size(); i++)
+            {
+                std::move(threadEntries[i].begin(), threadEntries[i].end(), std::back_inserter(threadEntries[0]));
+                threadEntries[i].clear();
+            }
+            duplicatesNum = findDuplicates(threadEntries[0], originDir, duplicatesSize);
+            TLogger::getInstance().startLogging();
+            TLogger::getInstance().logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Dedup: "
+                                              + std::to_string(duplicatesNum) + " duplicate files, " + std::to_string(duplicatesSize) + " bytes.");
+        }
 
-    scopeSize = 0U;
-    fileNum = 0U;
-    bool retValue{ true };
-    const auto dirOption { std::filesystem::directory_options::skip_permission_denied };
-    try {
-        for (const auto& dir_entry : fs::recursive_directory_iterator(origin, dirOption))
+        if (retValue)
         {
-            if (dir_entry.is_regular_file())
+            const bool journaling = copyOptions.journal && journal.create(origin, dest);
+            if (journaling)
             {
-                scopeSize += dir_entry.file_size();
-                const std::string full_file = dir_entry.path().string();
-                const std::string file = full_file.substr(origin.size());
-                const uint32_t fStreamIndex = fileNum % hardwConcur;
-                fplan[fStreamIndex] << file << std::endl; // False positive warning, index is correct
-                fileNum++;
+                for (const auto & dir : planDirs)
+                {
+                    journal.addDir(dir);
+                }
+            }
+            for (auto & threadEntry : threadEntries)
+            {
+                for (auto & entry : threadEntry)
+                {
+                    scopeSize += entry.size;
+                    fileNum++;
+                    const uint64_t journalIndex = journaling ? journal.addFile(entry.file, entry.stat) : 0U;
+                    if (entry.duplicates && journaling) // Planned as usual files, a resumed job copies them
+                    {
+                        for (auto & duplicate : *entry.duplicates)
+                        {
+                            duplicate.journalIndex = journal.addFile(duplicate.file, duplicate.stat);
+                        }
+                    }
+                    makeTasks(std::move(entry.file), entry.stat, journalIndex, noDoneRanges, 0U, [&](TCopyTask && task)
+                    {
+                        task.duplicates = entry.duplicates; // Every range of a split file, the last landed one links them
+                        pushEntry(std::move(task));
+                    });
+                }
+                threadEntry.clear();
+            }
+            if (journaling)
+            {
+                journal.finishPlan();
             }
         }
+        else if (!copyCancel) // Access denied. Can happens for C:/ or C:/Windows origin dir
+        {
+            auto & logger = TLogger::getInstance();
+            logger.startLogging();
+            const auto logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ";
+            logger.logMessage(logMesBase + "Error! Can not create copy queues. Access denied. Origin: " + origin.data() + " System info: " + walker.getError());
+            logger.finishLogging();
+        }
     }
-    catch(const std::exception & e) // Access denied. Can happens for C:/ or C:/Windows origin dir
+
+    if (retValue)
     {
-        retValue = false;
-        auto & logger = TLogger::getInstance();
-        logger.startLogging();
-        const auto logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ";
-        logger.logMessage(logMesBase + "Error! Can not create copy queue files. Access denied. Origin: " + origin.data() + " System info: " + e.what());
-        logger.finishLogging();
+        const auto queueIndexes = balanceQueues(entries, hardwConcur);
+        for(size_t i = 0U; i < entries.size(); i++)
+        {
+            queues.push(queueIndexes[i], std::move(entries[i]));
+        }
+        TJobStats::getInstance().addPhase(EJobPhase::Scan, scanStart, std::chrono::steady_clock::now());
     }
-
-    for(size_t i = 0; i < hardwConcur; i++)
+    else
     {
-        fplan[i].close();
+        queues.clear();
     }
-    delete [] fplan;
 
     if (retValue)
     {
-        TLogger::getInstance().startLogging(); // create log file and open it
+        auto & logger = TLogger::getInstance();
+        logger.startLogging(); // create log file and open it
+        logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Plan: "
+                          + std::to_string(fileNum) + " files, " + std::to_string(scopeSize) + " bytes in "
+                          + std::to_string(hardwConcur) + " queues. Imbalance (max/avg bytes): "
+                          + std::to_string(planImbalance) + ", round-robin would give: " + std::to_string(roundRobinImbalance)
+                          + (copyOptions.sync ? ". Sync, skipped unchanged: " + std::to_string(skippedFileNum) + " files, "
+                                                + std::to_string(skippedFileSize) + " bytes" : std::string()));
+        configureDeviceLimits(origin, dest, std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ");
     }
     copyErrorHappened.store(false); // variable for worker fun copy error signalization
 
@@ -139,128 +707,404 @@ bool createCopyQueues(const std::string_view & origin, const std::string_view &
 
 //===================================================================================================================================
 
+bool openCopyQueues(const std::string_view & origin, const std::string_view & dest, const uint32_t hardwConcur)
+{
+    if (!checkCopyParams(origin, dest, hardwConcur))
+    {
+        return false;
+    }
+    auto & queues = TCopyQueues::getInstance();
+    if (!queues.reset(hardwConcur, origin, dest))
+    {
+        return false;
+    }
+    queueLoads.assign(hardwConcur, TQueueLoad{});
+    planImbalance = roundRobinImbalance = 1.0;
+    resetJobState();
+    resetCopyMethodStats();
+    TWorkerControl::getInstance().reset(hardwConcur, copyOptions.adaptiveWorkers);
+    TJobStats::getInstance().reset(hardwConcur);
+    startTrace();
+    queues.startScan();
+
+    auto & logger = TLogger::getInstance();
+    logger.startLogging(); // create log file and open it
+    copyErrorHappened.store(false);
+    configureDeviceLimits(origin, dest, std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ");
+
+    if (copyOptions.dedup)
+    {
+        logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Dedup needs the whole plan, the streaming job copies every file.");
+    }
+
+    // A resumed job has its plan already, the scanner only reports its totals
+    if (copyOptions.journal)
+    {
+        std::vector<TCopyTask> entries;
+        if (resumeJob(origin, dest, resumedScopeSize, resumedScopeFileNum, [&entries](TCopyTask && task) { entries.push_back(std::move(task)); }))
+        {
+            const auto queueIndexes = balanceQueues(entries, hardwConcur);
+            for (size_t i = 0U; i < entries.size(); i++)
+            {
+                queues.push(queueIndexes[i], std::move(entries[i]));
+            }
+            queues.finishScan();
+            logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Resumed from the journal, "
+                              + std::to_string(resumedFileNum) + " files, " + std::to_string(resumedFileSize) + " bytes were copied before.");
+        }
+        else if (!TJournal::getInstance().create(origin, dest))
+        {
+            logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Warning! Can not create the journal, the job is not resumable. " + std::string(dest));
+        }
+    }
+
+    return true;
+}
+
+//===================================================================================================================================
+
+void scanner(std::atomic<uint64_t>& scopeSize, std::atomic<uint64_t>& fileNum, const std::atomic<bool>& copyCancel)
+{
+    const std::string logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ";
+    auto & logger = TLogger::getInstance();
+    auto & queues = TCopyQueues::getInstance();
+    auto & journal = TJournal::getInstance();
+
+    if (planResumed) // Queues are filled by openCopyQueues
+    {
+        scopeSize += resumedScopeSize;
+        fileNum += resumedScopeFileNum;
+        return;
+    }
+    if (!queues.isScanning())
+    {
+        logger.logMessage(logMesBase + "Error! Copy queues are not opened for streaming!");
+        return;
+    }
+
+    TTracer::getInstance().nameThread("scanner");
+    const TTraceSpan span("scanner", "scan");
+    const auto scanStart = std::chrono::steady_clock::now();
+    const std::string & origin = queues.getOrigin();
+    const std::string & dest = queues.getDest();
+    std::mutex loadsMutex;
+    TTreeWalker walker(origin, copyOptions.scanThreadsNum);
+
+    // A dir is reported before its files, so workers always find the destination dir created
+    const auto onDir = [&](const uint32_t, const std::string & dir)
+    {
+        std::error_code code;
+        fs::create_directory(dest + dir, code);
+        if (code.value() != 0)
+        {
+            copyErrorHappened.store(true);
+            logger.logMessage(logMesBase + "Error! Can not create a destination dir. " + dest + dir);
+        }
+    };
+
+    // Online version of the size balancing, stealing evens out the rest
+    const auto onFile = [&](const uint32_t, std::string && file, const TFileStat & stat)
+    {
+        if (copyOptions.sync && isUnchanged(origin + file, dest + file, stat))
+        {
+            return;
+        }
+        const uint64_t journalIndex = journal.addFile(file, stat);
+        makeTasks(std::move(file), stat, journalIndex, noDoneRanges, 0U, [&](TCopyTask && task)
+        {
+            uint32_t queue{ 0U };
+            {
+                const std::lock_guard<std::mutex> lock(loadsMutex);
+                const auto lightest = std::min_element(queueLoads.begin(), queueLoads.end(), [](const TQueueLoad & a, const TQueueLoad & b)
+                {
+                    return a.bytes < b.bytes || (a.bytes == b.bytes && a.files < b.files);
+                });
+                lightest->bytes += task.size;
+                lightest->files++;
+                queue = static_cast<uint32_t>(lightest - queueLoads.begin());
+            }
+            queues.push(queue, std::move(task));
+        });
+        scopeSize += stat.size;
+        fileNum++;
+    };
+
+    if (walker.walk(onDir, onFile, copyCancel))
+    {
+        journal.finishPlan(); // Every dir is created by onDir already
+        journal.dirsCreated();
+    }
+    else if (!copyCancel) // Access denied. Can happens for C:/ or C:/Windows origin dir
+    {
+        copyErrorHappened.store(true);
+        logger.logMessage(logMesBase + "Error! Scan is stopped. Access denied. Origin: " + origin + " System info: " + walker.getError());
+    }
+    planImbalance = calcImbalance(queueLoads);
+    TJobStats::getInstance().addPhase(EJobPhase::Scan, scanStart, std::chrono::steady_clock::now()); // Dirs are created by the scan
+
+    queues.finishScan();
+}
+
+//===================================================================================================================================
+
 void copyDirStructure()
 {
-    const auto tempDir = fs::temp_directory_path().string();
-    const auto pathFirstQueue = tempDir + tempFN + "0" + tempExten;
+    if (planResumed && journalDirsCreated) // Created by the interrupted job
+    {
+        return;
+    }
+    const auto & queues = TCopyQueues::getInstance();
+    const auto & origin = queues.getOrigin();
+    const auto & dest = queues.getDest();
     const auto logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Error! ";
     auto & logger = TLogger::getInstance();
-    if (fs::exists(pathFirstQueue))
+    if (origin.empty() || dest.empty())
     {
-        const auto copyOptions = fs::copy_options::update_existing
-                                   | fs::copy_options::recursive
-                                   | fs::copy_options::directories_only;
+        logger.logMessage(logMesBase + "Origin or destination dir is an empty, copy queues are not created!");
+        return;
+    }
+    if (!fs::exists(origin) || !fs::exists(dest))
+    {
+        logger.logMessage(logMesBase + "Origin or destination dir does not exist! Origin: " + origin + " Dest: " + dest);
+        return;
+    }
+
+    const TTraceSpan span("copyDirStructure", "mkdir");
+    const auto start = std::chrono::steady_clock::now();
 
-        std::ifstream fin(pathFirstQueue);
-        if (fin.is_open())
+    // Dirs of the plan by depth, a level is created when all its parents are
+    std::vector<std::vector<const std::string *>> levels;
+    for (const auto & dir : planDirs)
+    {
+        const auto depth = static_cast<size_t>(std::count_if(dir.begin(), dir.end(), [](const char ch) { return ch == '/' || ch == '\\'; }));
+        if (levels.size() <= depth)
         {
-            std::string origin;
-            std::getline(fin, origin);
-            std::string dest;
-            std::getline(fin, dest);
-            if (!origin.empty() && !dest.empty())
+            levels.resize(depth + 1U);
+        }
+        levels[depth].push_back(&dir);
+    }
+
+    std::atomic<bool> failed{ false };
+    for (const auto & level : levels)
+    {
+        std::atomic<size_t> next{ 0U };
+        const auto createDirs = [&]()
+        {
+            std::error_code code;
+            for (size_t first = next.fetch_add(dirsChunk); first < level.size(); first = next.fetch_add(dirsChunk))
             {
-                if (fs::exists(origin) && fs::exists(dest))
+                const size_t last = std::min(first + dirsChunk, level.size());
+                addSyscalls(2U * (last - first)); // stat of the origin dir and mkdir
+                for (size_t i = first; i < last; i++)
                 {
-                    std::error_code code;
-                    fs::copy(origin, dest, copyOptions, code);
+                    // With the permissions of the origin dir, an existing dir is not an error
+                    fs::create_directory(dest + *level[i], origin + *level[i], code);
                     if (code.value() != 0) // For access denied it is 5
                     {
-                        copyErrorHappened.store(true);
-                        logger.logMessage(logMesBase + "Can not copy a file, you do not have permissions for the destination folder or the file is being opened. Destination: " + dest);
+                        failed.store(true);
+                        logger.logMessage(logMesBase + "Can not create a destination dir, you do not have permissions for the destination folder. " + dest + *level[i] + " System info: " + code.message());
+                        code.clear();
                     }
-                    code.clear();
-                }
-                else
-                {
-                    logger.logMessage(logMesBase + "Origin or destination dir does not exist! Origin: " + origin + " Dest: " + dest);
                 }
             }
-            else
-            {
-                logger.logMessage(logMesBase + "Origin or destination dir is en empty in the first queue file! " + pathFirstQueue);
-            }
-            fin.close();
+        };
+        const size_t threadsNum = std::min<size_t>(std::max(copyOptions.scanThreadsNum, 1U), (level.size() + dirsChunk - 1U) / dirsChunk);
+        std::vector<std::thread> threads;
+        for (size_t i = 1U; i < threadsNum; i++)
+        {
+            threads.emplace_back(createDirs);
         }
-        else
+        createDirs();
+        for (auto & thread : threads)
         {
-            logger.logMessage(logMesBase + "Can not open queue file! " + pathFirstQueue);
+            thread.join();
         }
     }
+
+    TJobStats::getInstance().addPhase(EJobPhase::Mkdir, start, std::chrono::steady_clock::now());
+    if (failed)
+    {
+        copyErrorHappened.store(true);
+    }
     else
     {
-        logger.logMessage(logMesBase + "First queue file does not exist! " + pathFirstQueue);
+        TJournal::getInstance().dirsCreated();
     }
 }
 
 //===================================================================================================================================
 
-void worker(const std::string queue, std::atomic<uint64_t>& copiedFileSize,
+void worker(const uint32_t queue, std::atomic<uint64_t>& copiedFileSize,
             std::atomic<uint64_t>& copiedFileNum, std::atomic<uint32_t>& finishedThreadsNum,
             const std::atomic<bool>& copyCancel)
 {
     const std::string logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ";
     auto & logger = TLogger::getInstance();
+    auto & queues = TCopyQueues::getInstance();
+    auto & journal = TJournal::getInstance();
+    auto & verifyQueue = TVerifyQueue::getInstance(); // Not open without the verification
+    auto & control = TWorkerControl::getInstance();
+    auto & stats = TJobStats::getInstance();
+    const auto workerStart = std::chrono::steady_clock::now();
+    if (TTracer::getInstance().isRecording())
+    {
+        TTracer::getInstance().nameThread("worker " + std::to_string(queue));
+    }
 
-    if (!queue.empty() && fs::exists(queue))
+    if (queue < queues.getQueuesNum())
     {
-        std::ifstream fin(queue);
-        if (fin.is_open())
+        const std::string & origin = queues.getOrigin();
+        const std::string & dest = queues.getDest();
+        TCopyTask task;
+        std::string fullPath;
+        std::string destPath;
+        std::error_code code;
+        ECopyMethod method{ ECopyMethod::Buffered };
+        uint64_t written{ 0U };
+        const bool sync = copyOptions.sync;
+        const bool delta = copyOptions.delta && copyOptions.deltaBlockSize != 0U;
+        const bool dedup = copyOptions.dedup;
+        const uint64_t directThreshold = copyOptions.directThreshold;
+        TCopyProgress progress; // Bytes are published as they are written
+        progress.copiedSize = &copiedFileSize;
+        progress.cancel = &copyCancel;
+        auto waitStart = workerStart;
+        while(control.waitActive(queue, copyCancel) && queues.pop(queue, task))
         {
-            std::string origin;
-            std::getline(fin, origin);
-            std::string dest;
-            std::getline(fin, dest);
-            if (origin.empty() || dest.empty())
+            const auto taskStart = std::chrono::steady_clock::now(); // Two clock reads a task, cheaper than a syscall
+            stats.addQueueWait(queue, taskStart - waitStart);
+            if (!task.file.empty())
             {
-                logger.logMessage(logMesBase + "Error! Incorrect structure in queue file: origin or destination dir is not provided! " + queue);
-                fin.close();
-                return;
-            }
-            std::string currentFile, fullPath;
-            std::error_code code;
-            const auto copyOptions = fs::copy_options::overwrite_existing;
-            while(!fin.eof() && !copyCancel.load())
-            {
-                std::getline(fin, currentFile);
-                if (!currentFile.empty())
+                const TTraceSpan span(task.split ? "copy range" : "copy file", "copy", task.file);
+                fullPath = origin + task.file;
+                destPath = dest + task.file;
+                progress.published = 0U;
+                if(task.split) // A range of a big file, the file is done when its last range lands
                 {
-                    fullPath = origin + currentFile;
-                    if (fs::exists(fullPath))
+                    auto & split = *task.split;
+                    bool ret{ false };
+                    bool canceled = !split.startRange(); // Another range of the file was canceled
+                    if (!canceled)
+                    {
+                        const TDeviceSlot slot(copyCancel);
+                        ret = slot.isAcquired() ? copyRange(fullPath, destPath, split, task.offset, task.size, code, written, &progress) : false;
+                        code = slot.isAcquired() ? code : std::make_error_code(std::errc::operation_canceled);
+                        // A range failing after the cancel is canceled, not an error
+                        canceled = (code == std::errc::operation_canceled) || (!ret && copyCancel.load()) || split.isCanceled(copyCancel);
+                    }
+                    if (canceled)
+                    {
+                        split.canceled.store(true);
+                        leaveSplitRange(destPath, split, progress.published, copiedFileSize, logMesBase);
+                        break;
+                    }
+                    if (!ret)
+                    {
+                        copyErrorHappened.store(true);
+                        logger.logMessage(logMesBase + "Error! Can not copy a file range from " + std::to_string(task.offset) + ", " + std::to_string(task.size) + " bytes. " + fullPath + " System info: " + code.message());
+                    }
+                    else
                     {
-                        if(fs::is_regular_file(fullPath))
+                        journal.rangeDone(task.journalIndex, task.offset);
+                        verifyQueue.push(TVerifyTask{ fullPath, destPath, task.offset, task.size });
+                    }
+                    code.clear();
+                    const uint64_t rest = task.size - std::min(progress.published, task.size);
+                    copiedFileSize += rest;
+                    writtenFileSize += written;
+                    if (split.finishRange(ret))
+                    {
+                        copiedFileNum++;
+                        if (task.duplicates)
+                        {
+                            linkDuplicates(origin, dest, destPath, task, !split.failed, logMesBase);
+                        }
+                        if (!split.failed)
                         {
-                            fs::copy(fullPath, dest + currentFile, copyOptions, code);
-                            if (code.value() != 0) // For access denied it is 5
+                            journal.fileDone(task.journalIndex);
+                            addCopyMethodFile(ECopyMethod::SplitRanges);
+                            if (sync)
                             {
-                                copyErrorHappened.store(true);
-                                logger.logMessage(logMesBase + "Error! Can not copy a file, you do not have permissions for the destination folder or the file is being opened. " + fullPath);
+                                keepMtime(destPath, task.stat, logMesBase);
                             }
-                            code.clear();
-                            copiedFileSize += fs::file_size(fullPath);
-                            copiedFileNum++;
                         }
-                        else
+                    }
+                    leaveSplitRange(destPath, split, progress.published + rest, copiedFileSize, logMesBase);
+                }
+                else if (task.stat.type != fs::file_type::regular) // The scan stat is trusted, the origin is not checked again
+                {
+                    logger.logMessage(logMesBase + "Warning! File to copy from queue is not regular and will be skipped! " + fullPath);
+                }
+                else
+                {
+                    // A new destination is copied as a whole in delta mode too
+                    bool copied{ false };
+                    bool deltaDone{ false };
+                    uint64_t size{ 0U }; // Bytes copied, the origin may have changed after the scan
+                    const TDeviceSlot slot(copyCancel);
+                    if (!slot.isAcquired()) // Canceled while waiting, nothing is written yet
+                    {
+                        break;
+                    }
+                    if (delta && task.size >= copyOptions.deltaThreshold)
+                    {
+                        copied = deltaCopyFile(fullPath, destPath, task.stat, copyOptions.deltaBlockSize, code, written, size, &progress);
+                        deltaDone = copied || code != std::errc::no_such_file_or_directory;
+                    }
+                    if (!deltaDone)
+                    {
+                        if (dedup) // Never written through a hard link made by the dedup mode
                         {
-                            logger.logMessage(logMesBase + "Warning! File to copy from queue file is not regular and will be skipped! " + fullPath);
+                            std::error_code removeCode;
+                            fs::remove(destPath, removeCode);
                         }
+                        copied = (directThreshold != 0U && task.size >= directThreshold)
+                               ? directCopyFile(fullPath, destPath, task.stat, copyOptions.directBlockSize, code, method, size, &progress)
+                               : copyFile(fullPath, destPath, task.stat, code, method, size, &progress);
+                        written = (method == ECopyMethod::Reflink) ? 0U : size;
+                    }
+                    if (code == std::errc::operation_canceled)
+                    {
+                        handlePartialFile(destPath, task, progress.published, progress.published, copiedFileSize, logMesBase);
+                        break;
+                    }
+                    if (!copied) // For access denied it is 5, a removed file fails here too
+                    {
+                        copyErrorHappened.store(true);
+                        logger.logMessage(logMesBase + "Error! Can not copy a file, you do not have permissions for the destination folder or the file is being opened. " + fullPath + " System info: " + code.message());
                     }
                     else
                     {
-                        logger.logMessage(logMesBase + "Error! A file to copy from queue file does not exist! " + fullPath);
+                        journal.fileDone(task.journalIndex);
+                        verifyQueue.push(TVerifyTask{ fullPath, destPath, 0U, size });
+                        writtenFileSize += written;
+                        if (sync)
+                        {
+                            keepMtime(destPath, task.stat, logMesBase);
+                        }
+                    }
+                    if (task.duplicates)
+                    {
+                        linkDuplicates(origin, dest, destPath, task, copied, logMesBase);
                     }
+                    code.clear();
+                    copiedFileSize += task.size - std::min(progress.published, task.size);
+                    copiedFileNum++;
                 }
+                waitStart = std::chrono::steady_clock::now();
+                stats.addFile(queue, task.size, waitStart - taskStart);
             }
-            fin.close();
         }
-        else
+        control.finish(); // Nothing left to copy, parked workers finish too
+        if (copyCancel)
         {
-            logger.logMessage(logMesBase + "Error! Can not open input queue file! " + queue);
+            dropCanceledRanges(queue, copiedFileSize, logMesBase);
         }
+        stats.addPhase(EJobPhase::Copy, workerStart, std::chrono::steady_clock::now());
     }
     else
     {
-        logger.logMessage(logMesBase + "Error! Queue file param is an empty or does not exist!" + " Queue file param: " + queue);
+        logger.logMessage(logMesBase + "Error! Queue index param is out of range! Queue index param: " + std::to_string(queue));
     }
 
     finishedThreadsNum++;
@@ -268,33 +1112,261 @@ void worker(const std::string queue, std::atomic<uint64_t>& copiedFileSize,
 
 //===================================================================================================================================
 
-void removeCopyQueues(const uint32_t hardwConcur)
+void uringWorker(const uint32_t queue, std::atomic<uint64_t>& copiedFileSize,
+                 std::atomic<uint64_t>& copiedFileNum, std::atomic<uint32_t>& finishedThreadsNum,
+                 const std::atomic<bool>& copyCancel)
 {
-    const std::string tempDir = fs::temp_directory_path().string();
-    for(size_t i = 0U; i < hardwConcur; i++)
+    const std::string logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ";
+    auto & logger = TLogger::getInstance();
+
+    const auto onError = [&](const std::string & file, const std::string & error)
+    {
+        copyErrorHappened.store(true);
+        logger.logMessage(logMesBase + "Error! Can not copy a file, you do not have permissions for the destination folder or the file is being opened. " + file + " System info: " + error);
+    };
+
+    // Ranges are not compared with the destination by the ring
+    if (copyOptions.delta)
+    {
+        logger.logMessage(logMesBase + "Info! Delta mode is not supported by io_uring, the thread copies files one by one.");
+        worker(queue, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+        return;
+    }
+
+    const bool sync = copyOptions.sync;
+    const auto & origin = TCopyQueues::getInstance().getOrigin();
+    const auto & destDir = TCopyQueues::getInstance().getDest();
+    const auto onFinished = [&](const std::string & dest, const TCopyTask & task, const bool copied, const uint64_t size)
     {
-        const std::string path = tempDir + tempFN + std::to_string(i) + tempExten;
-        if (fs::exists(path))
+        if (task.duplicates)
+        {
+            linkDuplicates(origin, destDir, dest, task, copied, logMesBase);
+        }
+        if (!copied)
+        {
+            return;
+        }
+        writtenFileSize += size;
+        TJournal::getInstance().fileDone(task.journalIndex);
+        TVerifyQueue::getInstance().push(TVerifyTask{ origin + task.file, dest, 0U, size });
+        if (sync)
         {
-            fs::remove(path);
+            keepMtime(dest, task.stat, logMesBase);
         }
+    };
+
+    // Blocks land out of order, the prefix is not known
+    const auto onCanceled = [&](const std::string & dest, const TCopyTask & task, const uint64_t published)
+    {
+        handlePartialFile(dest, task, 0U, published, copiedFileSize, logMesBase);
+    };
+    const auto onRangeLeft = [&](const std::string & dest, const TCopyTask & task, const uint64_t counted)
+    {
+        leaveSplitRange(dest, *task.split, counted, copiedFileSize, logMesBase);
+    };
+
+    // Every ring gets its share of the device limits, a slot is a read or a write in flight
+    const auto & limits = TDeviceLimits::getInstance();
+    const auto orNoLimit = [](const uint32_t limit) { return limit == 0U ? std::numeric_limits<uint32_t>::max() : limit; };
+    const uint32_t deviceLimit = std::min(orNoLimit(limits.getReadLimit()), orNoLimit(limits.getWriteLimit()));
+    const uint32_t queueDepth = std::clamp(deviceLimit / std::max(copyOptions.uringThreadsNum, 1U), 1U, std::max(copyOptions.uringQueueDepth, 1U));
+
+    if (TTracer::getInstance().isRecording())
+    {
+        TTracer::getInstance().nameThread("io_uring " + std::to_string(queue));
+    }
+    const auto start = std::chrono::steady_clock::now();
+    if (!uringCopy(queue, queueDepth, copyOptions.uringBlockSize, copiedFileSize, copiedFileNum, copyCancel, onError, onFinished, onCanceled, onRangeLeft))
+    {
+        logger.logMessage(logMesBase + "Warning! io_uring is not available or failed, the thread copies the rest of files one by one.");
+        worker(queue, copiedFileSize, copiedFileNum, finishedThreadsNum, copyCancel);
+        return;
     }
+    if (copyCancel)
+    {
+        dropCanceledRanges(queue, copiedFileSize, logMesBase);
+    }
+    TJobStats::getInstance().addPhase(EJobPhase::Copy, start, std::chrono::steady_clock::now());
+
+    finishedThreadsNum++;
+}
+
+//===================================================================================================================================
 
-    TLogger::getInstance().finishLogging(); // close log file
+void verifier(std::atomic<uint32_t>& finishedVerifiersNum, const std::atomic<bool>& copyCancel)
+{
+    const std::string logMesBase = std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". ";
+    auto & logger = TLogger::getInstance();
+    auto & verifyQueue = TVerifyQueue::getInstance();
+    TVerifyTask task;
+    uint32_t originCrc{ 0U };
+    uint32_t destCrc{ 0U };
+    std::error_code code;
+    auto & stats = TJobStats::getInstance();
+    if (TTracer::getInstance().isRecording())
+    {
+        TTracer::getInstance().nameThread("verifier");
+    }
+    while (!copyCancel.load() && verifyQueue.pop(task))
+    {
+        const TTraceSpan span("verify", "verify", task.dest);
+        const auto start = std::chrono::steady_clock::now();
+        const std::string range = " From " + std::to_string(task.offset) + ", " + std::to_string(task.size) + " bytes.";
+        if (!checksumRange(task.origin, task.dest, task.offset, task.size, originCrc, destCrc, code))
+        {
+            verifyMismatchNum++;
+            copyErrorHappened.store(true);
+            logger.logMessage(logMesBase + "Error! Can not verify a copied file, it is not readable or was changed. " + task.dest + range + " System info: " + code.message());
+        }
+        else if (originCrc != destCrc)
+        {
+            verifyMismatchNum++;
+            copyErrorHappened.store(true);
+            logger.logMessage(logMesBase + "Error! Verification failed, the copy differs from the origin. " + task.dest + range
+                              + " CRC32C origin: " + std::to_string(originCrc) + ", destination: " + std::to_string(destCrc));
+        }
+        verifiedFileSize += task.size;
+        stats.addPhase(EJobPhase::Verify, start, std::chrono::steady_clock::now());
+    }
+    finishedVerifiersNum++;
+}
+
+//===================================================================================================================================
+
+void finishVerify()
+{
+    TVerifyQueue::getInstance().close();
+}
+
+//===================================================================================================================================
+
+void removeCopyQueues()
+{
+    TCopyQueues::getInstance().clear();
+    TVerifyQueue::getInstance().close();
+    TAlignedBufferPool::getInstance().clear();
+
+    auto & logger = TLogger::getInstance();
+    auto & journal = TJournal::getInstance();
+    if (journal.isOpen() && !journal.close())
+    {
+        logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! The job is not complete, the next run with the journal resumes it.");
+    }
+    logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Files copied by method: " + getCopyMethodStats());
+    if (copyOptions.verify)
+    {
+        logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Info! Verified: " + std::to_string(verifiedFileSize)
+                          + " bytes (CRC32C " + (isCrc32cHardware() ? "SSE4.2" : "tables") + "), mismatches: " + std::to_string(verifyMismatchNum));
+    }
+    if (!copyOptions.statsFile.empty() && !saveJobStats())
+    {
+        logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Warning! Can not write the job stats. " + copyOptions.statsFile);
+    }
+    auto & tracer = TTracer::getInstance();
+    if (tracer.isRecording())
+    {
+        tracer.stop();
+        if (tracer.getDroppedNum() > 0U)
+        {
+            logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Warning! " + std::to_string(tracer.getDroppedNum()) + " trace spans were dropped, the thread buffers were full.");
+        }
+        if (!tracer.save(copyOptions.traceFile))
+        {
+            logger.logMessage(std::string(__FUNCTION__) + ", thread: " + getCurrentThreadId() + ". Warning! Can not write the trace. " + copyOptions.traceFile);
+        }
+    }
+    logger.finishLogging(); // close log file
+}
+
+//===================================================================================================================================
+
+bool saveJobStats()
+{
+    return !copyOptions.statsFile.empty() && TJobStats::getInstance().save(copyOptions.statsFile, copyOptions.statsFormat);
+}
+
+//===================================================================================================================================
+
+uint64_t getDedupFileNum()
+{
+    return dedupFileNum;
+}
+
+//===================================================================================================================================
+
+uint64_t getDedupSavedSize()
+{
+    return dedupSavedSize;
+}
+
+//===================================================================================================================================
+
+uint64_t getVerifiedFileSize()
+{
+    return verifiedFileSize;
+}
+
+//===================================================================================================================================
+
+uint64_t getVerifyMismatchNum()
+{
+    return verifyMismatchNum;
+}
+
+//===================================================================================================================================
+
+uint64_t getSkippedFileNum()
+{
+    return skippedFileNum;
+}
+
+//===================================================================================================================================
+
+uint64_t getSkippedFileSize()
+{
+    return skippedFileSize;
+}
+
+//===================================================================================================================================
+
+uint64_t getResumedFileNum()
+{
+    return resumedFileNum;
+}
+
+//===================================================================================================================================
+
+uint64_t getResumedFileSize()
+{
+    return resumedFileSize;
+}
+
+//===================================================================================================================================
+
+uint64_t getWrittenFileSize()
+{
+    return writtenFileSize;
+}
+
+//===================================================================================================================================
+
+std::vector<TQueueLoad> getQueueLoads()
+{
+    return queueLoads;
 }
 
 //===================================================================================================================================
 
-std::string getTempFN() // for unit tests
+double getPlanImbalance()
 {
-    return tempFN;
+    return planImbalance;
 }
 
 //===================================================================================================================================
 
-std::string getTempExten() // for unit tests
+double getRoundRobinImbalance()
 {
-    return tempExten;
+    return roundRobinImbalance;
 }
 
 //===================================================================================================================================
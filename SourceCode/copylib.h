@@ -4,91 +4,176 @@
 #include <string>
 #include <string_view>
 #include <atomic>
-#include <mutex>
-#include <fstream>
+#include <vector>
+
+#include "logger.h"
+#include "jobstats.h"
 
 namespace CopyLib {
 
+    // Bytes and files assigned to a copy queue
+    struct TQueueLoad
+    {
+        uint64_t bytes{ 0U };
+        uint64_t files{ 0U };
+    };
+
+    // What is done with the destination of a file interrupted by cancel
+    enum class EPartialFilePolicy : uint32_t
+    {
+        Remove, // No partial files are left in the destination
+        Keep    // Kept for the resumed job, with the journal only the not copied rest is copied then
+    };
+
+    // Copy job settings, applied to the next createCopyQueues/openCopyQueues call
+    struct TCopyOptions
+    {
+        uint32_t scanThreadsNum{ 1U }; // Threads enumerating the origin tree and creating the destination dirs
+
+        // io_uring backend, see uringWorker
+        bool ioUring{ false };
+        uint32_t uringThreadsNum{ 1U };      // Rings, one thread each
+        uint32_t uringQueueDepth{ 64U };     // Reads and writes in flight per ring
+        uint32_t uringBlockSize{ 1U << 20U }; // Size of every registered buffer
+
+        // Files from splitThreshold bytes are copied in splitRangeSize ranges by several workers at once, 0 disables
+        uint64_t splitThreshold{ 1ULL << 30U };
+        uint64_t splitRangeSize{ 256ULL << 20U };
+
+        // Sync mode: files with the same size and mtime in the destination are skipped, copied files get the origin mtime.
+        // syncChecksum compares the content of same size files instead of mtime, both files are read by the scan then.
+        bool sync{ false };
+        bool syncChecksum{ false };
+
+        // Delta mode: an existing destination of a file from deltaThreshold bytes is updated in place,
+        // only deltaBlockSize blocks differing from the origin are written. io_uring workers fall back to worker.
+        bool delta{ false };
+        uint64_t deltaThreshold{ 16ULL << 20U };
+        uint32_t deltaBlockSize{ 256U << 10U };
+
+        // Large file mode: files from directThreshold bytes (and ranges of split ones) are copied by directCopyFile,
+        // in directBlockSize blocks bypassing the page cache, so a huge copy does not evict the cached data of the host.
+        // 0 disables. io_uring workers copy through the page cache.
+        uint64_t directThreshold{ 0U };
+        uint32_t directBlockSize{ 4U << 20U };
+
+        // Resumable job: a checkpoint journal is kept in the destination dir, see TJournal. The next job
+        // for the same origin and destination takes the not copied work from it without a rescan.
+        bool journal{ false };
+
+        // Workers copy in chunks and react to cancel within one chunk, see TCopyProgress
+        EPartialFilePolicy partialFiles{ EPartialFilePolicy::Remove };
+
+        // Verification: every landed file (or range) is passed to verifier threads, they compare CRC32C of the origin
+        // and the destination while the copy goes on. Mismatches are logged as copy errors.
+        bool verify{ false };
+        uint32_t verifyThreadsNum{ 1U };
+
+        // Dedup mode (createCopyQueues only): files of the same size and permissions are hashed after the scan,
+        // equal ones (confirmed byte by byte) are copied once and the rest are reflinked to that copy, or hard linked
+        // where reflinks are not supported. Hard linked files share one inode, so in this mode a destination file
+        // is replaced by a new one instead of being written into.
+        bool dedup{ false };
+
+        // Adaptive number of workers, see TWorkerControl: hardwConcur of createCopyQueues/openCopyQueues is the max
+        // number of workers then, the controller starts from a half of it. Not for io_uring workers.
+        bool adaptiveWorkers{ false };
+
+        // Copies in flight per device, see TDeviceLimits: a sync worker copying a file takes a slot, io_uring rings
+        // share the limit as their queue depth. The kind of the origin and the destination device gives each its limit.
+        uint32_t rotationalInFlight{ 4U };   // A few requests let the disk reorder them, more only make it seek
+        uint32_t solidStateInFlight{ 64U };  // Also for not known devices, 0 is no limit
+
+        // Job stats, see TJobStats: saved to statsFile by removeCopyQueues at the end of every job
+        // and by saveJobStats on demand. Empty is no file.
+        std::string statsFile;
+        EStatsFormat statsFormat{ EStatsFormat::Json };
+
+        // Timeline of the job in the Chrome trace event format, see TTracer: spans of the scan, the dir structure,
+        // every file copied or verified by every thread and the log writes, saved by removeCopyQueues. Empty is no trace.
+        std::string traceFile;
+    };
+
+    void setCopyOptions(const TCopyOptions & options);
+
+    TCopyOptions getCopyOptions();
+
+    // False if the origin can not be walked or the scan is canceled, the queues are left empty then
     bool createCopyQueues(const std::string_view & origin, const std::string_view & dest,
-                          const uint32_t hardwConcur, uint64_t & scopeSize, uint64_t & fileNum);
+                          const uint32_t hardwConcur, uint64_t & scopeSize, uint64_t & fileNum,
+                          const std::atomic<bool>& copyCancel);
 
+    // Streaming mode: queues are opened empty and filled by the scanner thread while workers already copy.
+    // The scanner creates destination dirs itself, copyDirStructure is not needed.
+    bool openCopyQueues(const std::string_view & origin, const std::string_view & dest, const uint32_t hardwConcur);
+
+    void scanner(std::atomic<uint64_t>& scopeSize, std::atomic<uint64_t>& fileNum, const std::atomic<bool>& copyCancel);
+
+    // Creates the dirs found by the createCopyQueues scan (or kept by the journal of a resumed job) in the destination,
+    // level by level, so parents are created before children, by scanThreadsNum threads. The origin is not walked again.
     void copyDirStructure();
 
     bool isEnoughSpace(const std::string_view & dest, const uint64_t spaceNeeded);
 
-    void removeCopyQueues(const uint32_t hardwConcur);
+    void removeCopyQueues();
+
+    // Stats of the running (or the last) job to statsFile of the options, false if it is not set or can not be written
+    bool saveJobStats();
 
-    void worker(const std::string queue, std::atomic<uint64_t>& copiedFileSize,
+    // copiedFileSize and copiedFileNum are only added to by the worker, pass the counters of its own
+    // TProgressCounters block so that workers do not share a cache line
+    void worker(const uint32_t queue, std::atomic<uint64_t>& copiedFileSize,
                 std::atomic<uint64_t>& copiedFileNum, std::atomic<uint32_t>& finishedThreadsNum,
                 const std::atomic<bool>& copyCancel);
 
-    std::string getTempFN();
+    // io_uring version of worker: one thread keeps many files in flight, tasks of other queues are stolen,
+    // so uringThreadsNum threads drain all the queues. Falls back to worker if a ring can not be created.
+    void uringWorker(const uint32_t queue, std::atomic<uint64_t>& copiedFileSize,
+                     std::atomic<uint64_t>& copiedFileNum, std::atomic<uint32_t>& finishedThreadsNum,
+                     const std::atomic<bool>& copyCancel);
 
-    std::string getTempExten();
+    // Verifier thread: checks what the workers have copied until finishVerify is called and everything is checked
+    void verifier(std::atomic<uint32_t>& finishedVerifiersNum, const std::atomic<bool>& copyCancel);
+
+    // Called when all the workers are finished, no more files come to the verifiers
+    void finishVerify();
 
     bool isCopyErrorHappened();
 
-    //===================================================================================================================================
+    // Unchanged files skipped by the sync mode since the last createCopyQueues/openCopyQueues call,
+    // they are not counted in scopeSize and fileNum
+    uint64_t getSkippedFileNum();
 
-    // Logger singleton for multithreaded worker fun
-    class TLogger
-    {
-    public:
-
-        static TLogger & getInstance()
-        {
-            static TLogger logger;
-            return logger;
-        }
-
-        bool logMessage(const std::string_view & message)
-        {
-            if (message.empty())
-            {
-                return false;
-            }
-
-            const std::lock_guard<std::mutex> lock(fStreamMutex);
-            if (fout.is_open())
-            {
-                fout << logMessageNum++ << ": "<< message << std::endl;
-                return true;
-            }
-            return false;
-        }
-
-        void startLogging()
-        {
-            if(!fout.is_open())
-            {
-                fout.open(logFileName);
-                logMessageNum = 1U;
-            }
-        }
-
-        void finishLogging()
-        {
-            if(fout.is_open())
-            {
-                fout.close();
-            }
-        }
-
-        std::string getLogFileName() const { return logFileName; }
-
-    private:
-
-        TLogger() { }
-        ~TLogger() { finishLogging(); }
-        TLogger(const TLogger & log) = delete;
-        TLogger operator=(const TLogger & log) = delete;
-
-        std::mutex fStreamMutex;
-        std::ofstream fout;
-        const std::string logFileName{"simpleCopyLog.txt"};
-        uint64_t logMessageNum{ 1U };
-
-    }; // TLogger
+    uint64_t getSkippedFileSize();
+
+    // Files and bytes copied by the interrupted job the current one is resumed from, not counted in scopeSize and fileNum
+    uint64_t getResumedFileNum();
+
+    uint64_t getResumedFileSize();
+
+    // Bytes really written to the destination since the last createCopyQueues/openCopyQueues call.
+    // copiedFileSize counts logical bytes, delta and reflink copies write less.
+    uint64_t getWrittenFileSize();
+
+    // Duplicates linked to the copy of the same content by the dedup mode since the last createCopyQueues call
+    // and bytes saved by them. They are not counted in scopeSize and fileNum.
+    uint64_t getDedupFileNum();
+
+    uint64_t getDedupSavedSize();
+
+    // Bytes verified and files (or ranges) differing from the origin since the last createCopyQueues/openCopyQueues call
+    uint64_t getVerifiedFileSize();
+
+    uint64_t getVerifyMismatchNum();
+
+    // Queues load of the last createCopyQueues call
+    std::vector<TQueueLoad> getQueueLoads();
+
+    // Heaviest queue bytes divided by the average queue bytes, 1.0 is a perfect balance
+    double getPlanImbalance();
+
+    // The same ratio for the old round-robin by file count distribution, to see the gain
+    double getRoundRobinImbalance();
 
     //===================================================================================================================================
 
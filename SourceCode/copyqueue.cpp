@@ -0,0 +1,180 @@
+
+#include "copyqueue.h"
+
+#include <new>
+
+namespace CopyLib {
+
+//===================================================================================================================================
+
+bool TCopyQueues::reset(const uint32_t queuesNum, const std::string_view & origin, const std::string_view & dest)
+{
+    clear();
+    if (queuesNum == 0U)
+    {
+        return false;
+    }
+    queues.reset(new (std::nothrow) TQueue [queuesNum]);
+    if (queues == nullptr)
+    {
+        return false;
+    }
+    this->queuesNum = queuesNum;
+    this->origin = origin;
+    this->dest = dest;
+    return true;
+}
+
+//===================================================================================================================================
+
+void TCopyQueues::clear()
+{
+    finishScan();
+    queues.reset();
+    queuesNum = 0U;
+    stolenTasksNum.store(0U);
+    pendingTasksNum.store(0U);
+    origin.clear();
+    dest.clear();
+}
+
+//===================================================================================================================================
+
+void TCopyQueues::push(const uint32_t queue, TCopyTask && task)
+{
+    if (queue < queuesNum)
+    {
+        pendingTasksNum++; // Before the push, so the counter never goes below the real tasks number
+        {
+            const std::lock_guard<std::mutex> lock(queues[queue].mutex);
+            queues[queue].tasks.push_back(std::move(task));
+        }
+        if (scanning)
+        {
+            // Taking the wait mutex avoids a lost wake up between the waiter check and its sleep
+            { const std::lock_guard<std::mutex> lock(waitMutex); }
+            taskPushed.notify_one();
+        }
+    }
+}
+
+//===================================================================================================================================
+
+bool TCopyQueues::pop(const uint32_t queue, TCopyTask & task)
+{
+    if (queue >= queuesNum)
+    {
+        return false;
+    }
+    while (!tryPop(queue, task))
+    {
+        if (!scanning)
+        {
+            // The last tasks could be pushed right before the scan end
+            return tryPop(queue, task);
+        }
+        std::unique_lock<std::mutex> lock(waitMutex);
+        taskPushed.wait(lock, [this]() { return pendingTasksNum != 0U || !scanning; });
+    }
+    return true;
+}
+
+//===================================================================================================================================
+
+bool TCopyQueues::tryPop(const uint32_t queue, TCopyTask & task)
+{
+    if (queue >= queuesNum)
+    {
+        return false;
+    }
+    {
+        const std::lock_guard<std::mutex> lock(queues[queue].mutex);
+        auto & tasks = queues[queue].tasks;
+        if (!tasks.empty())
+        {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            pendingTasksNum--;
+            return true;
+        }
+    }
+    if (steal(queue, task))
+    {
+        pendingTasksNum--;
+        return true;
+    }
+    return false;
+}
+
+//===================================================================================================================================
+
+void TCopyQueues::startScan()
+{
+    scanning.store(true);
+}
+
+//===================================================================================================================================
+
+void TCopyQueues::finishScan()
+{
+    {
+        const std::lock_guard<std::mutex> lock(waitMutex);
+        scanning.store(false);
+    }
+    taskPushed.notify_all();
+}
+
+//===================================================================================================================================
+
+bool TCopyQueues::steal(const uint32_t thief, TCopyTask & task)
+{
+    // Take a half of the first non empty victim to not come back for every small file
+    for (uint32_t i = 1U; i < queuesNum; i++)
+    {
+        const uint32_t victim = (thief + i) % queuesNum;
+        std::deque<TCopyTask> loot;
+        {
+            const std::lock_guard<std::mutex> lock(queues[victim].mutex);
+            auto & tasks = queues[victim].tasks;
+            const size_t lootSize = (tasks.size() + 1U) / 2U;
+            for (size_t j = 0U; j < lootSize; j++)
+            {
+                loot.push_front(std::move(tasks.back()));
+                tasks.pop_back();
+            }
+        }
+        if (!loot.empty())
+        {
+            stolenTasksNum += loot.size();
+            task = std::move(loot.front());
+            loot.pop_front();
+            if (!loot.empty())
+            {
+                const std::lock_guard<std::mutex> lock(queues[thief].mutex);
+                auto & tasks = queues[thief].tasks;
+                for (auto & stolenTask : loot)
+                {
+                    tasks.push_back(std::move(stolenTask));
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+//===================================================================================================================================
+
+uint64_t TCopyQueues::getTasksNum(const uint32_t queue) const
+{
+    if (queue >= queuesNum)
+    {
+        return 0U;
+    }
+    const std::lock_guard<std::mutex> lock(queues[queue].mutex);
+    return queues[queue].tasks.size();
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
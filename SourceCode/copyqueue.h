@@ -0,0 +1,197 @@
+#ifndef COPYQUEUE_H
+#define COPYQUEUE_H
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+#include <system_error>
+#include <filesystem>
+
+namespace CopyLib {
+
+    // File metadata taken once by the scan and carried to the workers with the task
+    struct TFileStat
+    {
+        std::filesystem::file_type type{ std::filesystem::file_type::none }; // Symlinks are followed
+        uint64_t size{ 0U };
+        int64_t mtime{ 0 };  // Last write time, ns since the file clock epoch
+        uint32_t mode{ 0U }; // Permission bits
+    };
+
+    // Shared state of a big file copied by several workers at once, one task per byte range
+    struct TSplitFile
+    {
+        uint64_t size{ 0U };                   // Full file size
+        uint32_t mode{ 0U };                   // Permission bits of the destination
+        uint32_t deltaBlockSize{ 0U };         // Not 0: the destination is updated in place, see deltaCopyFile
+        uint32_t directBlockSize{ 0U };        // Not 0: ranges bypass the page cache, see directCopyFile
+        bool keepContent{ false };             // The destination is not truncated: delta ranges or a resumed file
+        std::atomic<uint32_t> rangesLeft{ 0U };
+        std::atomic<bool> failed{ false };
+        std::once_flag prepared;               // Destination is created with the full size by the first range
+        std::error_code prepareCode;
+
+        // Cancel: ranges of a file canceled by one of them are not copied, the last range in flight removes the file
+        std::atomic<uint32_t> rangesActive{ 0U };
+        std::atomic<bool> started{ false };      // A range was copied, the destination is ours to remove
+        std::atomic<bool> canceled{ false };
+        std::atomic<uint64_t> countedSize{ 0U }; // Added to the copied size by the ranges, not taken back yet
+        std::atomic<bool> removed{ false };
+
+        // True for the last landed range, the file is done then. failed tells if any range was not copied.
+        bool finishRange(const bool success)
+        {
+            if (!success)
+            {
+                failed.store(true);
+            }
+            return --rangesLeft == 0U;
+        }
+
+        // A range starts, false if the file is canceled already and the range is not copied
+        bool startRange()
+        {
+            rangesActive++;
+            if (canceled.load())
+            {
+                return false;
+            }
+            started.store(true);
+            return true;
+        }
+
+        // A range landing after the job cancel cancels the file unless it is the last one, the queued rest is never copied
+        bool isCanceled(const bool jobCanceled) const
+        {
+            return canceled.load() || (jobCanceled && rangesLeft.load() > 1U);
+        }
+
+        // A range leaves with the bytes it added to the copied size. For a canceled file returns the bytes of its ranges
+        // to take back, lastRange is set for the one range removing the file: the last in flight.
+        uint64_t leaveRange(const uint64_t counted, bool & lastRange)
+        {
+            countedSize += counted;
+            const bool idle = (--rangesActive == 0U);
+            lastRange = false;
+            if (!canceled.load())
+            {
+                return 0U;
+            }
+            lastRange = idle && started.load() && !removed.exchange(true);
+            return countedSize.exchange(0U);
+        }
+    };
+
+    // Dedup mode: a file with the same content as a copied one, its destination is linked to the copy
+    struct TDuplicate
+    {
+        std::string file; // Path relative to the origin dir
+        TFileStat stat;
+        uint64_t journalIndex{ 0U };
+    };
+
+    // One file or one byte range of a split file to copy
+    struct TCopyTask
+    {
+        TCopyTask() { }
+        TCopyTask(std::string && file, const uint64_t size)
+            : file(std::move(file)), size(size), stat{ std::filesystem::file_type::regular, size } { }
+        TCopyTask(std::string && file, const TFileStat & stat)
+            : file(std::move(file)), size(stat.size), stat(stat) { }
+        TCopyTask(std::string && file, const TFileStat & stat, const uint64_t offset, const uint64_t size, std::shared_ptr<TSplitFile> split)
+            : file(std::move(file)), size(size), offset(offset), stat(stat), split(std::move(split)) { }
+
+        std::string file;      // Path relative to the origin dir
+        uint64_t size{ 0U };   // Bytes to copy by this task
+        uint64_t offset{ 0U }; // Range start for a split file
+        TFileStat stat;        // Of the whole file, so workers do not stat the origin again
+        uint64_t journalIndex{ 0U }; // Plan record of the file, see TJournal
+        std::shared_ptr<TSplitFile> split; // Not null for a range of a split file
+        std::shared_ptr<std::vector<TDuplicate>> duplicates; // Dedup mode: linked when the file is copied
+    };
+
+    //===================================================================================================================================
+
+    // In-memory copy plan singleton. Every worker owns a deque and takes tasks from its front,
+    // when the own deque is drained the worker steals a half of another deque from its back.
+    // In streaming mode the scanner pushes tasks while workers copy, workers wait for new tasks until the scan is finished.
+    class TCopyQueues
+    {
+    public:
+
+        static TCopyQueues & getInstance()
+        {
+            static TCopyQueues queues;
+            return queues;
+        }
+
+        bool reset(const uint32_t queuesNum, const std::string_view & origin, const std::string_view & dest);
+
+        void clear();
+
+        void push(const uint32_t queue, TCopyTask && task);
+
+        // Own queue first, then stealing. False if all the queues are empty and the scan is not running.
+        bool pop(const uint32_t queue, TCopyTask & task);
+
+        // Never waits for the scanner, for workers having other work in flight
+        bool tryPop(const uint32_t queue, TCopyTask & task);
+
+        // Streaming mode: pop waits for tasks between startScan and finishScan
+        void startScan();
+
+        void finishScan();
+
+        bool isScanning() const { return scanning; }
+
+        uint32_t getQueuesNum() const { return queuesNum; }
+
+        uint64_t getTasksNum(const uint32_t queue) const;
+
+        uint64_t getStolenTasksNum() const { return stolenTasksNum; }
+
+        const std::string & getOrigin() const { return origin; }
+
+        const std::string & getDest() const { return dest; }
+
+    private:
+
+        TCopyQueues() { }
+        ~TCopyQueues() { }
+        TCopyQueues(const TCopyQueues & queues) = delete;
+        TCopyQueues operator=(const TCopyQueues & queues) = delete;
+
+        bool steal(const uint32_t thief, TCopyTask & task);
+
+        // Own cache line for every queue to avoid false sharing of the mutexes
+        struct alignas(64) TQueue
+        {
+            mutable std::mutex mutex;
+            std::deque<TCopyTask> tasks;
+        };
+
+        std::unique_ptr<TQueue[]> queues;
+        uint32_t queuesNum{ 0U };
+        std::atomic<uint64_t> stolenTasksNum{ 0U };
+
+        // Waiting for the scanner in streaming mode
+        std::atomic<bool> scanning{ false };
+        std::atomic<uint64_t> pendingTasksNum{ 0U };
+        std::mutex waitMutex;
+        std::condition_variable taskPushed;
+        std::string origin;
+        std::string dest;
+
+    }; // TCopyQueues
+
+    //===================================================================================================================================
+
+} // namespace CopyLib
+
+#endif // COPYQUEUE_H
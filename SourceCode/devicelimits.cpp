@@ -0,0 +1,112 @@
+
+#include "devicelimits.h"
+
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+
+#if defined(__linux__)
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace CopyLib {
+
+//===================================================================================================================================
+
+TDeviceInfo getDeviceInfo(const std::string & path)
+{
+    TDeviceInfo info;
+#if defined(__linux__)
+    struct stat st{};
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        return info;
+    }
+    info.id = static_cast<uint64_t>(st.st_dev);
+    info.valid = true;
+
+    // /sys/dev/block/MAJOR:MINOR links to the device, a partition is a subdirectory of its disk
+    std::error_code code;
+    const std::string link = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+    fs::path device = fs::canonical(link, code);
+    if (code)
+    {
+        return info; // No block device behind: tmpfs, NFS, overlay and so on
+    }
+    if (fs::exists(device / "partition", code))
+    {
+        device = device.parent_path();
+    }
+    std::ifstream fin(device / "queue" / "rotational");
+    uint32_t rotational{ 0U };
+    if (fin >> rotational)
+    {
+        info.name = device.filename().string();
+        info.rotational = (rotational != 0U);
+        info.known = true;
+    }
+#else
+    (void)path; // Not detected, the solid state limit is used
+#endif
+    return info;
+}
+
+//===================================================================================================================================
+
+void TDeviceLimits::configure(const TDeviceInfo & originDevice, const TDeviceInfo & destDevice,
+                              const uint32_t rotationalLimit, const uint32_t solidStateLimit)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    readLimit = originDevice.rotational ? rotationalLimit : solidStateLimit;
+    writeLimit = destDevice.rotational ? rotationalLimit : solidStateLimit;
+    // Paths failed to stat are not compared, their ids are all zero
+    sameDevice = (originDevice.valid && destDevice.valid && originDevice.id == destDevice.id)
+              || (originDevice.known && destDevice.known && originDevice.name == destDevice.name);
+    if (sameDevice)
+    {
+        readLimit = writeLimit; // One device serves both
+    }
+    reads = writes = 0U;
+}
+
+//===================================================================================================================================
+
+bool TDeviceLimits::acquire(const std::atomic<bool>& copyCancel)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    const auto isFree = [this]()
+    {
+        return (readLimit == 0U || reads < readLimit) && (sameDevice || writeLimit == 0U || writes < writeLimit);
+    };
+    // Both slots are taken at once, a worker never holds one of them waiting for the other
+    while (!isFree())
+    {
+        if (copyCancel)
+        {
+            return false;
+        }
+        slotReleased.wait_for(lock, std::chrono::milliseconds(100)); // copyCancel is not notified
+    }
+    reads++;
+    writes += sameDevice ? 0U : 1U;
+    return true;
+}
+
+//===================================================================================================================================
+
+void TDeviceLimits::release()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        reads--;
+        writes -= sameDevice ? 0U : 1U;
+    }
+    slotReleased.notify_one();
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
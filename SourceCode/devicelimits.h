@@ -0,0 +1,102 @@
+#ifndef DEVICELIMITS_H
+#define DEVICELIMITS_H
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // Block device a path is stored on
+    struct TDeviceInfo
+    {
+        uint64_t id{ 0U };      // st_dev
+        bool valid{ false };    // The path is stat'ed, id is set
+        std::string name;       // Whole disk name from /sys/block, empty if not known
+        bool rotational{ false };
+        bool known{ false };    // False for network, virtual file systems and other platforms
+    };
+
+    // Finds the device of the path by st_dev, a partition is resolved to its disk for the queue/rotational flag
+    TDeviceInfo getDeviceInfo(const std::string & path);
+
+    //===================================================================================================================================
+
+    // In-flight limits of the copy engine per device: a worker holds a read slot of the origin device and a write slot
+    // of the destination one while it copies a file or a range. When both are on one device a single slot is taken.
+    // A disk head serves a few requests well, a flash device needs many of them in flight to reach its speed.
+    class TDeviceLimits
+    {
+    public:
+
+        static TDeviceLimits & getInstance()
+        {
+            static TDeviceLimits limits;
+            return limits;
+        }
+
+        // A new job. 0 limits disable the limiting.
+        void configure(const TDeviceInfo & originDevice, const TDeviceInfo & destDevice,
+                       const uint32_t rotationalLimit, const uint32_t solidStateLimit);
+
+        // Waits for the slots, false if the copy is canceled meanwhile
+        bool acquire(const std::atomic<bool>& copyCancel);
+
+        void release();
+
+        uint32_t getReadLimit() const { return readLimit; }
+
+        uint32_t getWriteLimit() const { return writeLimit; }
+
+        bool isSameDevice() const { return sameDevice; }
+
+    private:
+
+        TDeviceLimits() { }
+        ~TDeviceLimits() { }
+        TDeviceLimits(const TDeviceLimits & limits) = delete;
+        TDeviceLimits operator=(const TDeviceLimits & limits) = delete;
+
+        std::mutex mutex;
+        std::condition_variable slotReleased;
+        uint32_t readLimit{ 0U };   // 0 is no limit
+        uint32_t writeLimit{ 0U };
+        uint32_t reads{ 0U };       // Slots taken
+        uint32_t writes{ 0U };
+        bool sameDevice{ false };
+
+    }; // TDeviceLimits
+
+    //===================================================================================================================================
+
+    // Holds the device slots for the scope
+    class TDeviceSlot
+    {
+    public:
+
+        explicit TDeviceSlot(const std::atomic<bool>& copyCancel) : acquired(TDeviceLimits::getInstance().acquire(copyCancel)) { }
+
+        ~TDeviceSlot()
+        {
+            if (acquired)
+            {
+                TDeviceLimits::getInstance().release();
+            }
+        }
+
+        TDeviceSlot(const TDeviceSlot & slot) = delete;
+        TDeviceSlot operator=(const TDeviceSlot & slot) = delete;
+
+        bool isAcquired() const { return acquired; }
+
+    private:
+
+        const bool acquired;
+
+    }; // TDeviceSlot
+
+} // namespace CopyLib
+
+#endif // DEVICELIMITS_H
@@ -0,0 +1,323 @@
+
+#include "jobstats.h"
+
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+
+namespace CopyLib {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    int64_t toNs(const std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    // Upper bound of a latency bucket in microseconds
+    uint64_t getBucketBoundUs(const size_t bucket)
+    {
+        return 2ULL << bucket;
+    }
+
+    std::string formatSeconds(const uint64_t ns)
+    {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(6) << ns / 1e9;
+        return out.str();
+    }
+
+}; // namespace
+
+//===================================================================================================================================
+
+uint64_t TJobStats::THistogram::getCount() const
+{
+    uint64_t count{ 0U };
+    for (const auto & bucket : buckets)
+    {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+//===================================================================================================================================
+
+void TJobStats::reset(const uint32_t workersNum)
+{
+    for (auto & phase : phases)
+    {
+        phase.begin.store(INT64_MAX);
+        phase.end.store(INT64_MIN);
+        phase.busy.store(0);
+    }
+    workers.reset(new TWorkerStats[workersNum]);
+    this->workersNum = workersNum;
+}
+
+//===================================================================================================================================
+
+void TJobStats::addPhase(const EJobPhase phase, const std::chrono::steady_clock::time_point begin,
+                         const std::chrono::steady_clock::time_point end)
+{
+    auto & times = phases[static_cast<size_t>(phase)];
+    const int64_t beginNs = toNs(begin);
+    const int64_t endNs = toNs(end);
+    // Written only when moved, the verifiers add a phase interval per file
+    int64_t current = times.begin.load(std::memory_order_relaxed);
+    while (beginNs < current && !times.begin.compare_exchange_weak(current, beginNs, std::memory_order_relaxed)) { }
+    current = times.end.load(std::memory_order_relaxed);
+    while (endNs > current && !times.end.compare_exchange_weak(current, endNs, std::memory_order_relaxed)) { }
+    times.busy.fetch_add(endNs - beginNs, std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+void TJobStats::addFile(const uint32_t worker, const uint64_t size, const std::chrono::nanoseconds latency)
+{
+    if (worker >= workersNum)
+    {
+        return;
+    }
+    auto & histogram = workers[worker].latency[getSizeClass(size)];
+    histogram.buckets[getLatencyBucket(latency)].fetch_add(1U, std::memory_order_relaxed);
+    histogram.sumNs.fetch_add(static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)), std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+void TJobStats::addQueueWait(const uint32_t worker, const std::chrono::nanoseconds wait)
+{
+    if (worker >= workersNum)
+    {
+        return;
+    }
+    auto & histogram = workers[worker].queueWait;
+    histogram.buckets[getLatencyBucket(wait)].fetch_add(1U, std::memory_order_relaxed);
+    histogram.sumNs.fetch_add(static_cast<uint64_t>(std::max<int64_t>(wait.count(), 0)), std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+std::chrono::nanoseconds TJobStats::getPhaseWall(const EJobPhase phase) const
+{
+    const auto & times = phases[static_cast<size_t>(phase)];
+    const int64_t begin = times.begin.load(std::memory_order_relaxed);
+    const int64_t end = times.end.load(std::memory_order_relaxed);
+    return std::chrono::nanoseconds(end >= begin ? end - begin : 0);
+}
+
+//===================================================================================================================================
+
+std::chrono::nanoseconds TJobStats::getPhaseBusy(const EJobPhase phase) const
+{
+    return std::chrono::nanoseconds(phases[static_cast<size_t>(phase)].busy.load(std::memory_order_relaxed));
+}
+
+//===================================================================================================================================
+
+uint64_t TJobStats::getFileNum(const uint32_t worker, const size_t sizeClass, const size_t bucket) const
+{
+    if (worker >= workersNum || sizeClass >= sizeClassesNum || bucket >= latencyBucketsNum)
+    {
+        return 0U;
+    }
+    return workers[worker].latency[sizeClass].buckets[bucket].load(std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+uint64_t TJobStats::getQueueWaitNum(const uint32_t worker, const size_t bucket) const
+{
+    if (worker >= workersNum || bucket >= latencyBucketsNum)
+    {
+        return 0U;
+    }
+    return workers[worker].queueWait.buckets[bucket].load(std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+size_t TJobStats::getSizeClass(const uint64_t size)
+{
+    size_t sizeClass{ 0U };
+    for (uint64_t bound = 4ULL << 10U; size >= bound && sizeClass < sizeClassesNum - 1U; bound <<= 4U)
+    {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+//===================================================================================================================================
+
+size_t TJobStats::getLatencyBucket(const std::chrono::nanoseconds latency)
+{
+    uint64_t us = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)) / 1000U;
+    size_t bucket{ 0U };
+    while ((us >>= 1U) != 0U && bucket < latencyBucketsNum - 1U)
+    {
+        bucket++;
+    }
+    return bucket;
+}
+
+//===================================================================================================================================
+
+const char * TJobStats::getPhaseName(const EJobPhase phase)
+{
+    switch (phase)
+    {
+        case EJobPhase::Scan:   return "scan";
+        case EJobPhase::Mkdir:  return "mkdir";
+        case EJobPhase::Copy:   return "copy";
+        case EJobPhase::Verify: return "verify";
+        default:                return "unknown";
+    }
+}
+
+//===================================================================================================================================
+
+const char * TJobStats::getSizeClassName(const size_t sizeClass)
+{
+    static const char * const names[sizeClassesNum]{ "lt4k", "lt64k", "lt1m", "lt16m", "lt256m", "ge256m" };
+    return sizeClass < sizeClassesNum ? names[sizeClass] : "unknown";
+}
+
+//===================================================================================================================================
+
+std::string TJobStats::toJson() const
+{
+    const auto writeHistogram = [](std::ostringstream & out, const THistogram & histogram)
+    {
+        out << "{\"count\":" << histogram.getCount() << ",\"sum_sec\":" << formatSeconds(histogram.sumNs.load(std::memory_order_relaxed)) << ",\"buckets\":[";
+        for (size_t i = 0U; i < latencyBucketsNum; i++)
+        {
+            out << (i == 0U ? "" : ",") << histogram.buckets[i].load(std::memory_order_relaxed);
+        }
+        out << "]}";
+    };
+
+    std::ostringstream out;
+    out << "{\"phases\":{";
+    for (size_t i = 0U; i < static_cast<size_t>(EJobPhase::Count); i++)
+    {
+        const auto phase = static_cast<EJobPhase>(i);
+        out << (i == 0U ? "" : ",") << "\"" << getPhaseName(phase) << "\":{\"wall_sec\":" << formatSeconds(getPhaseWall(phase).count())
+            << ",\"busy_sec\":" << formatSeconds(getPhaseBusy(phase).count()) << "}";
+    }
+    out << "},\"bucket_le_us\":[";
+    for (size_t i = 0U; i + 1U < latencyBucketsNum; i++) // The last bucket has no bound
+    {
+        out << (i == 0U ? "" : ",") << getBucketBoundUs(i);
+    }
+    out << "],\"workers\":[";
+    for (uint32_t worker = 0U; worker < workersNum; worker++)
+    {
+        out << (worker == 0U ? "" : ",") << "{\"worker\":" << worker << ",\"queue_wait\":";
+        writeHistogram(out, workers[worker].queueWait);
+        out << ",\"latency\":{";
+        for (size_t sizeClass = 0U; sizeClass < sizeClassesNum; sizeClass++)
+        {
+            out << (sizeClass == 0U ? "" : ",") << "\"" << getSizeClassName(sizeClass) << "\":";
+            writeHistogram(out, workers[worker].latency[sizeClass]);
+        }
+        out << "}}";
+    }
+    out << "]}\n";
+    return out.str();
+}
+
+//===================================================================================================================================
+
+std::string TJobStats::toPrometheus() const
+{
+    // Cumulative buckets, empty size classes are left out
+    const auto writeHistogram = [](std::ostringstream & out, const std::string & name, const std::string & labels, const THistogram & histogram)
+    {
+        uint64_t count{ 0U };
+        for (size_t i = 0U; i < latencyBucketsNum; i++)
+        {
+            count += histogram.buckets[i].load(std::memory_order_relaxed);
+            out << name << "_bucket{" << labels << ",le=\"";
+            if (i + 1U < latencyBucketsNum)
+            {
+                out << getBucketBoundUs(i) / 1e6;
+            }
+            else
+            {
+                out << "+Inf";
+            }
+            out << "\"} " << count << '\n';
+        }
+        out << name << "_sum{" << labels << "} " << formatSeconds(histogram.sumNs.load(std::memory_order_relaxed)) << '\n';
+        out << name << "_count{" << labels << "} " << count << '\n';
+    };
+
+    std::ostringstream out;
+    out << std::setprecision(10); // Bucket bounds are written exactly
+    out << "# HELP simplecopier_phase_seconds Wall time of a job phase, from its first start to its last end.\n"
+        << "# TYPE simplecopier_phase_seconds gauge\n";
+    for (size_t i = 0U; i < static_cast<size_t>(EJobPhase::Count); i++)
+    {
+        const auto phase = static_cast<EJobPhase>(i);
+        out << "simplecopier_phase_seconds{phase=\"" << getPhaseName(phase) << "\"} " << formatSeconds(getPhaseWall(phase).count()) << '\n';
+    }
+    out << "# HELP simplecopier_phase_busy_seconds Time of a job phase summed over its threads.\n"
+        << "# TYPE simplecopier_phase_busy_seconds gauge\n";
+    for (size_t i = 0U; i < static_cast<size_t>(EJobPhase::Count); i++)
+    {
+        const auto phase = static_cast<EJobPhase>(i);
+        out << "simplecopier_phase_busy_seconds{phase=\"" << getPhaseName(phase) << "\"} " << formatSeconds(getPhaseBusy(phase).count()) << '\n';
+    }
+    out << "# HELP simplecopier_file_latency_seconds Time to copy a file or a range of a split file.\n"
+        << "# TYPE simplecopier_file_latency_seconds histogram\n";
+    for (uint32_t worker = 0U; worker < workersNum; worker++)
+    {
+        for (size_t sizeClass = 0U; sizeClass < sizeClassesNum; sizeClass++)
+        {
+            if (workers[worker].latency[sizeClass].getCount() > 0U)
+            {
+                writeHistogram(out, "simplecopier_file_latency_seconds",
+                               "worker=\"" + std::to_string(worker) + "\",size=\"" + getSizeClassName(sizeClass) + "\"",
+                               workers[worker].latency[sizeClass]);
+            }
+        }
+    }
+    out << "# HELP simplecopier_queue_wait_seconds Time a worker waits for its next task.\n"
+        << "# TYPE simplecopier_queue_wait_seconds histogram\n";
+    for (uint32_t worker = 0U; worker < workersNum; worker++)
+    {
+        writeHistogram(out, "simplecopier_queue_wait_seconds", "worker=\"" + std::to_string(worker) + "\"", workers[worker].queueWait);
+    }
+    return out.str();
+}
+
+//===================================================================================================================================
+
+bool TJobStats::save(const std::string & path, const EStatsFormat format) const
+{
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream fout(tempPath, std::ios::trunc);
+        if (!fout.is_open())
+        {
+            return false;
+        }
+        fout << (format == EStatsFormat::Prometheus ? toPrometheus() : toJson());
+        if (!fout.good())
+        {
+            return false;
+        }
+    }
+    std::error_code code;
+    fs::rename(tempPath, path, code);
+    return !code;
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
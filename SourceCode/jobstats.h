@@ -0,0 +1,119 @@
+#ifndef JOBSTATS_H
+#define JOBSTATS_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace CopyLib {
+
+    enum class EJobPhase : uint32_t
+    {
+        Scan,   // Plan of createCopyQueues (walk, dedup hashing, balancing) or the streaming scanner
+        Mkdir,  // copyDirStructure, the streaming scanner creates dirs as a part of the scan
+        Copy,   // From the first worker start to the last worker end
+        Verify, // From the first verified file to the last one
+        Count
+    };
+
+    enum class EStatsFormat : uint32_t
+    {
+        Json,
+        Prometheus // Text exposition format, for a node exporter textfile collector
+    };
+
+    // Timing of the current job: the time of every phase and, for every worker, histograms of the time
+    // to copy a file (or a range of a split file) by its size class and of the time waiting for the next task.
+    // A worker only adds to its own cache line, the export may run at any time during the job.
+    class TJobStats
+    {
+    public:
+
+        static TJobStats & getInstance()
+        {
+            static TJobStats stats;
+            return stats;
+        }
+
+        // Size classes: < 4 KiB, < 64 KiB, < 1 MiB, < 16 MiB, < 256 MiB, the rest
+        static constexpr size_t sizeClassesNum{ 6U };
+
+        // Bucket i holds latencies below 2^(i+1) us (bucket 0 from 0), the last one holds the rest
+        static constexpr size_t latencyBucketsNum{ 24U };
+
+        // Zeroed stats for a job of workersNum workers, not while the workers run
+        void reset(const uint32_t workersNum);
+
+        // Adds the interval to the phase, several threads may take part in a phase
+        void addPhase(const EJobPhase phase, const std::chrono::steady_clock::time_point begin,
+                      const std::chrono::steady_clock::time_point end);
+
+        // A worker with an index out of range is not counted
+        void addFile(const uint32_t worker, const uint64_t size, const std::chrono::nanoseconds latency);
+        void addQueueWait(const uint32_t worker, const std::chrono::nanoseconds wait);
+
+        // From the first begin to the last end of the phase, 0 if it did not happen
+        std::chrono::nanoseconds getPhaseWall(const EJobPhase phase) const;
+
+        // Summed over the threads of the phase
+        std::chrono::nanoseconds getPhaseBusy(const EJobPhase phase) const;
+
+        uint32_t getWorkersNum() const { return workersNum; }
+
+        uint64_t getFileNum(const uint32_t worker, const size_t sizeClass, const size_t bucket) const;
+        uint64_t getQueueWaitNum(const uint32_t worker, const size_t bucket) const;
+
+        static size_t getSizeClass(const uint64_t size);
+        static size_t getLatencyBucket(const std::chrono::nanoseconds latency);
+
+        static const char * getPhaseName(const EJobPhase phase);
+        static const char * getSizeClassName(const size_t sizeClass);
+
+        std::string toJson() const;
+        std::string toPrometheus() const;
+
+        // Written to a temporary file and renamed, a reader never sees a half written file
+        bool save(const std::string & path, const EStatsFormat format) const;
+
+    private:
+
+        TJobStats() { }
+        ~TJobStats() { }
+        TJobStats(const TJobStats & stats) = delete;
+        TJobStats operator=(const TJobStats & stats) = delete;
+
+        struct THistogram
+        {
+            std::atomic<uint64_t> buckets[latencyBucketsNum];
+            std::atomic<uint64_t> sumNs{ 0U };
+
+            THistogram() { for (auto & bucket : buckets) { bucket.store(0U, std::memory_order_relaxed); } }
+            uint64_t getCount() const;
+        };
+
+        struct alignas(64) TWorkerStats
+        {
+            THistogram latency[sizeClassesNum];
+            THistogram queueWait;
+        };
+
+        // Steady clock ns, begin is the earliest one and end the latest one
+        struct TPhaseTimes
+        {
+            std::atomic<int64_t> begin{ INT64_MAX };
+            std::atomic<int64_t> end{ INT64_MIN };
+            std::atomic<int64_t> busy{ 0 };
+        };
+
+        TPhaseTimes phases[static_cast<size_t>(EJobPhase::Count)];
+        std::unique_ptr<TWorkerStats[]> workers;
+        uint32_t workersNum{ 0U };
+
+    }; // TJobStats
+
+} // namespace CopyLib
+
+#endif // JOBSTATS_H
@@ -0,0 +1,449 @@
+
+#include "journal.h"
+#include "tracer.h"
+
+#include <filesystem>
+#include <fstream>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace CopyLib {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    const std::string journalHeader{ "SimpleCopier journal 2" }; // A journal of version 1 has no dirs, its job is planned again
+    const std::string journalFileName{ ".simplecopier_journal" };
+
+    // Paths are the last field of a record, only the line end and the escape char are escaped
+    std::string escape(const std::string_view & path)
+    {
+        std::string escaped;
+        escaped.reserve(path.size());
+        for (const char ch : path)
+        {
+            if (ch == '\\')
+            {
+                escaped += "\\\\";
+            }
+            else if (ch == '\n')
+            {
+                escaped += "\\n";
+            }
+            else
+            {
+                escaped += ch;
+            }
+        }
+        return escaped;
+    }
+
+    std::string unescape(const std::string_view & escaped)
+    {
+        std::string path;
+        path.reserve(escaped.size());
+        for (size_t i = 0U; i < escaped.size(); i++)
+        {
+            if (escaped[i] == '\\' && i + 1U < escaped.size())
+            {
+                path += (escaped[++i] == 'n') ? '\n' : escaped[i];
+            }
+            else
+            {
+                path += escaped[i];
+            }
+        }
+        return path;
+    }
+
+}; // namespace
+
+//===================================================================================================================================
+
+std::string TJournal::getFileName(const std::string_view & dest)
+{
+    return (fs::path(dest) / journalFileName).string();
+}
+
+//===================================================================================================================================
+
+bool TJournal::load(const std::string_view & origin, const std::string_view & dest,
+                    std::vector<TJournalEntry> & entries, std::vector<std::string> & dirs, bool & dirsCreated) const
+{
+    entries.clear();
+    dirs.clear();
+    dirsCreated = false;
+    std::ifstream fin(getFileName(dest), std::ios::binary);
+    std::string line;
+    if (!fin.is_open() || !std::getline(fin, line) || line != journalHeader
+        || !std::getline(fin, line) || line.size() < 2U || line[0] != 'O' || unescape(std::string_view(line).substr(2U)) != origin)
+    {
+        return false;
+    }
+
+    bool planFinished{ false };
+    while (std::getline(fin, line))
+    {
+        if (fin.eof() || line.empty()) // The last record is torn if the job was killed during a write
+        {
+            break;
+        }
+        const char * pos = line.c_str() + 1;
+        char * end{ nullptr };
+        switch (line[0])
+        {
+            case 'F':
+            {
+                TJournalEntry entry;
+                entry.stat.type = fs::file_type::regular;
+                entry.stat.size = std::strtoull(pos, &end, 10);
+                entry.stat.mtime = std::strtoll(end, &end, 10);
+                entry.stat.mode = static_cast<uint32_t>(std::strtoul(end, &end, 10));
+                if (*end != ' ')
+                {
+                    return false;
+                }
+                entry.file = unescape(end + 1);
+                entries.push_back(std::move(entry));
+                break;
+            }
+            case 'D':
+                if (*pos != ' ')
+                {
+                    return false;
+                }
+                dirs.push_back(unescape(pos + 1));
+                break;
+            case 'E':
+                planFinished = true;
+                break;
+            case 'S':
+                dirsCreated = true;
+                break;
+            case 'C':
+            {
+                const uint64_t index = std::strtoull(pos, &end, 10);
+                if (index < entries.size())
+                {
+                    entries[index].done = true;
+                }
+                break;
+            }
+            case 'R':
+            {
+                const uint64_t index = std::strtoull(pos, &end, 10);
+                const uint64_t offset = std::strtoull(end, &end, 10);
+                if (index < entries.size())
+                {
+                    entries[index].doneRanges.push_back(offset);
+                }
+                break;
+            }
+            case 'P':
+            {
+                const uint64_t index = std::strtoull(pos, &end, 10);
+                const uint64_t size = std::strtoull(end, &end, 10);
+                if (index < entries.size())
+                {
+                    entries[index].partialSize = size;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return planFinished;
+}
+
+//===================================================================================================================================
+
+bool TJournal::create(const std::string_view & origin, const std::string_view & dest)
+{
+    close();
+    const std::lock_guard<std::mutex> lock(flushMutex);
+    fileName = getFileName(dest);
+    file = std::fopen(fileName.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    {
+        const std::lock_guard<std::mutex> bufferLock(mutex);
+        buffer = journalHeader + "\n" + "O " + escape(origin) + "\n";
+        bufferHasCompletions = false;
+        plannedNum = 0U;
+        doneNum = 0U;
+        planFinished = false;
+    }
+    opened.store(true);
+    startFlusher();
+    return true;
+}
+
+//===================================================================================================================================
+
+bool TJournal::resume(const std::string_view & dest, const uint64_t plannedNum, const uint64_t doneNum)
+{
+    close();
+    const std::lock_guard<std::mutex> lock(flushMutex);
+    fileName = getFileName(dest);
+    file = std::fopen(fileName.c_str(), "ab");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    {
+        const std::lock_guard<std::mutex> bufferLock(mutex);
+        buffer.clear();
+        bufferHasCompletions = false;
+        this->plannedNum = plannedNum;
+        this->doneNum = doneNum;
+        planFinished = true;
+    }
+    opened.store(true);
+    startFlusher();
+    return true;
+}
+
+//===================================================================================================================================
+
+uint64_t TJournal::addFile(const std::string_view & file, const TFileStat & stat)
+{
+    if (!opened)
+    {
+        return 0U;
+    }
+    const std::string record = "F " + std::to_string(stat.size) + " " + std::to_string(stat.mtime) + " "
+                             + std::to_string(stat.mode) + " " + escape(file) + "\n";
+    uint64_t index{ 0U };
+    bool flushNeeded{ false };
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        index = plannedNum++; // The record order is the index order
+        flushNeeded = push(record, false);
+    }
+    if (flushNeeded)
+    {
+        wake.notify_one();
+    }
+    return index;
+}
+
+//===================================================================================================================================
+
+void TJournal::addDir(const std::string_view & dir)
+{
+    if (opened)
+    {
+        append("D " + escape(dir) + "\n", false);
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::finishPlan()
+{
+    if (opened)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            planFinished = true;
+        }
+        append("E\n", false);
+        flush(true); // Resuming is possible from now on
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::dirsCreated()
+{
+    if (opened)
+    {
+        append("S\n", true);
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::fileDone(const uint64_t index)
+{
+    if (opened)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            doneNum++;
+        }
+        append("C " + std::to_string(index) + "\n", true);
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::rangeDone(const uint64_t index, const uint64_t offset)
+{
+    if (opened)
+    {
+        append("R " + std::to_string(index) + " " + std::to_string(offset) + "\n", true);
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::partialDone(const uint64_t index, const uint64_t size)
+{
+    if (opened)
+    {
+        append("P " + std::to_string(index) + " " + std::to_string(size) + "\n", true);
+    }
+}
+
+//===================================================================================================================================
+
+bool TJournal::close()
+{
+    if (!opened.exchange(false))
+    {
+        return false;
+    }
+    stopFlusher();
+    flush(true);
+    const std::lock_guard<std::mutex> lock(flushMutex);
+    std::fclose(file);
+    file = nullptr;
+    bool complete{ false };
+    {
+        const std::lock_guard<std::mutex> bufferLock(mutex);
+        complete = planFinished && doneNum >= plannedNum;
+    }
+    if (complete)
+    {
+        std::error_code code;
+        fs::remove(fileName, code);
+    }
+    return complete;
+}
+
+//===================================================================================================================================
+
+void TJournal::append(const std::string_view & record, const bool completion)
+{
+    bool flushNeeded{ false };
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        flushNeeded = push(record, completion);
+    }
+    if (flushNeeded)
+    {
+        wake.notify_one();
+    }
+}
+
+//===================================================================================================================================
+
+bool TJournal::push(const std::string_view & record, const bool completion)
+{
+    const bool below = buffer.size() < flushSize;
+    buffer += record;
+    bufferHasCompletions = bufferHasCompletions || completion;
+    const bool flushNeeded = below && buffer.size() >= flushSize; // Once, records kept by a failed sync wait for the interval
+    flushRequested = flushRequested || flushNeeded;
+    return flushNeeded;
+}
+
+//===================================================================================================================================
+
+void TJournal::startFlusher()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        flushRequested = false;
+        stopping = false;
+    }
+    flusher = std::thread(&TJournal::flushLoop, this);
+}
+
+//===================================================================================================================================
+
+void TJournal::stopFlusher()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (flusher.joinable())
+    {
+        flusher.join();
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::flushLoop()
+{
+    auto & tracer = TTracer::getInstance();
+    if (tracer.isRecording())
+    {
+        tracer.nameThread("journal");
+    }
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, flushInterval, [this]() { return stopping || flushRequested; });
+            if (stopping)
+            {
+                break;
+            }
+            flushRequested = false;
+        }
+        flush(false);
+    }
+}
+
+//===================================================================================================================================
+
+void TJournal::flush(const bool force)
+{
+    const std::lock_guard<std::mutex> lock(flushMutex);
+    std::string data;
+    bool completions{ false };
+    {
+        const std::lock_guard<std::mutex> bufferLock(mutex);
+        data.swap(buffer);
+        completions = bufferHasCompletions;
+        bufferHasCompletions = false;
+    }
+    if (file == nullptr || (data.empty() && !force))
+    {
+        return;
+    }
+#if defined(__linux__)
+    if (completions && (syncFailure || ::syncfs(fileno(file)) != 0)) // Data of the reported files is on the disk before the records
+    {
+        // The data may not be on the disk, the records are kept for the next flush
+        const std::lock_guard<std::mutex> bufferLock(mutex);
+        buffer.insert(0U, data);
+        bufferHasCompletions = true;
+        return;
+    }
+#endif
+    std::fwrite(data.data(), 1U, data.size(), file);
+    std::fflush(file);
+#if defined(__linux__)
+    if (completions || force)
+    {
+        ::fdatasync(fileno(file));
+    }
+#endif
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
@@ -0,0 +1,133 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+#include "copyqueue.h"
+
+namespace CopyLib {
+
+    // A planned file of an interrupted job
+    struct TJournalEntry
+    {
+        std::string file; // Path relative to the origin dir
+        TFileStat stat;
+        bool done{ false };
+        std::vector<uint64_t> doneRanges; // Offsets of landed ranges of a split file
+        uint64_t partialSize{ 0U };       // Landed prefix of a canceled file kept in the destination
+    };
+
+    //===================================================================================================================================
+
+    // Append-only checkpoint journal of a copy job, kept in the destination dir. It holds the plan (every file with its stat)
+    // and records of completed files and ranges, so an interrupted job is resumed without a rescan.
+    // Records are buffered and written by a flusher thread every flushInterval or when flushSize is buffered, so the copy
+    // threads never wait for the disk. The destination filesystem is synced before completion records are written, so
+    // a record never outlives the data it reports, even after a power loss. If the sync fails the records stay buffered.
+    // Text format, one record per line, paths are escaped:
+    //   SimpleCopier journal 2 / O <origin> / D <path> ... (planned dir) / F <size> <mtime> <mode> <path> ... / E (plan is complete)
+    //   S (dirs are created)
+    //   C <file index> (file is copied) / R <file index> <offset> (range is copied) / P <file index> <size> (prefix is copied)
+    class TJournal
+    {
+    public:
+
+        static TJournal & getInstance()
+        {
+            static TJournal journal;
+            return journal;
+        }
+
+        static std::string getFileName(const std::string_view & dest);
+
+        // Reads the journal of an interrupted job copying the same origin. False if there is no journal,
+        // it is for other origin or its plan is not complete.
+        bool load(const std::string_view & origin, const std::string_view & dest,
+                  std::vector<TJournalEntry> & entries, std::vector<std::string> & dirs, bool & dirsCreated) const;
+
+        // Starts a new journal, an old one is overwritten
+        bool create(const std::string_view & origin, const std::string_view & dest);
+
+        // Continues the journal read by load, plannedNum files were planned and doneNum of them are copied
+        bool resume(const std::string_view & dest, const uint64_t plannedNum, const uint64_t doneNum);
+
+        bool isOpen() const { return opened; }
+
+        // Plan record, returns the file index for the completion records
+        uint64_t addFile(const std::string_view & file, const TFileStat & stat);
+
+        // Plan record of a dir to create, path relative to the origin dir
+        void addDir(const std::string_view & dir);
+
+        void finishPlan();
+
+        void dirsCreated();
+
+        void fileDone(const uint64_t index);
+
+        void rangeDone(const uint64_t index, const uint64_t offset);
+
+        // A canceled file kept with the first size bytes copied, the resumed job copies the rest only
+        void partialDone(const uint64_t index, const uint64_t size);
+
+        // Flushes and closes. The journal is removed when every planned file is copied.
+        // Returns true if the job is complete.
+        bool close();
+
+        // Tests: the sync before completion records fails, as on a destination losing the data
+        void setSyncFailure(const bool fail) { syncFailure.store(fail); }
+
+    private:
+
+        TJournal() { }
+        ~TJournal() { close(); }
+        TJournal(const TJournal & journal) = delete;
+        TJournal operator=(const TJournal & journal) = delete;
+
+        void append(const std::string_view & record, const bool completion);
+
+        // Buffers a record, the mutex is held. Returns true if the flusher is to be woken.
+        bool push(const std::string_view & record, const bool completion);
+
+        void startFlusher();
+        void stopFlusher();
+
+        // Flusher thread
+        void flushLoop();
+
+        // Writes the buffered records. Completion records wait for the destination data to reach the disk.
+        void flush(const bool force);
+
+        const std::chrono::milliseconds flushInterval{ 2000 };
+        const size_t flushSize{ 1U << 20U };
+
+        std::atomic<bool> opened{ false };
+        std::atomic<bool> syncFailure{ false }; // See setSyncFailure
+        std::mutex mutex;        // Buffer, counters and the flusher state
+        std::mutex flushMutex;   // File writes, one flushing thread at a time
+        std::condition_variable wake;
+        bool flushRequested{ false }; // flushSize is reached
+        bool stopping{ false };
+        std::thread flusher;
+        std::FILE * file{ nullptr };
+        std::string fileName;
+        std::string buffer;
+        bool bufferHasCompletions{ false };
+        uint64_t plannedNum{ 0U };
+        uint64_t doneNum{ 0U };
+        bool planFinished{ false };
+
+    }; // TJournal
+
+} // namespace CopyLib
+
+#endif // JOURNAL_H
@@ -0,0 +1,167 @@
+
+#include "logger.h"
+#include "tracer.h"
+
+#include <chrono>
+
+namespace CopyLib {
+
+namespace {
+
+    const auto writeInterval = std::chrono::milliseconds(20); // Longest a message waits in the ring when producers do not wake the writer
+
+}; // namespace
+
+//===================================================================================================================================
+
+TLogger::TLogger() : ring(new TSlot[ringCapacity])
+{
+    for (size_t i = 0U; i < ringCapacity; i++)
+    {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+//===================================================================================================================================
+
+bool TLogger::logMessage(const std::string_view & message)
+{
+    if (message.empty() || !logging.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    // Bounded MPMC ring of D. Vyukov, the writer is its only consumer
+    size_t position = pushPosition.load(std::memory_order_relaxed);
+    TSlot * slot{ nullptr };
+    while (true)
+    {
+        slot = &ring[position & (ringCapacity - 1U)];
+        const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+        if (diff == 0)
+        {
+            if (pushPosition.compare_exchange_weak(position, position + 1U, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0) // Full, the writer is behind
+        {
+            droppedNum.fetch_add(1U, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            position = pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+    slot->message.assign(message.data(), message.size());
+    slot->sequence.store(position + 1U, std::memory_order_release);
+
+    if (position - popPositionHint.load(std::memory_order_relaxed) >= ringCapacity / 2U)
+    {
+        wake.notify_one(); // Half full, do not wait for the interval
+    }
+    return true;
+}
+
+//===================================================================================================================================
+
+void TLogger::startLogging()
+{
+    const std::lock_guard<std::mutex> lock(controlMutex);
+    if (fout.is_open())
+    {
+        return;
+    }
+    fout.open(logFileName);
+    logMessageNum = 1U;
+    droppedNum.store(0U);
+    std::string message;
+    while (pop(message)) { } // Late messages of the previous log
+    stopping = false;
+    logging.store(true, std::memory_order_release);
+    writer = std::thread(&TLogger::write, this);
+}
+
+//===================================================================================================================================
+
+void TLogger::finishLogging()
+{
+    const std::lock_guard<std::mutex> lock(controlMutex);
+    if (!fout.is_open())
+    {
+        return;
+    }
+    logging.store(false, std::memory_order_release);
+    {
+        const std::lock_guard<std::mutex> wakeLock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+
+    std::string message;
+    while (pop(message)) // Pushed by producers which saw the log open
+    {
+        fout << logMessageNum++ << ": " << message << '\n';
+    }
+    if (droppedNum > 0U)
+    {
+        fout << logMessageNum++ << ": " << "Warning! " << droppedNum << " messages were dropped, the log was written slower than they came." << '\n';
+    }
+    fout.close();
+}
+
+//===================================================================================================================================
+
+bool TLogger::pop(std::string & message)
+{
+    TSlot & slot = ring[popPosition & (ringCapacity - 1U)];
+    if (slot.sequence.load(std::memory_order_acquire) != popPosition + 1U)
+    {
+        return false; // Empty or the producer is still copying the message
+    }
+    message.swap(slot.message);
+    slot.sequence.store(popPosition + ringCapacity, std::memory_order_release);
+    popPosition++;
+    popPositionHint.store(popPosition, std::memory_order_relaxed);
+    return true;
+}
+
+//===================================================================================================================================
+
+void TLogger::write()
+{
+    auto & tracer = TTracer::getInstance();
+    if (tracer.isRecording())
+    {
+        tracer.nameThread("logger");
+    }
+    std::string message;
+    while (true)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t firstNum = logMessageNum;
+        while (pop(message))
+        {
+            fout << logMessageNum++ << ": " << message << '\n';
+        }
+        if (logMessageNum != firstNum)
+        {
+            fout.flush(); // Once per batch
+            tracer.addSpan("log write", "log", start, std::chrono::steady_clock::now(), std::to_string(logMessageNum - firstNum) + " messages");
+        }
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        if (stopping)
+        {
+            break;
+        }
+        wake.wait_for(lock, writeInterval);
+    }
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
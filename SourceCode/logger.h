@@ -0,0 +1,82 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <fstream>
+#include <memory>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // Asynchronous log: logMessage puts the message into a bounded lock-free ring (many producers, one consumer)
+    // and returns, a writer thread takes them in batches and flushes the file once per batch. Workers do not wait
+    // for each other nor for the disk even when every file fails. When the ring is full a message is dropped
+    // and counted, the number is written to the log when logging is finished.
+    class TLogger
+    {
+    public:
+
+        static TLogger & getInstance()
+        {
+            static TLogger logger;
+            return logger;
+        }
+
+        // False for an empty message, when logging is not started or the message is dropped
+        bool logMessage(const std::string_view & message);
+
+        // Opens the log file and starts the writer
+        void startLogging();
+
+        // Writes all the queued messages and closes the log file
+        void finishLogging();
+
+        std::string getLogFileName() const { return logFileName; }
+
+        // Dropped since startLogging
+        uint64_t getDroppedNum() const { return droppedNum; }
+
+        static constexpr size_t ringCapacity{ 4096U }; // Power of 2
+
+    private:
+
+        TLogger();
+        ~TLogger() { finishLogging(); }
+        TLogger(const TLogger & log) = delete;
+        TLogger operator=(const TLogger & log) = delete;
+
+        struct TSlot
+        {
+            std::atomic<size_t> sequence{ 0U }; // == position: free for it, == position + 1: holds its message
+            std::string message;
+        };
+
+        bool pop(std::string & message);
+        void write();
+
+        std::unique_ptr<TSlot[]> ring;
+        alignas(64) std::atomic<size_t> pushPosition{ 0U }; // Producers, not sharing a cache line with the consumer
+        alignas(64) size_t popPosition{ 0U };               // Writer thread only
+        std::atomic<size_t> popPositionHint{ 0U };          // popPosition for the producers to see the fill level
+        alignas(64) std::atomic<bool> logging{ false };
+        std::atomic<uint64_t> droppedNum{ 0U };
+
+        std::mutex controlMutex; // start/finish, never taken by logMessage
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        bool stopping{ false };
+        std::thread writer;
+        std::ofstream fout;
+        const std::string logFileName{"simpleCopyLog.txt"};
+        uint64_t logMessageNum{ 1U };
+
+    }; // TLogger
+
+} // namespace CopyLib
+
+#endif // LOGGER_H
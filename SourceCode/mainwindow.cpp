@@ -22,6 +22,7 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "copylib.h"
+#include "uringengine.h"
 
 #include <QFileDialog>
 #include <QMessageBox>
@@ -29,16 +30,13 @@
 
 #include <filesystem>
 #include <thread>
-#include <chrono>
+#include <algorithm>
+#include <string>
 
 namespace fs = std::filesystem;
 
-using namespace std::chrono_literals;
-
 namespace
 {
-    const auto guiUpdateInterval { 30ms };
-
     const QString appName{ "SimpleCopier" };
     const QString appVersion{ "v1.0.0" };
     const QString author{ "Sidelnikov Dmitry" };
@@ -83,13 +81,37 @@ MainWindow::MainWindow(QWidget *parent)
     const QString statusBarMessage = QString("Available hardware concurrency: ") + std::to_string(hardwConcur).c_str() + " threads";
     ui->statusbar->showMessage(statusBarMessage);
 
+    // Origin tree is enumerated by the same number of threads
+    auto copyOptions = CopyLib::getCopyOptions();
+    copyOptions.scanThreadsNum = hardwConcur;
+    CopyLib::setCopyOptions(copyOptions);
+
+    ui->checkBoxIoUring->setEnabled(CopyLib::isIoUringAvailable());
+
     ui->pushButtonCancel->setEnabled(false);
+
+    // Controller lives in its own thread, signals between them are queued
+    qRegisterMetaType<TCopyJob>();
+    qRegisterMetaType<TCopyProgressInfo>();
+    controller = new TCopyController;
+    controller->moveToThread(&controllerThread);
+    connect(&controllerThread, &QThread::finished, controller, &QObject::deleteLater);
+    connect(this, &MainWindow::copyRequested, controller, &TCopyController::startJob);
+    connect(controller, &TCopyController::planReady, this, &MainWindow::showPlanInfo);
+    connect(controller, &TCopyController::progressChanged, this, &MainWindow::showProgress);
+    connect(controller, &TCopyController::errorOccurred, this, &MainWindow::showError);
+    connect(controller, &TCopyController::jobFinished, this, &MainWindow::finishCopy);
+    connect(controller, &TCopyController::jobFailed, this, &MainWindow::failCopy);
+    controllerThread.start();
 }
 
 //===================================================================================================================================
 
 MainWindow::~MainWindow()
 {
+    controller->cancel(); // A running job is stopped, its thread is joined
+    controllerThread.quit();
+    controllerThread.wait();
     delete ui;
 }
 
@@ -123,7 +145,7 @@ void MainWindow::on_pushButtonOrigin_clicked()
 
 void MainWindow::on_pushButtonCancel_clicked()
 {
-    copyCancel.store(true);
+    controller->cancel();
 }
 
 //===================================================================================================================================
@@ -150,56 +172,32 @@ void MainWindow::on_pushButtonStartCopy_clicked()
     {
         if (CopyLib::isEnoughSpace(dest.toStdString(), scopeSize))
         {
-            const auto ret = CopyLib::createCopyQueues(origin.toStdString(), dest.toStdString(), hardwConcur, scopeSize, fileNum);
-            if (ret)
-            {
-                ui->pushButtonStartCopy->setEnabled(false);
-                ui->pushButtonOrigin->setEnabled(false);
-                ui->pushButtonDestination->setEnabled(false);
-
-                const auto start = std::chrono::steady_clock::now();
-                
-				startCopy();
-                CopyLib::removeCopyQueues(hardwConcur);
-                
-				const auto end = std::chrono::steady_clock::now();
-                const auto diff = end - start;
-                const auto time = std::chrono::duration <double, std::milli> (diff).count();
-
-                // Update status label
-                std::string message;
-                if (copyCancel)
-                {
-                    message = "Copy is CANCELED! Copied files: " + std::to_string(copiedFileNum) + " from "
-                            + std::to_string(fileNum) + ", Copied size: "
-                            + std::to_string(copiedFileSize/1'048'576.0f) + " MBytes, Took time: "
-                            + std::to_string(time/1000.0f) + " sec.";
-
-                    // Update progress bar
-                    const int value = (copiedFileSize * 100.0f) / scopeSize;
-                    ui->progressBar->setValue(value);
-                }
-                else
-                {
-                    message = "Copy is DONE. Copied files: " + std::to_string(copiedFileNum) + ", Total size: "
-                            + std::to_string(copiedFileSize/1'048'576.0f) + " MBytes, Took time: "
-                            + std::to_string(time/1000.0f) + " sec.";
-                }
-                ui->labelStatus->setText(message.c_str());
-
-                if (CopyLib::isCopyErrorHappened())
-                {
-                    QMessageBox::warning(this, "Error", "Some files were not copied! Because of lack of permission or files were opened.");
-                }
-
-                ui->pushButtonStartCopy->setEnabled(true);
-                ui->pushButtonOrigin->setEnabled(true);
-                ui->pushButtonDestination->setEnabled(true);
-            }
-            else
-            {
-                QMessageBox::warning(this, "Error", "Can not create copy files queues. Probably access denied (for origin dir).");
-            }
+            auto copyOptions = CopyLib::getCopyOptions();
+            copyOptions.sync = ui->checkBoxSync->isChecked();
+            copyOptions.syncChecksum = copyOptions.sync && ui->checkBoxSyncChecksum->isChecked();
+            copyOptions.delta = ui->checkBoxDelta->isChecked();
+            copyOptions.journal = ui->checkBoxJournal->isChecked();
+            copyOptions.partialFiles = ui->checkBoxKeepPartial->isChecked() ? CopyLib::EPartialFilePolicy::Keep
+                                                                             : CopyLib::EPartialFilePolicy::Remove;
+            copyOptions.verify = ui->checkBoxVerify->isChecked();
+            copyOptions.dedup = ui->checkBoxDedup->isChecked();
+            TCopyJob job;
+            job.origin = origin;
+            job.dest = dest;
+            job.hardwConcur = hardwConcur;
+            job.streaming = ui->checkBoxStreaming->isChecked();
+            // io_uring threads keep many files in flight each, their number is not adapted
+            job.ioUring = ui->checkBoxIoUring->isChecked() && CopyLib::isIoUringAvailable() && !copyOptions.delta;
+            copyOptions.adaptiveWorkers = ui->checkBoxAdaptive->isChecked() && !job.ioUring;
+            CopyLib::setCopyOptions(copyOptions);
+            // Adaptive jobs get room to grow past a thread per core, the controller parks the extra workers
+            job.workersNum = copyOptions.adaptiveWorkers ? hardwConcur * 2U : hardwConcur;
+
+            setControlsEnabled(false);
+            ui->progressBar->setValue(0);
+            ui->labelStatus->setText(job.streaming ? "Copying while scanning..." : "Scanning...");
+            controller->resetCancel(); // Before the job is queued, Cancel works from now on
+            emit copyRequested(job);
         }
         else
         {
@@ -214,92 +212,89 @@ void MainWindow::on_pushButtonStartCopy_clicked()
 
 //===================================================================================================================================
 
-
-void MainWindow::startCopy()
+void MainWindow::setControlsEnabled(const bool enabled)
 {
-    copiedFileSize.store(0U);
-    copiedFileNum.store(0U);
-    copyCancel.store(false);
-    ui->progressBar->setValue(0);
+    ui->pushButtonStartCopy->setEnabled(enabled);
+    ui->pushButtonOrigin->setEnabled(enabled);
+    ui->pushButtonDestination->setEnabled(enabled);
+    ui->checkBoxStreaming->setEnabled(enabled);
+    ui->checkBoxIoUring->setEnabled(enabled && CopyLib::isIoUringAvailable());
+    ui->checkBoxSync->setEnabled(enabled);
+    ui->checkBoxSyncChecksum->setEnabled(enabled);
+    ui->checkBoxDelta->setEnabled(enabled);
+    ui->checkBoxJournal->setEnabled(enabled);
+    ui->checkBoxKeepPartial->setEnabled(enabled);
+    ui->checkBoxVerify->setEnabled(enabled);
+    ui->checkBoxDedup->setEnabled(enabled);
+    ui->checkBoxAdaptive->setEnabled(enabled);
+    ui->pushButtonCancel->setEnabled(!enabled);
+}
 
-    CopyLib::copyDirStructure();
+//===================================================================================================================================
 
-    if (CopyLib::isCopyErrorHappened())
-    {
-        return;
-    }
+void MainWindow::showPlanInfo(const QString & planInfo)
+{
+    ui->statusbar->showMessage(planInfo);
+}
+
+//===================================================================================================================================
 
-    if (fileNum == 0U)
+void MainWindow::showProgress(const TCopyProgressInfo & info)
+{
+    // Totals are growing while the streaming scan goes on
+    const auto oneMb = 1'048'576.0;
+    const auto seconds = std::max(info.seconds, 0.001);
+    scopeSize = info.scopeSize;
+    std::string message = "Copied files: " + std::to_string(info.copiedNum) + " from "
+            + std::to_string(info.fileNum) + (info.scanning ? " (scanning...)" : "")
+            + ", copied size: " + std::to_string(info.copiedSize / oneMb) + " MBytes, "
+            + std::to_string(static_cast<uint32_t>(info.copiedSize / oneMb / seconds)) + " MBytes/s";
+    if (info.verify)
     {
-        // no files to copy
-        return;
+        message += ", verify: " + std::to_string(static_cast<uint32_t>(info.verifiedSize / oneMb / seconds)) + " MBytes/s";
     }
+    ui->labelStatus->setText(message.c_str());
+    ui->progressBar->setValue(info.percent);
 
-    // Start threads
-    std::thread ** ppThreads = new (std::nothrow) std::thread * [hardwConcur];
-    if (ppThreads == nullptr)
+    if (info.adaptive)
     {
-        QMessageBox::warning(this, "Fatal error", QString(__FUNCTION__) + " - Sorry not enought memory, can not alloc memory for threads!");
-        return;
+        const QString statusBarMessage = QString("Workers: ") + std::to_string(info.activeWorkers).c_str()
+                + " active of " + std::to_string(info.workersNum).c_str();
+        ui->statusbar->showMessage(statusBarMessage);
     }
-    finishedThreadsNum.store(0U);
-    const auto tempDir = fs::temp_directory_path().string();
-    for(size_t i = 0U; i < hardwConcur; i++)
-    {
-        const std::string path = tempDir + CopyLib::getTempFN() + std::to_string(i) + CopyLib::getTempExten();
-
-        ppThreads[i] = new (std::nothrow) std::thread(CopyLib::worker, path,
-                                                      std::ref(copiedFileSize),
-                                                      std::ref(copiedFileNum),
-                                                      std::ref(finishedThreadsNum),
-                                                      std::ref(copyCancel));
+}
 
-        if (ppThreads[i] == nullptr) // Safe start canceling
-        {
-            QMessageBox::warning(this, "Fatal error", QString(__FUNCTION__) + " - Sorry not enought memory, can not alloc memory for a thread!");
-            for(size_t j = 0U; j < i; j++)
-            {
-                ppThreads[j]->join();
-                delete ppThreads[j];
-            }
-            delete [] ppThreads;
-            return;
-        }
-    }
+//===================================================================================================================================
 
-    ui->pushButtonCancel->setEnabled(true);
+void MainWindow::showError(const QString & title, const QString & message)
+{
+    QMessageBox::warning(this, title, message);
+}
 
-    // Update the progress
-    const auto oneMb = 1'048'576.0f;
-    while((finishedThreadsNum != hardwConcur) && !copyCancel)
-    {
-        std::this_thread::sleep_for(guiUpdateInterval);
-        QApplication::processEvents();
-
-        // Update info label
-        const std::string message = "Copied files: " + std::to_string(copiedFileNum) + " from "
-                + std::to_string(fileNum) + ", copied size: "
-                + std::to_string(copiedFileSize / oneMb) + " MBytes";
-        ui->labelStatus->setText(message.c_str());
-
-        // Update progress bar
-        const int value = (copiedFileSize * 100.0f) / scopeSize;
-        ui->progressBar->setValue(value);
-    }
+//===================================================================================================================================
 
-    if (!copyCancel)
+void MainWindow::finishCopy(const QString & message, const bool canceled, const bool errorHappened)
+{
+    if (!canceled)
     {
         ui->progressBar->setValue(100);
     }
-    ui->pushButtonCancel->setEnabled(false);
+    ui->labelStatus->setText(message);
+    setControlsEnabled(true);
 
-    // Finishing the threads
-    for(size_t i = 0U; i < hardwConcur; i++)
+    if (errorHappened)
     {
-        ppThreads[i]->join();
-        delete ppThreads[i];
+        QMessageBox::warning(this, "Error", "Some files were not copied! Because of lack of permission or files were opened.");
     }
-    delete [] ppThreads;
+}
+
+//===================================================================================================================================
+
+void MainWindow::failCopy(const QString & message)
+{
+    ui->labelStatus->clear();
+    setControlsEnabled(true);
+    QMessageBox::warning(this, "Error", message);
 }
 
 //===================================================================================================================================
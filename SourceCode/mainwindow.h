@@ -2,7 +2,9 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <atomic>
+#include <QThread>
+
+#include "controller.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -16,6 +18,10 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+signals:
+
+    void copyRequested(const TCopyJob & job); // Queued to the controller thread
+
 private slots:
 
     void on_pushButtonDestination_clicked();
@@ -26,22 +32,30 @@ private slots:
 
     void on_pushButtonCancel_clicked();
 
+    // Controller reports
+    void showPlanInfo(const QString & planInfo);
+
+    void showProgress(const TCopyProgressInfo & info);
+
+    void showError(const QString & title, const QString & message);
+
+    void finishCopy(const QString & message, const bool canceled, const bool errorHappened);
+
+    void failCopy(const QString & message);
+
 private:
 
-    void startCopy(); // GUI fun to start copy
+    void setControlsEnabled(const bool enabled); // Job settings can not be changed while it runs
 
     Ui::MainWindow *ui;
 
-    uint64_t scopeSize{ 0U }; // Size all files to copy
-    uint64_t fileNum{ 0U };   // Files number to copy
+    // Copy jobs run there, the GUI thread only shows their progress
+    QThread controllerThread;
+    TCopyController * controller{ nullptr };
 
-    // Copied
-    std::atomic<uint64_t> copiedFileSize{ 0U };
-    std::atomic<uint64_t> copiedFileNum{ 0U };
-    std::atomic<bool> copyCancel{ false };
+    uint64_t scopeSize{ 0U }; // Size all files to copy of the last job
 
     // Available CPU cores
     uint32_t hardwConcur{ 0U };
-    std::atomic<uint32_t> finishedThreadsNum{ 0U };
 };
 #endif // MAINWINDOW_H
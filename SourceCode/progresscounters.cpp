@@ -0,0 +1,49 @@
+
+#include "progresscounters.h"
+
+namespace CopyLib {
+
+//===================================================================================================================================
+
+void TProgressCounters::reset(const size_t workersNum)
+{
+    if (workersNum != this->workersNum || !counters)
+    {
+        counters.reset(new TWorkerCounters[workersNum]);
+        this->workersNum = workersNum;
+        return;
+    }
+    for (size_t i = 0U; i < workersNum; i++)
+    {
+        counters[i].copiedSize.store(0U);
+        counters[i].copiedNum.store(0U);
+    }
+}
+
+//===================================================================================================================================
+
+uint64_t TProgressCounters::getCopiedSize() const
+{
+    uint64_t size{ 0U };
+    for (size_t i = 0U; i < workersNum; i++)
+    {
+        size += counters[i].copiedSize.load(std::memory_order_relaxed);
+    }
+    return size;
+}
+
+//===================================================================================================================================
+
+uint64_t TProgressCounters::getCopiedNum() const
+{
+    uint64_t num{ 0U };
+    for (size_t i = 0U; i < workersNum; i++)
+    {
+        num += counters[i].copiedNum.load(std::memory_order_relaxed);
+    }
+    return num;
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
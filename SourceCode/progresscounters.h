@@ -0,0 +1,46 @@
+#ifndef PROGRESSCOUNTERS_H
+#define PROGRESSCOUNTERS_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // Progress of one worker on its own cache line, other workers never write it
+    struct alignas(64) TWorkerCounters
+    {
+        std::atomic<uint64_t> copiedSize{ 0U };
+        std::atomic<uint64_t> copiedNum{ 0U };
+    };
+
+    // Counters of all the workers of a job: worker i is given the references to block i instead of
+    // the totals shared by every worker, the poller sums the blocks when it shows the progress.
+    class TProgressCounters
+    {
+    public:
+
+        explicit TProgressCounters(const size_t workersNum = 0U) { reset(workersNum); }
+
+        // Zeroed blocks for workersNum workers, not while the workers run
+        void reset(const size_t workersNum);
+
+        TWorkerCounters & operator[](const size_t worker) { return counters[worker]; }
+
+        size_t size() const { return workersNum; }
+
+        // Sums of all the blocks, a worker may be in the middle of an update
+        uint64_t getCopiedSize() const;
+        uint64_t getCopiedNum() const;
+
+    private:
+
+        std::unique_ptr<TWorkerCounters[]> counters;
+        size_t workersNum{ 0U };
+
+    }; // TProgressCounters
+
+} // namespace CopyLib
+
+#endif // PROGRESSCOUNTERS_H
@@ -0,0 +1,172 @@
+
+#include "tracer.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+
+namespace CopyLib {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+    int64_t toNs(const std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    }
+
+    std::string jsonString(const std::string & text)
+    {
+        std::ostringstream out;
+        out << '"';
+        for (const char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out << '\\' << c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20U)
+            {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+            }
+            else
+            {
+                out << c;
+            }
+        }
+        out << '"';
+        return out.str();
+    }
+
+}; // namespace
+
+//===================================================================================================================================
+
+void TTracer::start()
+{
+    {
+        const std::lock_guard<std::mutex> lock(buffersMutex);
+        buffers.clear();
+        generation.fetch_add(1U, std::memory_order_relaxed);
+        epoch.store(toNs(std::chrono::steady_clock::now()), std::memory_order_relaxed);
+        droppedNum.store(0U, std::memory_order_relaxed);
+    }
+    recording.store(true, std::memory_order_relaxed);
+}
+
+//===================================================================================================================================
+
+TTracer::TThreadBuffer & TTracer::getThreadBuffer()
+{
+    thread_local std::shared_ptr<TThreadBuffer> buffer;
+    thread_local uint64_t bufferGeneration{ 0U };
+    if (!buffer || bufferGeneration != generation.load(std::memory_order_relaxed))
+    {
+        auto newBuffer = std::make_shared<TThreadBuffer>();
+        if (buffer)
+        {
+            const std::lock_guard<std::mutex> lock(buffer->mutex);
+            newBuffer->name = buffer->name; // A thread of the previous job, the logger writer
+        }
+        const std::lock_guard<std::mutex> lock(buffersMutex);
+        newBuffer->id = static_cast<uint32_t>(buffers.size()) + 1U;
+        buffers.push_back(newBuffer);
+        bufferGeneration = generation.load(std::memory_order_relaxed);
+        buffer = std::move(newBuffer);
+    }
+    return *buffer;
+}
+
+//===================================================================================================================================
+
+void TTracer::nameThread(const std::string & name)
+{
+    auto & buffer = getThreadBuffer();
+    const std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+//===================================================================================================================================
+
+void TTracer::addSpan(const char * name, const char * category,
+                      const std::chrono::steady_clock::time_point begin, const std::chrono::steady_clock::time_point end,
+                      std::string && detail, const bool async)
+{
+    if (!isRecording())
+    {
+        return;
+    }
+    auto & buffer = getThreadBuffer();
+    const int64_t start = epoch.load(std::memory_order_relaxed);
+    const std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.spans.size() >= maxThreadSpans)
+    {
+        droppedNum.fetch_add(1U, std::memory_order_relaxed);
+        return;
+    }
+    buffer.spans.push_back(TSpan{ name, category, std::move(detail), toNs(begin) - start, toNs(end) - start, async });
+}
+
+//===================================================================================================================================
+
+bool TTracer::save(const std::string & path) const
+{
+    std::vector<std::shared_ptr<TThreadBuffer>> threadBuffers;
+    {
+        const std::lock_guard<std::mutex> lock(buffersMutex);
+        threadBuffers = buffers;
+    }
+
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream fout(tempPath, std::ios::trunc);
+        if (!fout.is_open())
+        {
+            return false;
+        }
+        fout << std::fixed << std::setprecision(3); // Microseconds
+        fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+             << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"SimpleCopier\"}}";
+        uint64_t asyncId{ 0U };
+        for (const auto & buffer : threadBuffers)
+        {
+            const std::lock_guard<std::mutex> lock(buffer->mutex);
+            const std::string thread = ",\"pid\":1,\"tid\":" + std::to_string(buffer->id);
+            if (!buffer->name.empty())
+            {
+                fout << ",\n{\"name\":\"thread_name\",\"ph\":\"M\"" << thread << ",\"args\":{\"name\":" << jsonString(buffer->name) << "}}";
+            }
+            for (const auto & span : buffer->spans)
+            {
+                const std::string args = span.detail.empty() ? std::string("{}") : "{\"detail\":" + jsonString(span.detail) + "}";
+                if (span.async) // A begin and an end event with the same id
+                {
+                    asyncId++;
+                    fout << ",\n{\"name\":\"" << span.name << "\",\"cat\":\"" << span.category << "\",\"ph\":\"b\",\"id\":" << asyncId
+                         << ",\"ts\":" << span.begin / 1000.0 << thread << ",\"args\":" << args << "}"
+                         << ",\n{\"name\":\"" << span.name << "\",\"cat\":\"" << span.category << "\",\"ph\":\"e\",\"id\":" << asyncId
+                         << ",\"ts\":" << span.end / 1000.0 << thread << "}";
+                }
+                else
+                {
+                    fout << ",\n{\"name\":\"" << span.name << "\",\"cat\":\"" << span.category << "\",\"ph\":\"X\",\"ts\":" << span.begin / 1000.0
+                         << ",\"dur\":" << (span.end - span.begin) / 1000.0 << thread << ",\"args\":" << args << "}";
+                }
+            }
+        }
+        fout << "\n]}\n";
+        if (!fout.good())
+        {
+            return false;
+        }
+    }
+    std::error_code code;
+    fs::rename(tempPath, path, code);
+    return !code;
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
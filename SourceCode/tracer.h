@@ -0,0 +1,126 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // Timeline of a copy job in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+    // Every thread records its spans to its own buffer, its mutex is only contended while the trace is saved,
+    // so a span costs two clock reads and an uncontended lock. Not recording, a span is one relaxed load.
+    class TTracer
+    {
+    public:
+
+        static TTracer & getInstance()
+        {
+            static TTracer tracer;
+            return tracer;
+        }
+
+        // Drops the previous trace and starts recording
+        void start();
+
+        void stop() { recording.store(false, std::memory_order_relaxed); }
+
+        bool isRecording() const { return recording.load(std::memory_order_relaxed); }
+
+        // Name of the calling thread in the timeline
+        void nameThread(const std::string & name);
+
+        // async: spans of the thread may overlap (io_uring files in flight), they are shown in their own rows
+        void addSpan(const char * name, const char * category,
+                     const std::chrono::steady_clock::time_point begin, const std::chrono::steady_clock::time_point end,
+                     std::string && detail = std::string(), const bool async = false);
+
+        // Spans not recorded because the buffer of their thread is full
+        uint64_t getDroppedNum() const { return droppedNum.load(std::memory_order_relaxed); }
+
+        // JSON object format, may be called while recording
+        bool save(const std::string & path) const;
+
+        static constexpr size_t maxThreadSpans{ 1U << 18U };
+
+    private:
+
+        TTracer() { }
+        ~TTracer() { }
+        TTracer(const TTracer & tracer) = delete;
+        TTracer operator=(const TTracer & tracer) = delete;
+
+        struct TSpan
+        {
+            const char * name{ nullptr };     // Literals only
+            const char * category{ nullptr };
+            std::string detail;
+            int64_t begin{ 0 }; // ns since the trace start
+            int64_t end{ 0 };
+            bool async{ false };
+        };
+
+        struct TThreadBuffer
+        {
+            std::mutex mutex;
+            std::vector<TSpan> spans;
+            std::string name;
+            uint32_t id{ 0U };
+        };
+
+        // Owned by the thread too, so a thread recording during start (the logger writer) never writes to a freed one
+        TThreadBuffer & getThreadBuffer();
+
+        std::atomic<bool> recording{ false };
+        std::atomic<uint64_t> generation{ 0U }; // Buffers of an older trace are not used
+        std::atomic<uint64_t> droppedNum{ 0U };
+        std::atomic<int64_t> epoch{ 0 };        // Steady clock ns of the trace start
+        mutable std::mutex buffersMutex;
+        std::vector<std::shared_ptr<TThreadBuffer>> buffers;
+
+    }; // TTracer
+
+    // Span of the enclosing scope, recorded by the destructor if the tracer was recording at its start
+    class TTraceSpan
+    {
+    public:
+
+        TTraceSpan(const char * name, const char * category, const std::string & detail = std::string())
+            : name(name), category(category)
+        {
+            if (TTracer::getInstance().isRecording())
+            {
+                this->detail = detail;
+                begin = std::chrono::steady_clock::now();
+                active = true;
+            }
+        }
+
+        ~TTraceSpan()
+        {
+            if (active)
+            {
+                TTracer::getInstance().addSpan(name, category, begin, std::chrono::steady_clock::now(), std::move(detail));
+            }
+        }
+
+    private:
+
+        TTraceSpan(const TTraceSpan & span) = delete;
+        TTraceSpan operator=(const TTraceSpan & span) = delete;
+
+        const char * name;
+        const char * category;
+        std::string detail;
+        std::chrono::steady_clock::time_point begin;
+        bool active{ false };
+
+    }; // TTraceSpan
+
+} // namespace CopyLib
+
+#endif // TRACER_H
@@ -0,0 +1,145 @@
+
+#include "treewalker.h"
+#include "copyengine.h"
+
+#include <filesystem>
+#include <thread>
+
+namespace CopyLib {
+
+namespace fs = std::filesystem;
+
+//===================================================================================================================================
+
+TTreeWalker::TTreeWalker(const std::string_view & origin, const uint32_t threadsNum)
+    : origin(origin)
+    , threadsNum(threadsNum == 0U ? 1U : threadsNum)
+{
+}
+
+//===================================================================================================================================
+
+bool TTreeWalker::walk(const TDirCallback & onDir, const TFileCallback & onFile, const std::atomic<bool> & cancel)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        dirs.assign(1U, origin);
+        busyThreadsNum = 0U;
+        failed = false;
+        error.clear();
+    }
+
+    // The calling thread is a walker too
+    std::vector<std::thread> threads;
+    threads.reserve(threadsNum - 1U);
+    for (uint32_t i = 1U; i < threadsNum; i++)
+    {
+        threads.emplace_back(&TTreeWalker::walkerThread, this, i, std::cref(onDir), std::cref(onFile), std::cref(cancel));
+    }
+    walkerThread(0U, onDir, onFile, cancel);
+    for (auto & thread : threads)
+    {
+        thread.join();
+    }
+
+    const std::lock_guard<std::mutex> lock(mutex);
+    return !failed && !cancel;
+}
+
+//===================================================================================================================================
+
+void TTreeWalker::walkerThread(const uint32_t thread, const TDirCallback & onDir, const TFileCallback & onFile,
+                               const std::atomic<bool> & cancel)
+{
+    const auto dirOption { fs::directory_options::skip_permission_denied };
+    std::vector<std::string> subdirs;
+    std::error_code code;
+    TFileStat stat;
+    while (true)
+    {
+        std::string dir;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Done when nothing to list and nobody can push more
+            dirPushed.wait(lock, [this]() { return !dirs.empty() || busyThreadsNum == 0U || failed; });
+            if (dirs.empty() || failed || cancel)
+            {
+                dirs.clear();
+                dirPushed.notify_all();
+                return;
+            }
+            dir = std::move(dirs.back());
+            dirs.pop_back();
+            busyThreadsNum++;
+        }
+
+        subdirs.clear();
+        addSyscalls(3U); // open, getdents and close at least
+        // Cancel is checked for every entry too, a dir of millions of files is not listed to the end
+        for (auto it = fs::directory_iterator(dir, dirOption, code); !code && !cancel && it != fs::directory_iterator(); it.increment(code))
+        {
+            const auto & dir_entry = *it;
+            std::string path = dir_entry.path().string();
+            statFile(path, stat, code); // Follows symlinks like the entry is_* funs
+            if (stat.type == fs::file_type::not_found) // Broken symlink, skipped
+            {
+                continue;
+            }
+            if (!code && stat.type == fs::file_type::directory && !dir_entry.is_symlink(code)) // Type is cached by the iterator
+            {
+                if (onDir)
+                {
+                    onDir(thread, path.substr(origin.size()));
+                }
+                subdirs.push_back(std::move(path));
+            }
+            else if (!code && stat.type == fs::file_type::regular && onFile)
+            {
+                onFile(thread, path.substr(origin.size()), stat);
+            }
+            if (code)
+            {
+                break;
+            }
+        }
+        if (code) // Access denied is skipped by the dir option, anything else stops the walk
+        {
+            setError(dir + " System info: " + code.message());
+            code.clear();
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock(mutex);
+            for (auto & subdir : subdirs)
+            {
+                dirs.push_back(std::move(subdir));
+            }
+            busyThreadsNum--;
+        }
+        dirPushed.notify_all();
+    }
+}
+
+//===================================================================================================================================
+
+void TTreeWalker::setError(const std::string & error)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (!failed)
+    {
+        failed = true;
+        this->error = error;
+    }
+}
+
+//===================================================================================================================================
+
+std::string TTreeWalker::getError() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return error;
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
@@ -0,0 +1,61 @@
+#ifndef TREEWALKER_H
+#define TREEWALKER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include "copyqueue.h"
+
+namespace CopyLib {
+
+    // Parallel origin tree enumeration. Not listed dirs are shared through a stack, every thread lists one dir
+    // at a time and pushes its subdirs back. Paths are passed to the callbacks relative to the origin dir,
+    // callbacks are called from several threads at once with the index of the calling thread.
+    class TTreeWalker
+    {
+    public:
+
+        // Called for a dir before any of its content is listed
+        using TDirCallback = std::function<void(const uint32_t thread, const std::string & dir)>;
+
+        // Called for every regular file with its only stat made during the copy
+        using TFileCallback = std::function<void(const uint32_t thread, std::string && file, const TFileStat & stat)>;
+
+        TTreeWalker(const std::string_view & origin, const uint32_t threadsNum);
+
+        // False if the walk was not complete because of an error or canceling
+        bool walk(const TDirCallback & onDir, const TFileCallback & onFile, const std::atomic<bool> & cancel);
+
+        uint32_t getThreadsNum() const { return threadsNum; }
+
+        // The first error happened during the walk
+        std::string getError() const;
+
+    private:
+
+        void walkerThread(const uint32_t thread, const TDirCallback & onDir, const TFileCallback & onFile,
+                          const std::atomic<bool> & cancel);
+
+        void setError(const std::string & error);
+
+        const std::string origin;
+        const uint32_t threadsNum;
+
+        mutable std::mutex mutex;
+        std::condition_variable dirPushed;
+        std::vector<std::string> dirs; // Absolute paths of dirs to list
+        uint32_t busyThreadsNum{ 0U };
+        bool failed{ false };
+        std::string error;
+
+    }; // TTreeWalker
+
+} // namespace CopyLib
+
+#endif // TREEWALKER_H
@@ -0,0 +1,713 @@
+
+#include "uringengine.h"
+#include "copyqueue.h"
+#include "copyengine.h"
+#include "jobstats.h"
+#include "tracer.h"
+
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <system_error>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#endif
+
+namespace CopyLib {
+
+namespace {
+
+#if defined(__linux__)
+
+    const uint32_t maxQueueDepth{ 4096U }; // Slot index is a 16 bit registered buffer index
+    const uint32_t maxBusyRetries{ 1000U }; // io_uring_enter retries with nothing to reap, 1 ms apart
+
+    int ioUringSetup(const uint32_t entries, io_uring_params * params)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(const int fd, const uint32_t toSubmit, const uint32_t minComplete, const uint32_t flags)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    int ioUringRegister(const int fd, const uint32_t opcode, const void * arg, const uint32_t argsNum)
+    {
+        return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, argsNum));
+    }
+
+    // Minimal io_uring wrapper: submission and completion rings mapped from the kernel
+    class TUring
+    {
+    public:
+
+        TUring() { }
+        ~TUring()
+        {
+            if (sqes != MAP_FAILED)
+            {
+                ::munmap(sqes, sqesSize);
+            }
+            if (cqRing != MAP_FAILED && cqRing != sqRing)
+            {
+                ::munmap(cqRing, cqRingSize);
+            }
+            if (sqRing != MAP_FAILED)
+            {
+                ::munmap(sqRing, sqRingSize);
+            }
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+        TUring(const TUring & ring) = delete;
+        TUring operator=(const TUring & ring) = delete;
+
+        bool init(const uint32_t entries)
+        {
+            io_uring_params params{};
+            fd = ioUringSetup(entries, &params);
+            if (fd < 0)
+            {
+                return false;
+            }
+            sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+            cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+            }
+            sqRing = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqRing == MAP_FAILED)
+            {
+                return false;
+            }
+            cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing
+                   : ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED)
+            {
+                return false;
+            }
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void * sqesMap = ::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqesMap == MAP_FAILED)
+            {
+                return false;
+            }
+            sqes = static_cast<io_uring_sqe *>(sqesMap);
+
+            char * sq = static_cast<char *>(sqRing);
+            sqHead = reinterpret_cast<uint32_t *>(sq + params.sq_off.head);
+            sqTail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+            sqMask = *reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+            sqEntries = params.sq_entries;
+            sqLocalTail = *sqTail;
+
+            char * cq = static_cast<char *>(cqRing);
+            cqHead = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+            cqTail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+            cqMask = *reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+            return true;
+        }
+
+        bool registerBuffers(const std::vector<iovec> & buffers)
+        {
+            return ioUringRegister(fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<uint32_t>(buffers.size())) == 0;
+        }
+
+        // nullptr if the submission ring is full
+        io_uring_sqe * getSqe()
+        {
+            const uint32_t head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            if (sqLocalTail - head >= sqEntries)
+            {
+                return nullptr;
+            }
+            const uint32_t index = sqLocalTail & sqMask;
+            sqArray[index] = index;
+            sqLocalTail++;
+            io_uring_sqe * sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(io_uring_sqe));
+            return sqe;
+        }
+
+        // Submits prepared entries and waits for at least waitNum completions. Returns early, with entries left
+        // for the next call, when the completion ring is full (EBUSY) or the kernel is short of memory (EAGAIN)
+        // and there are completions to process: retrying without reaping them would never succeed.
+        bool submitAndWait(const uint32_t waitNum)
+        {
+            __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+            uint32_t busyRetries{ 0U };
+            while (true)
+            {
+                const uint32_t toSubmit = sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+                const int ret = ioUringEnter(fd, toSubmit, waitNum, waitNum > 0U ? IORING_ENTER_GETEVENTS : 0U);
+                addSyscalls(1U);
+                if (ret >= 0)
+                {
+                    return true;
+                }
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EBUSY)
+                {
+                    return false;
+                }
+                if (*cqHead != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+                {
+                    return true;
+                }
+                if (++busyRetries > maxBusyRetries)
+                {
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        // Submission entries not taken by the kernel yet
+        uint32_t getUnsubmitted() const
+        {
+            return sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        }
+
+        // Reaps inKernel operations without submitting new ones, after submitAndWait failed: their buffers must not
+        // be freed while the kernel can still read or write them. False if they can not be reaped.
+        bool drain(uint32_t inKernel)
+        {
+            uint32_t retries{ 0U };
+            while (true)
+            {
+                processCompletions([&inKernel](const uint64_t, const int32_t) { inKernel--; });
+                if (inKernel == 0U)
+                {
+                    return true;
+                }
+                const int ret = ioUringEnter(fd, 0U, 1U, IORING_ENTER_GETEVENTS);
+                addSyscalls(1U);
+                if (ret < 0 && errno != EINTR)
+                {
+                    if (++retries > maxBusyRetries)
+                    {
+                        return false;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        }
+
+        // Calls fun(user_data, res) for every ready completion
+        template<class TFun>
+        void processCompletions(TFun fun)
+        {
+            uint32_t head = *cqHead;
+            const uint32_t tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != tail)
+            {
+                const io_uring_cqe & cqe = cqes[head & cqMask];
+                const uint64_t userData = cqe.user_data;
+                const int32_t res = cqe.res;
+                head++;
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+                fun(userData, res);
+            }
+        }
+
+    private:
+
+        int fd{ -1 };
+        void * sqRing{ MAP_FAILED };
+        void * cqRing{ MAP_FAILED };
+        io_uring_sqe * sqes{ static_cast<io_uring_sqe *>(MAP_FAILED) };
+        size_t sqRingSize{ 0U };
+        size_t cqRingSize{ 0U };
+        size_t sqesSize{ 0U };
+
+        uint32_t * sqHead{ nullptr };
+        uint32_t * sqTail{ nullptr };
+        uint32_t * sqArray{ nullptr };
+        uint32_t sqMask{ 0U };
+        uint32_t sqEntries{ 0U };
+        uint32_t sqLocalTail{ 0U };
+
+        uint32_t * cqHead{ nullptr };
+        uint32_t * cqTail{ nullptr };
+        uint32_t cqMask{ 0U };
+        io_uring_cqe * cqes{ nullptr };
+    };
+
+    // File being copied, its blocks are spread over the slots
+    struct TUringFile
+    {
+        TCopyTask task;
+        std::string origin;
+        std::string dest;
+        int src{ -1 };
+        int dst{ -1 };
+        uint64_t end{ 0U };        // Size of the open origin or the range end for a split file
+        uint64_t nextOffset{ 0U }; // First not requested byte
+        uint32_t inFlight{ 0U };   // Slots busy with this file
+        uint64_t published{ 0U };  // Written bytes added to copiedFileSize
+        int error{ 0 };
+        std::chrono::steady_clock::time_point start; // Taken from the queue
+    };
+
+    // One buffer and one operation in flight, slot index is the user data and the registered buffer index
+    struct TUringSlot
+    {
+        TUringFile * file{ nullptr };
+        uint64_t offset{ 0U };
+        uint32_t length{ 0U };  // Requested read length
+        uint32_t done{ 0U };    // Bytes read to the buffer
+        uint32_t written{ 0U }; // Bytes of the buffer written
+        bool writing{ false };
+    };
+
+    struct TFreeDeleter
+    {
+        void operator()(void * ptr) const { std::free(ptr); }
+    };
+
+#endif // __linux__
+
+}; // namespace
+
+//===================================================================================================================================
+
+bool isIoUringAvailable()
+{
+#if defined(__linux__)
+    static const bool available = []()
+    {
+        io_uring_params params{};
+        const int fd = ioUringSetup(2U, &params);
+        if (fd < 0)
+        {
+            return false;
+        }
+        ::close(fd);
+        return (params.features & IORING_FEAT_RW_CUR_POS) != 0U; // Linux 5.6 with IORING_OP_READ/WRITE
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+//===================================================================================================================================
+
+bool uringCopy(const uint32_t queue, const uint32_t queueDepth, const uint32_t blockSize,
+               std::atomic<uint64_t>& copiedFileSize, std::atomic<uint64_t>& copiedFileNum,
+               const std::atomic<bool>& copyCancel,
+               const std::function<void(const std::string & file, const std::string & error)> & onError,
+               const std::function<void(const std::string & dest, const TCopyTask & task, const bool copied, const uint64_t size)> & onFinished,
+               const std::function<void(const std::string & dest, const TCopyTask & task, const uint64_t published)> & onCanceled,
+               const std::function<void(const std::string & dest, const TCopyTask & task, const uint64_t counted)> & onRangeLeft)
+{
+#if defined(__linux__)
+    if (queueDepth == 0U || queueDepth > maxQueueDepth || blockSize == 0U || !isIoUringAvailable())
+    {
+        return false;
+    }
+    // One page aligned allocation for all the slots, declared before the ring: it must outlive the operations
+    const size_t alignedBlock = (blockSize + 4095U) & ~static_cast<size_t>(4095U);
+    std::unique_ptr<void, TFreeDeleter> memory(std::aligned_alloc(4096U, alignedBlock * queueDepth));
+    if (!memory)
+    {
+        return false;
+    }
+    TUring ring;
+    if (!ring.init(queueDepth))
+    {
+        return false;
+    }
+    char * const buffers = static_cast<char *>(memory.get());
+    std::vector<iovec> iovecs(queueDepth);
+    for (uint32_t i = 0U; i < queueDepth; i++)
+    {
+        iovecs[i].iov_base = buffers + i * alignedBlock;
+        iovecs[i].iov_len = alignedBlock;
+    }
+    const bool fixedBuffers = ring.registerBuffers(iovecs); // Plain read/write if memlock limit is too low
+
+    auto & queues = TCopyQueues::getInstance();
+    const std::string & origin = queues.getOrigin();
+    const std::string & dest = queues.getDest();
+
+    std::vector<TUringSlot> slots(queueDepth);
+    std::vector<uint32_t> freeSlots(queueDepth);
+    for (uint32_t i = 0U; i < queueDepth; i++)
+    {
+        freeSlots[i] = queueDepth - 1U - i;
+    }
+    std::deque<std::unique_ptr<TUringFile>> files;
+    uint32_t inFlight{ 0U };
+    bool noMoreTasks{ false };
+
+    const auto submitRead = [&](const uint32_t index)
+    {
+        TUringSlot & slot = slots[index];
+        io_uring_sqe * sqe = ring.getSqe(); // Never full, slots number is the ring size
+        sqe->opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = slot.file->src;
+        sqe->off = slot.offset + slot.done;
+        sqe->addr = reinterpret_cast<uint64_t>(buffers + index * alignedBlock + slot.done);
+        sqe->len = slot.length - slot.done;
+        sqe->buf_index = static_cast<uint16_t>(index);
+        sqe->user_data = index;
+    };
+
+    const auto submitWrite = [&](const uint32_t index)
+    {
+        TUringSlot & slot = slots[index];
+        io_uring_sqe * sqe = ring.getSqe();
+        sqe->opcode = fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = slot.file->dst;
+        sqe->off = slot.offset + slot.written;
+        sqe->addr = reinterpret_cast<uint64_t>(buffers + index * alignedBlock + slot.written);
+        sqe->len = slot.done - slot.written;
+        sqe->buf_index = static_cast<uint16_t>(index);
+        sqe->user_data = index;
+    };
+
+    const auto closeFile = [&](TUringFile & file)
+    {
+        if (file.src >= 0)
+        {
+            ::close(file.src);
+            addSyscalls(1U);
+            file.src = -1;
+        }
+        if (file.dst >= 0)
+        {
+            addSyscalls(1U);
+            if (::close(file.dst) != 0 && file.error == 0)
+            {
+                file.error = errno;
+            }
+            file.dst = -1;
+        }
+        const bool done = (file.error == 0) && (!copyCancel || file.nextOffset >= file.end);
+        if (done) // Files in flight overlap, so the latency includes waiting for the slots taken by the others
+        {
+            const auto now = std::chrono::steady_clock::now();
+            TJobStats::getInstance().addFile(queue, file.task.size, now - file.start);
+            TTracer::getInstance().addSpan(file.task.split ? "copy range" : "copy file", "copy", file.start, now, std::string(file.task.file), true);
+        }
+        if (file.task.split) // The file is done when its last range lands, it is canceled with any of its ranges
+        {
+            auto & split = *file.task.split;
+            if ((!done && (file.error == 0 || copyCancel)) || split.isCanceled(copyCancel))
+            {
+                split.canceled.store(true);
+                onRangeLeft(file.dest, file.task, file.published);
+                return;
+            }
+            if (file.error != 0)
+            {
+                onError(file.origin, std::generic_category().message(file.error));
+            }
+            const uint64_t rest = done ? file.task.size - std::min(file.published, file.task.size) : 0U;
+            copiedFileSize += rest;
+            if (split.finishRange(done))
+            {
+                copiedFileNum++;
+                const bool copied = !split.failed;
+                if (copied)
+                {
+                    addCopyMethodFile(ECopyMethod::SplitRanges);
+                }
+                onFinished(file.dest, file.task, copied, split.size);
+            }
+            onRangeLeft(file.dest, file.task, file.published + rest);
+            return;
+        }
+        if (file.error != 0)
+        {
+            onError(file.origin, std::generic_category().message(file.error));
+        }
+        else if (!done)
+        {
+            onCanceled(file.dest, file.task, file.published);
+            return;
+        }
+        const uint64_t rest = file.task.size - std::min(file.published, file.task.size);
+        if (done)
+        {
+            copiedFileSize += rest;
+            copiedFileNum++;
+            addCopyMethodFile(ECopyMethod::IoUring);
+            onFinished(file.dest, file.task, true, file.end);
+        }
+        else
+        {
+            onFinished(file.dest, file.task, false, 0U);
+        }
+    };
+
+    // Opens the next task, false if there are no more tasks
+    const auto openNextFile = [&]()
+    {
+        TCopyTask task;
+        const auto waitStart = std::chrono::steady_clock::now();
+        if (!(inFlight > 0U ? queues.tryPop(queue, task) : queues.pop(queue, task)))
+        {
+            noMoreTasks = (inFlight == 0U);
+            return false;
+        }
+        auto file = std::make_unique<TUringFile>();
+        file->start = std::chrono::steady_clock::now();
+        if (inFlight == 0U) // The ring is idle only while it waits for a task
+        {
+            TJobStats::getInstance().addQueueWait(queue, file->start - waitStart);
+        }
+        file->origin = origin + task.file;
+        file->dest = dest + task.file;
+        file->task = std::move(task);
+        std::error_code code;
+        const uint32_t mode = file->task.stat.mode & 07777; // Of the scan, see TCopyTask::stat
+        const bool skipped = file->task.split && !file->task.split->startRange(); // Another range of the file was canceled
+        if (!skipped)
+        {
+            addSyscalls(1U);
+            file->src = ::open(file->origin.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (skipped)
+        {
+            file->error = ECANCELED;
+        }
+        else if (file->src < 0)
+        {
+            file->error = errno;
+        }
+        else if (file->task.split) // A range is written into the destination created by the first range
+        {
+            file->nextOffset = file->task.offset;
+            file->end = file->task.offset + file->task.size;
+            const uint64_t splitSize = file->task.split->size;
+            struct stat srcStat{};
+            if (file->end >= splitSize) // The tail of a grown origin is not in any range, see copyRange
+            {
+                addSyscalls(1U);
+                if (::fstat(file->src, &srcStat) != 0)
+                {
+                    file->error = errno;
+                }
+                else if (static_cast<uint64_t>(srcStat.st_size) != splitSize)
+                {
+                    file->error = EIO;
+                }
+            }
+            if (file->error == 0 && !prepareSplitFile(file->dest, *file->task.split, code))
+            {
+                file->error = code.value();
+            }
+            else if (file->error == 0)
+            {
+                addSyscalls(1U);
+                file->dst = ::open(file->dest.c_str(), O_WRONLY | O_CLOEXEC);
+                file->error = (file->dst < 0) ? errno : 0;
+            }
+        }
+        else
+        {
+            struct stat srcStat{}; // The size of the open origin, the scan size is only for planning (see copyFile)
+            addSyscalls(1U);
+            if (::fstat(file->src, &srcStat) != 0)
+            {
+                file->error = errno;
+            }
+            else
+            {
+                file->end = static_cast<uint64_t>(srcStat.st_size);
+                addSyscalls(2U);
+                file->dst = ::open(file->dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+                if (file->dst < 0)
+                {
+                    file->error = errno;
+                }
+                else
+                {
+                    ::fchmod(file->dst, mode);
+                }
+            }
+        }
+        if (file->error != 0 || file->nextOffset >= file->end)
+        {
+            closeFile(*file);
+        }
+        else
+        {
+            files.push_back(std::move(file));
+        }
+        return true;
+    };
+
+    while (true)
+    {
+        // Give every free slot the next block of the oldest file with unread data
+        while (!freeSlots.empty() && !copyCancel)
+        {
+            const auto readable = std::find_if(files.begin(), files.end(), [](const std::unique_ptr<TUringFile> & file)
+            {
+                return file->error == 0 && file->nextOffset < file->end;
+            });
+            if (readable == files.end())
+            {
+                if (noMoreTasks || !openNextFile())
+                {
+                    break;
+                }
+                continue;
+            }
+            TUringFile & file = **readable;
+            const uint32_t index = freeSlots.back();
+            freeSlots.pop_back();
+            TUringSlot & slot = slots[index];
+            slot = TUringSlot{};
+            slot.file = &file;
+            slot.offset = file.nextOffset;
+            slot.length = static_cast<uint32_t>(std::min<uint64_t>(blockSize, file.end - file.nextOffset));
+            file.nextOffset += slot.length;
+            file.inFlight++;
+            inFlight++;
+            submitRead(index);
+        }
+
+        if (inFlight == 0U)
+        {
+            if (noMoreTasks || copyCancel)
+            {
+                break;
+            }
+            continue; // Only possible after a failed or empty file, take the next one
+        }
+
+        if (!ring.submitAndWait(1U)) // Ring is broken, the files in flight go back to the queue for the caller
+        {
+            if (!ring.drain(inFlight - ring.getUnsubmitted()))
+            {
+                memory.release(); // The kernel may still write into the buffers, they are leaked rather than reused
+            }
+            for (auto & file : files)
+            {
+                if (file->error != 0) // Failed before, reported as usual
+                {
+                    closeFile(*file);
+                    continue;
+                }
+                addSyscalls(2U);
+                ::close(file->src);
+                ::close(file->dst);
+                copiedFileSize -= file->published; // Copied again from the start
+                if (file->task.split)
+                {
+                    onRangeLeft(file->dest, file->task, 0U);
+                }
+                queues.push(queue, std::move(file->task));
+            }
+            return false;
+        }
+
+        ring.processCompletions([&](const uint64_t userData, const int32_t res)
+        {
+            const uint32_t index = static_cast<uint32_t>(userData);
+            TUringSlot & slot = slots[index];
+            TUringFile & file = *slot.file;
+            bool slotDone{ false };
+            if (res < 0)
+            {
+                file.error = (file.error == 0) ? -res : file.error;
+                slotDone = true;
+            }
+            else if (!slot.writing)
+            {
+                slot.done += static_cast<uint32_t>(res);
+                if (res == 0) // The file was truncated meanwhile, a short copy (or a hole in a split file) is an error
+                {
+                    file.error = (file.error == 0) ? EIO : file.error;
+                }
+                if (res > 0 && slot.done < slot.length)
+                {
+                    submitRead(index);
+                }
+                else if (slot.done > 0U && file.error == 0)
+                {
+                    slot.writing = true;
+                    submitWrite(index);
+                }
+                else
+                {
+                    slotDone = true;
+                }
+            }
+            else
+            {
+                slot.written += static_cast<uint32_t>(res);
+                if (res == 0)
+                {
+                    file.error = (file.error == 0) ? EIO : file.error;
+                    slotDone = true;
+                }
+                else if (slot.written < slot.done)
+                {
+                    submitWrite(index);
+                }
+                else
+                {
+                    slotDone = true;
+                }
+                copiedFileSize += static_cast<uint64_t>(res);
+                file.published += static_cast<uint64_t>(res);
+            }
+
+            if (slotDone)
+            {
+                freeSlots.push_back(index);
+                inFlight--;
+                file.inFlight--;
+                if (file.inFlight == 0U && (file.error != 0 || file.nextOffset >= file.end || copyCancel))
+                {
+                    closeFile(file);
+                    files.erase(std::find_if(files.begin(), files.end(), [&file](const std::unique_ptr<TUringFile> & item)
+                    {
+                        return item.get() == &file;
+                    }));
+                }
+            }
+        });
+    }
+
+    for (auto & file : files) // Canceled files
+    {
+        closeFile(*file);
+    }
+    return true;
+#else
+    (void)queue; (void)queueDepth; (void)blockSize; (void)copiedFileSize; (void)copiedFileNum; (void)copyCancel; (void)onError; (void)onFinished; (void)onCanceled; (void)onRangeLeft;
+    return false;
+#endif
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
@@ -0,0 +1,35 @@
+#ifndef URINGENGINE_H
+#define URINGENGINE_H
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#include "copyqueue.h"
+
+namespace CopyLib {
+
+    // True if the kernel supports io_uring with plain read/write operations (Linux 5.6+).
+    // Always false on other platforms or when io_uring is disabled by the system.
+    bool isIoUringAvailable();
+
+    // Copies tasks of the queue (and stolen ones) through one io_uring instance, keeping up to queueDepth
+    // reads and writes of several files in flight. Buffers of blockSize bytes are registered in the kernel when
+    // RLIMIT_MEMLOCK allows it. Failed files are reported through onError, every finished file through onFinished
+    // with the result and the bytes copied (once for a split file). Every written block is added to copiedFileSize, files (or ranges) interrupted by cancel
+    // are reported through onCanceled with the bytes published for them. Every range of a split file leaving the ring is
+    // reported through onRangeLeft with the bytes it added, a canceled range cancels its file (see TSplitFile::leaveRange).
+    // Returns false if the ring can not be created or breaks during the copy: the files in flight are pushed back
+    // to the queue then, the tasks left in the queues are for the caller.
+    bool uringCopy(const uint32_t queue, const uint32_t queueDepth, const uint32_t blockSize,
+                   std::atomic<uint64_t>& copiedFileSize, std::atomic<uint64_t>& copiedFileNum,
+                   const std::atomic<bool>& copyCancel,
+                   const std::function<void(const std::string & file, const std::string & error)> & onError,
+                   const std::function<void(const std::string & dest, const TCopyTask & task, const bool copied, const uint64_t size)> & onFinished,
+                   const std::function<void(const std::string & dest, const TCopyTask & task, const uint64_t published)> & onCanceled,
+                   const std::function<void(const std::string & dest, const TCopyTask & task, const uint64_t counted)> & onRangeLeft);
+
+} // namespace CopyLib
+
+#endif // URINGENGINE_H
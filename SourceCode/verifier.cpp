@@ -0,0 +1,387 @@
+
+#include "verifier.h"
+#include "copyengine.h"
+
+#include <array>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace CopyLib {
+
+namespace {
+
+    const uint32_t crcPolynomial{ 0x82F63B78U }; // Castagnoli, reflected
+    const size_t checksumChunkSize{ 1U << 20U };
+
+    using TCrcTables = std::array<std::array<uint32_t, 256U>, 8U>;
+
+    // tables[0] is the classic byte table, tables[k] advances a byte k more positions
+    TCrcTables makeCrcTables()
+    {
+        TCrcTables tables{};
+        for (uint32_t i = 0U; i < 256U; i++)
+        {
+            uint32_t crc = i;
+            for (uint32_t bit = 0U; bit < 8U; bit++)
+            {
+                crc = (crc & 1U) ? (crc >> 1U) ^ crcPolynomial : crc >> 1U;
+            }
+            tables[0][i] = crc;
+        }
+        for (uint32_t i = 0U; i < 256U; i++)
+        {
+            for (size_t k = 1U; k < tables.size(); k++)
+            {
+                tables[k][i] = (tables[k - 1U][i] >> 8U) ^ tables[0][tables[k - 1U][i] & 0xFFU];
+            }
+        }
+        return tables;
+    }
+
+    const TCrcTables crcTables = makeCrcTables();
+
+    // Slicing-by-8, crc is not inverted here
+    uint32_t softwareCrc32c(uint32_t crc, const unsigned char * data, size_t size)
+    {
+        while (size >= 8U)
+        {
+            uint32_t low{ 0U };
+            uint32_t high{ 0U };
+            std::memcpy(&low, data, 4U);
+            std::memcpy(&high, data + 4U, 4U);
+            low ^= crc; // Little endian, as every platform the app is built for
+            crc = crcTables[7][low & 0xFFU] ^ crcTables[6][(low >> 8U) & 0xFFU]
+                ^ crcTables[5][(low >> 16U) & 0xFFU] ^ crcTables[4][low >> 24U]
+                ^ crcTables[3][high & 0xFFU] ^ crcTables[2][(high >> 8U) & 0xFFU]
+                ^ crcTables[1][(high >> 16U) & 0xFFU] ^ crcTables[0][high >> 24U];
+            data += 8U;
+            size -= 8U;
+        }
+        while (size-- > 0U)
+        {
+            crc = (crc >> 8U) ^ crcTables[0][(crc ^ *data++) & 0xFFU];
+        }
+        return crc;
+    }
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((target("sse4.2")))
+#endif
+    uint32_t hardwareCrc32c(uint32_t crc, const unsigned char * data, size_t size)
+    {
+        uint64_t crc64 = crc;
+        while (size >= 8U)
+        {
+            uint64_t word{ 0U };
+            std::memcpy(&word, data, 8U);
+            crc64 = _mm_crc32_u64(crc64, word);
+            data += 8U;
+            size -= 8U;
+        }
+        crc = static_cast<uint32_t>(crc64);
+        while (size-- > 0U)
+        {
+            crc = _mm_crc32_u8(crc, *data++);
+        }
+        return crc;
+    }
+
+    bool hasSse42()
+    {
+#if defined(_MSC_VER)
+        int info[4]{ 0 };
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.2");
+#endif
+    }
+
+    const bool crcHardware = hasSse42();
+
+#else
+
+    const bool crcHardware{ false };
+
+#endif
+
+#if defined(__linux__)
+
+    // Reads length bytes unless the file ends, returns -1 on error
+    ssize_t readChunk(const int fd, char * buffer, const size_t length, const uint64_t offset)
+    {
+        size_t done{ 0U };
+        while (done < length)
+        {
+            const ssize_t ret = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+            addSyscalls(1U);
+            if (ret < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (ret < 0)
+            {
+                return -1;
+            }
+            if (ret == 0)
+            {
+                break;
+            }
+            done += static_cast<size_t>(ret);
+        }
+        return static_cast<ssize_t>(done);
+    }
+
+#endif
+
+}; // namespace
+
+//===================================================================================================================================
+
+uint32_t crc32c(const uint32_t crc, const void * data, const size_t size)
+{
+    const auto bytes = static_cast<const unsigned char *>(data);
+#if defined(__x86_64__) || defined(_M_X64)
+    if (crcHardware)
+    {
+        return ~hardwareCrc32c(~crc, bytes, size);
+    }
+#endif
+    return ~softwareCrc32c(~crc, bytes, size);
+}
+
+//===================================================================================================================================
+
+bool isCrc32cHardware()
+{
+    return crcHardware;
+}
+
+//===================================================================================================================================
+
+bool fileCrc32c(const std::string & path, const uint64_t size, uint32_t & crc, std::error_code & code)
+{
+    code.clear();
+    crc = 0U;
+    thread_local std::vector<char> buffer;
+    buffer.resize(checksumChunkSize);
+#if defined(__linux__)
+    addSyscalls(3U);
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        code.assign(errno, std::generic_category());
+        return false;
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    bool ret{ true };
+    for (uint64_t done = 0U; done < size; )
+    {
+        const size_t chunk = static_cast<size_t>(std::min<uint64_t>(size - done, buffer.size()));
+        const ssize_t readBytes = readChunk(fd, buffer.data(), chunk, done);
+        if (readBytes != static_cast<ssize_t>(chunk))
+        {
+            if (readBytes < 0)
+            {
+                code.assign(errno, std::generic_category());
+            }
+            else
+            {
+                code = std::make_error_code(std::errc::io_error);
+            }
+            ret = false;
+            break;
+        }
+        crc = crc32c(crc, buffer.data(), chunk);
+        done += chunk;
+    }
+    ::close(fd);
+    return ret;
+#else
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin.is_open())
+    {
+        code = std::make_error_code(std::errc::permission_denied);
+        return false;
+    }
+    for (uint64_t done = 0U; done < size; )
+    {
+        const auto chunk = static_cast<std::streamsize>(std::min<uint64_t>(size - done, buffer.size()));
+        fin.read(buffer.data(), chunk);
+        addSyscalls(1U);
+        if (fin.gcount() != chunk)
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+        crc = crc32c(crc, buffer.data(), static_cast<size_t>(chunk));
+        done += static_cast<uint64_t>(chunk);
+    }
+    return true;
+#endif
+}
+
+//===================================================================================================================================
+
+bool checksumRange(const std::string & origin, const std::string & dest, const uint64_t offset, const uint64_t size,
+                   uint32_t & originCrc, uint32_t & destCrc, std::error_code & code)
+{
+    code.clear();
+    originCrc = destCrc = 0U;
+    thread_local std::vector<char> buffer;
+    buffer.resize(checksumChunkSize);
+#if defined(__linux__)
+    addSyscalls(4U);
+    const int src = ::open(origin.c_str(), O_RDONLY | O_CLOEXEC);
+    const int dst = ::open(dest.c_str(), O_RDONLY | O_CLOEXEC);
+    bool ret = (src >= 0 && dst >= 0);
+    if (!ret)
+    {
+        code.assign(errno, std::generic_category());
+    }
+    for (uint64_t done = 0U; ret && done < size; )
+    {
+        const size_t chunk = static_cast<size_t>(std::min<uint64_t>(size - done, buffer.size()));
+        const ssize_t srcBytes = readChunk(src, buffer.data(), chunk, offset + done);
+        if (srcBytes == static_cast<ssize_t>(chunk))
+        {
+            originCrc = crc32c(originCrc, buffer.data(), chunk);
+        }
+        const ssize_t dstBytes = (srcBytes == static_cast<ssize_t>(chunk)) ? readChunk(dst, buffer.data(), chunk, offset + done) : -1;
+        if (srcBytes < 0 || dstBytes < 0)
+        {
+            code.assign(errno, std::generic_category());
+            ret = false;
+        }
+        else if (srcBytes != static_cast<ssize_t>(chunk) || dstBytes != static_cast<ssize_t>(chunk))
+        {
+            code = std::make_error_code(std::errc::io_error); // Truncated meanwhile
+            ret = false;
+        }
+        else
+        {
+            destCrc = crc32c(destCrc, buffer.data(), chunk);
+            done += chunk;
+        }
+    }
+    if (src >= 0)
+    {
+        ::close(src);
+    }
+    if (dst >= 0)
+    {
+        ::close(dst);
+    }
+    return ret;
+#else
+    std::ifstream originIn(origin, std::ios::binary);
+    std::ifstream destIn(dest, std::ios::binary);
+    if (!originIn.is_open() || !destIn.is_open())
+    {
+        code = std::make_error_code(std::errc::permission_denied);
+        return false;
+    }
+    originIn.seekg(static_cast<std::streamoff>(offset));
+    destIn.seekg(static_cast<std::streamoff>(offset));
+    for (uint64_t done = 0U; done < size; )
+    {
+        const auto chunk = static_cast<std::streamsize>(std::min<uint64_t>(size - done, buffer.size()));
+        originIn.read(buffer.data(), chunk);
+        if (originIn.gcount() != chunk)
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+        originCrc = crc32c(originCrc, buffer.data(), static_cast<size_t>(chunk));
+        destIn.read(buffer.data(), chunk);
+        if (destIn.gcount() != chunk)
+        {
+            code = std::make_error_code(std::errc::io_error);
+            return false;
+        }
+        destCrc = crc32c(destCrc, buffer.data(), static_cast<size_t>(chunk));
+        addSyscalls(2U);
+        done += static_cast<uint64_t>(chunk);
+    }
+    return true;
+#endif
+}
+
+//===================================================================================================================================
+
+void TVerifyQueue::open()
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    tasks.clear();
+    opened = true;
+}
+
+//===================================================================================================================================
+
+void TVerifyQueue::close()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        opened = false;
+    }
+    taskPushed.notify_all();
+}
+
+//===================================================================================================================================
+
+void TVerifyQueue::push(TVerifyTask && task)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        if (!opened)
+        {
+            return;
+        }
+        tasks.push_back(std::move(task));
+    }
+    taskPushed.notify_one();
+}
+
+//===================================================================================================================================
+
+bool TVerifyQueue::pop(TVerifyTask & task)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    taskPushed.wait(lock, [this]() { return !tasks.empty() || !opened; });
+    if (tasks.empty())
+    {
+        return false;
+    }
+    task = std::move(tasks.front());
+    tasks.pop_front();
+    return true;
+}
+
+//===================================================================================================================================
+
+bool TVerifyQueue::isOpen() const
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    return opened;
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
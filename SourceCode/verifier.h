@@ -0,0 +1,83 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <cstddef>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // CRC32C (Castagnoli) of the data continuing crc, 0 starts a new checksum.
+    // The SSE4.2 crc32 instruction is used when the CPU has it, slicing-by-8 tables otherwise.
+    uint32_t crc32c(const uint32_t crc, const void * data, const size_t size);
+
+    bool isCrc32cHardware();
+
+    // CRC32C of the first size bytes of a file. False if it can not be read or is shorter (code is set then).
+    bool fileCrc32c(const std::string & path, const uint64_t size, uint32_t & crc, std::error_code & code);
+
+    // CRC32C of [offset, offset + size) of both files, read chunk by chunk in turn. False if a file can not be read
+    // or is shorter (code is set then).
+    bool checksumRange(const std::string & origin, const std::string & dest, const uint64_t offset, const uint64_t size,
+                       uint32_t & originCrc, uint32_t & destCrc, std::error_code & code);
+
+    // A landed file or range of a split file waiting for the verification
+    struct TVerifyTask
+    {
+        std::string origin; // Full paths
+        std::string dest;
+        uint64_t offset{ 0U };
+        uint64_t size{ 0U };
+    };
+
+    //===================================================================================================================================
+
+    // Pipeline from the workers to the verifier threads: a worker pushes what it has copied and goes on copying,
+    // verifiers hash it meanwhile, the data is still in the page cache then.
+    class TVerifyQueue
+    {
+    public:
+
+        static TVerifyQueue & getInstance()
+        {
+            static TVerifyQueue queue;
+            return queue;
+        }
+
+        // Drops old tasks and accepts new ones
+        void open();
+
+        // No more tasks, pop returns false when the queue is drained
+        void close();
+
+        // Ignored if the queue is not open
+        void push(TVerifyTask && task);
+
+        // Waits for a task while the queue is open
+        bool pop(TVerifyTask & task);
+
+        bool isOpen() const;
+
+    private:
+
+        TVerifyQueue() { }
+        ~TVerifyQueue() { }
+        TVerifyQueue(const TVerifyQueue & queue) = delete;
+        TVerifyQueue operator=(const TVerifyQueue & queue) = delete;
+
+        mutable std::mutex mutex;
+        std::condition_variable taskPushed;
+        std::deque<TVerifyTask> tasks;
+        bool opened{ false };
+
+    }; // TVerifyQueue
+
+    //===================================================================================================================================
+
+} // namespace CopyLib
+
+#endif // VERIFIER_H
@@ -0,0 +1,121 @@
+
+#include "workercontrol.h"
+
+#include <algorithm>
+
+namespace CopyLib {
+
+//===================================================================================================================================
+
+void TWorkerControl::reset(const uint32_t workersNum, const bool adaptive)
+{
+    const std::lock_guard<std::mutex> lock(mutex);
+    this->workersNum.store(std::max(workersNum, 1U));
+    this->adaptive.store(adaptive && workersNum > 1U);
+    // Adaptive jobs start from the middle, the controller can go both ways
+    activeNum.store(this->adaptive ? std::max(workersNum / 2U, 1U) : this->workersNum.load());
+    finished.store(false);
+    lastSample = std::chrono::steady_clock::time_point{};
+    lastSize = lastNum = 0U;
+    lastScore = 0.0;
+    direction = 1;
+    stableSamples = 0U;
+}
+
+//===================================================================================================================================
+
+bool TWorkerControl::waitActive(const uint32_t worker, const std::atomic<bool>& copyCancel)
+{
+    if (worker < activeNum || finished)
+    {
+        return !copyCancel;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    while (worker >= activeNum && !finished && !copyCancel)
+    {
+        activeChanged.wait_for(lock, std::chrono::milliseconds(100)); // copyCancel is not notified
+    }
+    return !copyCancel;
+}
+
+//===================================================================================================================================
+
+void TWorkerControl::finish()
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        finished.store(true);
+    }
+    activeChanged.notify_all();
+}
+
+//===================================================================================================================================
+
+void TWorkerControl::update(const uint64_t copiedSize, const uint64_t copiedNum, const std::chrono::steady_clock::time_point now)
+{
+    if (!adaptive || finished)
+    {
+        return;
+    }
+    if (lastSample == std::chrono::steady_clock::time_point{})
+    {
+        lastSample = now;
+        lastSize = copiedSize;
+        lastNum = copiedNum;
+        return;
+    }
+    const double seconds = std::chrono::duration<double>(now - lastSample).count();
+    if (now - lastSample < sampleInterval || seconds <= 0.0)
+    {
+        return;
+    }
+    const double score = (static_cast<double>(copiedSize - lastSize) + static_cast<double>(copiedNum - lastNum) * fileCost) / seconds;
+    lastSample = now;
+    lastSize = copiedSize;
+    lastNum = copiedNum;
+
+    bool step{ true };
+    if (lastScore > 0.0)
+    {
+        if (score < lastScore * (1.0 - tolerance)) // The last step made it worse
+        {
+            direction = -direction;
+            stableSamples = 0U;
+        }
+        else if (score <= lastScore * (1.0 + tolerance))
+        {
+            step = (++stableSamples >= probeSamples);
+            stableSamples = step ? 0U : stableSamples;
+        }
+        else
+        {
+            stableSamples = 0U;
+        }
+    }
+    lastScore = score;
+
+    const uint32_t active = activeNum;
+    if (step)
+    {
+        if ((direction > 0 && active >= workersNum) || (direction < 0 && active <= 1U))
+        {
+            direction = -direction; // At a bound the only way is back
+        }
+        setActiveNum(direction > 0 ? active + 1U : active - 1U);
+    }
+}
+
+//===================================================================================================================================
+
+void TWorkerControl::setActiveNum(const uint32_t num)
+{
+    {
+        const std::lock_guard<std::mutex> lock(mutex);
+        activeNum.store(std::clamp(num, 1U, workersNum.load()));
+    }
+    activeChanged.notify_all();
+}
+
+//===================================================================================================================================
+
+}; // namespace CopyLib
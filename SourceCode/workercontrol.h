@@ -0,0 +1,81 @@
+#ifndef WORKERCONTROL_H
+#define WORKERCONTROL_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+namespace CopyLib {
+
+    // Adaptive number of copying workers. All the workers of a job are started, the ones with an index
+    // not below the active number park before taking the next task, their queues are drained by stealing.
+    // update samples the copy throughput (bytes and files per second) and moves the active number toward
+    // the best level: a step in the same direction while the throughput grows, back when it drops
+    // and a probe step after a few stable samples, so the level follows a changing workload.
+    class TWorkerControl
+    {
+    public:
+
+        static TWorkerControl & getInstance()
+        {
+            static TWorkerControl control;
+            return control;
+        }
+
+        // A new job with workersNum workers. Not adaptive: every worker is active.
+        void reset(const uint32_t workersNum, const bool adaptive);
+
+        // Parks the worker while it is not active. False if the copy is canceled.
+        bool waitActive(const uint32_t worker, const std::atomic<bool>& copyCancel);
+
+        // No more tasks, parked workers go on to finish
+        void finish();
+
+        // Totals copied since the job start, called periodically (the GUI timer). The active number
+        // is changed once per sampleInterval at most.
+        void update(const uint64_t copiedSize, const uint64_t copiedNum,
+                    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+        uint32_t getActiveNum() const { return activeNum; }
+
+        uint32_t getWorkersNum() const { return workersNum; }
+
+        bool isAdaptive() const { return adaptive; }
+
+        static constexpr std::chrono::milliseconds sampleInterval{ 1000 };
+
+    private:
+
+        TWorkerControl() { }
+        ~TWorkerControl() { }
+        TWorkerControl(const TWorkerControl & control) = delete;
+        TWorkerControl operator=(const TWorkerControl & control) = delete;
+
+        void setActiveNum(const uint32_t num);
+
+        const double fileCost{ 64.0 * 1024.0 }; // A file is worth as many bytes in the throughput score
+        const double tolerance{ 0.05 };         // Smaller changes of the score are noise
+        const uint32_t probeSamples{ 5U };      // Stable samples before a probe step
+
+        std::atomic<uint32_t> activeNum{ 1U };
+        std::atomic<uint32_t> workersNum{ 1U };
+        std::atomic<bool> adaptive{ false };
+        std::atomic<bool> finished{ false };
+        std::mutex mutex;
+        std::condition_variable activeChanged;
+
+        // Hill climbing state, only update touches it
+        std::chrono::steady_clock::time_point lastSample;
+        uint64_t lastSize{ 0U };
+        uint64_t lastNum{ 0U };
+        double lastScore{ 0.0 };
+        int32_t direction{ 1 };
+        uint32_t stableSamples{ 0U };
+
+    }; // TWorkerControl
+
+} // namespace CopyLib
+
+#endif // WORKERCONTROL_H